@@ -0,0 +1,192 @@
+#ifndef CBTC_EVENT_LOOP_H
+#define CBTC_EVENT_LOOP_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// Event loop shared by the CCS, zone controllers and wayside equipment. Each
+// registered fd has a handler and a context pointer; a wakeup dispatches only
+// the fds epoll reports ready, so a zone controller with thousands of trains
+// pays for the sockets that have data rather than for every connection, and
+// there is no FD_SETSIZE limit.
+//
+// Sockets are normally registered edge-triggered (EVENT_READ_EDGE). Their
+// handlers must then read until EAGAIN, e.g. with recv(..., MSG_DONTWAIT),
+// or the remaining data is not reported again. Connections with a send
+// queue also watch EPOLLOUT (EVENT_READ_WRITE_EDGE); it is reported when a
+// socket that was full has room again. Timers are timerfds whose
+// expirations the loop consumes before calling the handler.
+#define EVENT_LOOP_BATCH 64
+#define EVENT_READ (EPOLLIN | EPOLLRDHUP)
+#define EVENT_READ_EDGE (EPOLLIN | EPOLLRDHUP | EPOLLET)
+#define EVENT_READ_WRITE_EDGE (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
+
+typedef struct EventLoop EventLoop;
+typedef void (*EventHandler)(EventLoop *loop, int fd, uint32_t events, void *context);
+
+typedef struct {
+    EventHandler handler; // NULL when the fd is not registered
+    void *context;
+    uint32_t generation;  // Tells a reused fd from the one an event was queued for
+    int isTimer;
+} EventWatch;
+
+struct EventLoop {
+    int epollFd;
+    EventWatch *watches; // Indexed by fd
+    int watchCapacity;
+    int running;
+};
+
+static inline int eventLoopInit(EventLoop *loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return loop->epollFd < 0 ? -1 : 0;
+}
+
+static inline EventWatch *eventLoopWatch(EventLoop *loop, int fd) {
+    if (fd >= loop->watchCapacity) {
+        int capacity = loop->watchCapacity ? loop->watchCapacity : 64;
+        while (capacity <= fd) capacity *= 2;
+        EventWatch *grown = realloc(loop->watches, capacity * sizeof(EventWatch));
+        if (!grown) return NULL;
+        memset(grown + loop->watchCapacity, 0, (capacity - loop->watchCapacity) * sizeof(EventWatch));
+        loop->watches = grown;
+        loop->watchCapacity = capacity;
+    }
+    return &loop->watches[fd];
+}
+
+static inline int eventLoopAdd(EventLoop *loop, int fd, uint32_t events, EventHandler handler, void *context) {
+    EventWatch *watch = eventLoopWatch(loop, fd);
+    if (!watch) return -1;
+
+    watch->generation++;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.u64 = ((uint64_t)watch->generation << 32) | (uint32_t)fd;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &event) < 0) return -1;
+
+    watch->handler = handler;
+    watch->context = context;
+    watch->isTimer = 0;
+    return 0;
+}
+
+// Switch an fd to another handler, e.g. once a connection has registered
+static inline void eventLoopSetHandler(EventLoop *loop, int fd, EventHandler handler, void *context) {
+    if (fd < 0 || fd >= loop->watchCapacity || !loop->watches[fd].handler) return;
+    loop->watches[fd].handler = handler;
+    loop->watches[fd].context = context;
+}
+
+// Stop watching an fd. Call before closing it; events already fetched for it
+// in the current batch are dropped.
+static inline void eventLoopRemove(EventLoop *loop, int fd) {
+    if (fd < 0 || fd >= loop->watchCapacity || !loop->watches[fd].handler) return;
+    epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    loop->watches[fd].handler = NULL;
+    loop->watches[fd].context = NULL;
+    loop->watches[fd].generation++;
+}
+
+// Create a disarmed timer; arm it with eventLoopArmTimer. Returns its fd.
+static inline int eventLoopAddTimer(EventLoop *loop, EventHandler handler, void *context) {
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) return -1;
+    if (eventLoopAdd(loop, timerFd, EPOLLIN, handler, context) < 0) {
+        close(timerFd);
+        return -1;
+    }
+    loop->watches[timerFd].isTimer = 1;
+    return timerFd;
+}
+
+// Fire after initialMs, then every intervalMs (0 for one shot). initialMs of
+// 0 disarms the timer.
+static inline int eventLoopArmTimer(int timerFd, long initialMs, long intervalMs) {
+    struct itimerspec spec;
+    spec.it_value.tv_sec = initialMs / 1000;
+    spec.it_value.tv_nsec = (initialMs % 1000) * 1000000L;
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+    return timerfd_settime(timerFd, 0, &spec, NULL);
+}
+
+static inline void eventLoopStop(EventLoop *loop) {
+    loop->running = 0;
+}
+
+// Dispatch events until eventLoopStop is called from a handler
+static inline void eventLoopRun(EventLoop *loop) {
+    struct epoll_event events[EVENT_LOOP_BATCH];
+
+    loop->running = 1;
+    while (loop->running) {
+        int ready = epoll_wait(loop->epollFd, events, EVENT_LOOP_BATCH, -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < ready && loop->running; i++) {
+            int fd = (int)(uint32_t)events[i].data.u64;
+            uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+            if (fd >= loop->watchCapacity) continue;
+            EventWatch *watch = &loop->watches[fd];
+            if (!watch->handler || watch->generation != generation) continue; // Removed in this batch
+
+            if (watch->isTimer) {
+                uint64_t expirations;
+                if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+            }
+            watch->handler(loop, fd, events[i].events, watch->context);
+        }
+    }
+}
+
+// Close the loop and every timer it owns. Sockets stay with their owners.
+static inline void eventLoopClose(EventLoop *loop) {
+    for (int fd = 0; fd < loop->watchCapacity; fd++) {
+        if (loop->watches[fd].handler && loop->watches[fd].isTimer) close(fd);
+    }
+    free(loop->watches);
+    loop->watches = NULL;
+    loop->watchCapacity = 0;
+    if (loop->epollFd >= 0) close(loop->epollFd);
+    loop->epollFd = -1;
+}
+
+// Read one chunk from an edge-triggered socket and NUL-terminate it. Returns
+// the byte count, 0 once the socket is drained, or -1 when the peer has gone.
+static inline int eventLoopReceive(int fd, char *buffer, size_t size) {
+    while (1) {
+        ssize_t bytesRead = recv(fd, buffer, size - 1, MSG_DONTWAIT);
+        if (bytesRead > 0) {
+            buffer[bytesRead] = '\0';
+            return (int)bytesRead;
+        }
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        return -1;
+    }
+}
+
+static inline int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+#endif // CBTC_EVENT_LOOP_H
@@ -0,0 +1,54 @@
+#ifndef CBTC_LATENCY_H
+#define CBTC_LATENCY_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Latency histograms for the components' status commands. Bucket b counts
+// values below 2^b microseconds, so recording is a few instructions and a
+// percentile is read off to within a factor of two.
+#define LATENCY_BUCKETS 40
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long totalNs;
+    unsigned long long maxNs;
+    unsigned long long buckets[LATENCY_BUCKETS];
+} LatencyStats;
+
+static inline unsigned long long monotonicNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline void latencyRecord(LatencyStats *stats, unsigned long long ns) {
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && ns / 1000 >= 1ull << bucket) bucket++;
+    stats->buckets[bucket]++;
+    stats->count++;
+    stats->totalNs += ns;
+    if (ns > stats->maxNs) stats->maxNs = ns;
+}
+
+// Upper bound of the bucket holding the given percentile, in nanoseconds
+static inline unsigned long long latencyPercentile(const LatencyStats *stats, double percentile) {
+    unsigned long long target = (unsigned long long)(stats->count * percentile / 100.0);
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += stats->buckets[bucket];
+        if (seen > target) return (1ull << bucket) * 1000;
+    }
+    return stats->maxNs;
+}
+
+static inline void printLatency(const char *name, const LatencyStats *stats) {
+    if (stats->count == 0) {
+        printf("  %s: none\n", name);
+        return;
+    }
+    printf("  %s: %llu, mean %.2f ms, p99 < %.2f ms, max %.2f ms\n", name, stats->count,
+           stats->totalNs / 1e6 / stats->count, latencyPercentile(stats, 99) / 1e6, stats->maxNs / 1e6);
+}
+
+#endif // CBTC_LATENCY_H
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include "raylib.h"
+#include "rlgl.h"
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <stdio.h>
@@ -10,105 +12,393 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
 #include <pthread.h>
 #include <errno.h>
+#include <math.h>
+#include <poll.h>
+
+#include "cbtc_ready.h"
+#include "cbtc_shm.h"
+#include "cbtc_topology.h"
+#include "cbtc_zygote.h"
 
-#define MAX_LOGS 20
-#define MAX_LOG_LENGTH 100
-#define MAX_TRAINS 5
-#define MAX_SIGNALS 10
-#define MAX_SWITCHES 5
 #define MAX_ZONES 3
-#define MAX_SECTIONS 30
-#define MAX_STATIONS 6
+#define CONFIG_FILE "track_config.json"
+#define TOPOLOGY_COMPILER "./topology_compiler"
 #define TRAIN_SIZE 10
 #define STATION_WIDTH 40
 #define STATION_HEIGHT 20
-#define MAX_PROCESSES 20
+#define MAX_PROCESSES 1024
 #define BUFFER_SIZE 1024
 #define POSITION_MULTICAST_PORT 8300
+#define MAX_LOGS 8 // Lines shown in the log panel
+#define LOG_LINE_HEIGHT 16
+#define LOG_SPILL_INTERVAL_MS 50 // Well inside the time a busy run takes to lap the ring
+#define EVENT_STORE_MAGIC 0x43424556u // "CBEV"
+#define EVENT_STORE_VERSION 1
+#define EVENT_STORE_GROW_RECORDS 65536
+#define EVENT_STORE_DEFAULT_MAX_RECORDS (8ull * 1024 * 1024) // About 1 GiB of address space
+#define HEADLESS_TICK_MS 100
+#define HEADLESS_STATS_INTERVAL_S 5
+#define STALE_TRAIN_AGE_MS 1000
+#define INGEST_BATCH_SIZE 64
+#define INGEST_POLL_TIMEOUT_MS 100
+#define INGEST_SOCKET_BUFFER (4 * 1024 * 1024)
+#define POSITION_POLL_INTERVAL_MS 20 // Train table pass with the shm transport
+#define READY_TIMEOUT_MS 10000 // Per launch wave
+#define MAX_PROCESS_ARGS ZYGOTE_MAX_ARGS
+#define MAX_PROCESS_ARG_LENGTH ZYGOTE_MAX_ARG_LENGTH
+#define TRAIN_EXECUTABLE "./train"
+#define ZYGOTE_ENV "CBTC_ZYGOTE" // Set to 0 to fork and exec every train
+#define ZYGOTE_TIMEOUT_MS 2000
+#define SUPERVISOR_POLL_MS 100
+#define RESTART_BACKOFF_MIN_MS 50   // Delay before restarting a component that crash-loops
+#define RESTART_BACKOFF_MAX_MS 2000
+#define RESTART_STABLE_MS 1000      // Uptime after which a restart is not counted as a crash loop
+#define TRACK_GRID_MIN_CELL_SIZE 64.0f
+#define TRACK_GRID_MAX_CELLS (1 << 20)
+#define WORLD_VIEW_HEIGHT 420 // The log panel covers the window below this
+#define CAMERA_MIN_ZOOM 0.02f
+#define CAMERA_MAX_ZOOM 8.0f
+#define TRAIN_PX_PER_SPEED_UNIT 0.15f      // Pixels per second per km/h, as trains move themselves
+#define DEAD_RECKONING_MAX_MS 1000         // Never extrapolate further than this past a report
+#define DEAD_RECKONING_CORRECTION_MS 150.0f // Time constant for blending out prediction error
+#define DEAD_RECKONING_SNAP_PX 60.0f       // Errors larger than this are jumps, not drift
+#define RECORD_MAGIC 0x43425243u // "CBRC"
+#define RECORD_INDEX_MAGIC 0x43424b49u // "CBKI"
+#define RECORD_VERSION 1
+#define RECORD_TICK_MS 50 // Twice the default position broadcast rate
+#define RECORD_KEYFRAME_INTERVAL_MS 5000 // Bounds how many deltas a seek replays
+#define REPLAY_STEP_MS 10000 // Left/Right arrow jump
+#define REPLAY_CLOCK_BASE_NS 1000000000ull // Keeps replay report times non-zero
+#define TIMELINE_HEIGHT 22
+#define PROFILE_WINDOW 512                 // Samples kept per phase
+#define PROFILE_OVERLAY_REFRESH_MS 250
+#define DWELL_BUCKET_MS 100
+#define DWELL_HISTOGRAM_BUCKETS 1200 // Two minutes; longer stops land in the last bucket
+#define DWELL_OVERLAY_MAX_ROWS 12
+#define CIRCLE_MIN_SEGMENTS 6
+#define CIRCLE_MAX_SEGMENTS 24
+#define TRAIN_DOT_MAX_PX 3.0f     // Trains smaller than this on screen are drawn as plain dots
+#define TRAIN_ARROW_MIN_PX 5.0f   // Screen radius below which direction arrows are hidden
+#define TRAIN_LABEL_MIN_ZOOM 0.6f // Labels are hidden when zoomed out further than this
+#define TRAIN_LABEL_WIDTH 100.0f  // World-space box a label claims when decluttering
+#define TRAIN_LABEL_HEIGHT 14.0f
+#define TRAIN_LABEL_MAX 400       // Labels drawn per frame at most
+#define DECLUTTER_MAX_CELLS (1 << 16)
 
-// Shared memory structure for system state
-typedef struct {
-    // Train state
-    struct {
-        int id;
-        int zoneId;
-        int section;
-        float x;
-        float y;
-        int speed;
-        int targetSpeed;
-        int stationStopTime;
-        int stationTimer;
-        int atStation;
-        int direction;  // 1 for forward, -1 for backward
-        char color[20]; // Color name as string
-    } trains[MAX_TRAINS];
-    int trainCount;
-    
-    // Signal state
-    struct {
-        int id;
-        int zoneId;
-        int section;
-        float x;
-        float y;
-        int state; // 0=RED, 1=YELLOW, 2=GREEN
-    } signals[MAX_SIGNALS];
-    int signalCount;
-    
-    // Switch state
-    struct {
-        int id;
-        int zoneId;
-        int section;
-        float x;
-        float y;
-        int state; // 0=NORMAL, 1=REVERSE
-    } switches[MAX_SWITCHES];
-    int switchCount;
-    
-    // Log messages
-    char logs[MAX_LOGS][MAX_LOG_LENGTH];
-    int logCount;
-    
-    // Mutex
-    pthread_mutex_t mutex;
-} SharedState;
-
-// Track segments for visualization
+// Track geometry loaded from the config, one entry per section. Kept as
+// structure-of-arrays so culling only walks the arrays it needs.
 typedef struct {
-    Vector2 start;
-    Vector2 end;
-    int zoneId;
-    int section;
-} TrackSegment;
+    int count;
+    float *x0, *y0, *x1, *y1;
+    int *section;
+    int *zoneId;
+    Rectangle extent;           // Bounding box of the whole network
+    int *sectionLookup;         // Section id -> segment index, -1 if unknown
+    int maxSectionId;
+    // Uniform grid: the segments touching cell c are
+    // cellItems[cellStart[c]] .. cellItems[cellStart[c + 1] - 1]
+    float cellSize;
+    int gridColumns;
+    int gridRows;
+    int *cellStart;
+    int *cellItems;
+    unsigned int *visitMark;    // Drops duplicates for segments spanning several cells
+    unsigned int visitEpoch;
+    int *visible;               // Result buffer for trackGeometryQuery
+} TrackGeometry;
 
 // Station information
 typedef struct {
     int id;
     Vector2 position;
-    const char *name;
+    char name[32];
     int section;
     int stopTime; // in seconds
     Rectangle bounds;
 } Station;
 
+// Render-side motion model for one train table slot, used to extrapolate
+// between position reports
+typedef struct {
+    unsigned long long updateNs;     // Receive time of the report below, 0 if none yet
+    unsigned long long correctionNs; // When the current correction started
+    float baseX, baseY;              // Reported position
+    float headingX, headingY;        // Unit vector of travel
+    float velocity;                  // Pixels per second
+    float errorX, errorY;            // Drawn minus predicted when the report arrived
+    float drawX, drawY;              // Last drawn position
+    int direction;
+    Color color;                     // Resolved from the slot's colour name; alpha 0 until then
+} TrainMotion;
+
+// Per-frame occupancy grid over the visible world, used to hide arrows and
+// labels of entities that would overlap ones already drawn
+typedef struct {
+    float originX, originY;
+    float cellWidth, cellHeight;
+    int columns, rows;
+    unsigned int *stamp; // Cell is taken this frame when stamp == epoch
+    unsigned int epoch;
+    int capacity;
+} DeclutterGrid;
+
+// Heatmap figures for one section, kept up to date by whoever applies
+// position updates so nothing is recomputed per frame
+typedef struct {
+    unsigned long long occupancyNs; // Train-time spent on the section
+    unsigned int traversals;        // Times a train entered the section
+    unsigned int speedSamples;
+    unsigned long long speedSum;    // Over every update reported on the section
+} SectionStats;
+
+// What the section statistics last saw of one train table slot
+typedef struct {
+    unsigned long long updateNs;     // 0 before the first update
+    unsigned long long dwellStartNs; // When the current station stop began
+    int section;                     // -1 if not on a known section
+    int atStation;
+    int dwellStation;                // Index into stations, -1 if the stop is not timed
+} TrainOccupancy;
+
+// Dwell times at one station. The histogram gives percentiles without
+// keeping every stop.
+typedef struct {
+    unsigned int count;
+    unsigned int minMs, maxMs;
+    unsigned long long totalMs;
+    unsigned int histogram[DWELL_HISTOGRAM_BUCKETS]; // DWELL_BUCKET_MS wide
+} DwellStats;
+
+typedef enum {
+    HEATMAP_OFF,
+    HEATMAP_OCCUPANCY,
+    HEATMAP_TRAVERSALS,
+    HEATMAP_SPEED,
+    HEATMAP_MODE_COUNT
+} HeatmapMode;
+
+// Event store file layout: a header followed by fixed-size records in append
+// order, so record n sits at a fixed offset and can be fetched directly
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int recordSize;
+    unsigned int reserved;
+    unsigned long long count; // Committed records; readers never look past this
+    unsigned long long lost;  // Ring messages overwritten before they were stored
+} EventStoreHeader;
+
+typedef struct {
+    unsigned long long monotonicNs;
+    unsigned int timestamp;
+    unsigned char component;
+    unsigned char severity;
+    unsigned short reserved;
+    int trainId;
+    int zoneId;
+    char text[MAX_LOG_LENGTH];
+} EventRecord;
+
+// Record numbers of matching events, ascending because the store is append-only
+typedef struct {
+    unsigned int *items;
+    unsigned int count;
+    unsigned int capacity;
+} PostingList;
+
+typedef struct {
+    int trainId; // 0 marks a free slot
+    PostingList events;
+} TrainPostings;
+
+// Append-only event store spilled from the log ring, with in-memory posting
+// lists per component and per train. The file is mapped for maxRecords up
+// front and grown with ftruncate, so record pointers stay valid.
+typedef struct {
+    int fd;
+    EventStoreHeader *header;
+    EventRecord *records;
+    size_t mappedBytes;
+    unsigned long long capacity;  // Records backed by the file
+    unsigned long long maxRecords;
+    pthread_mutex_t indexLock;    // Posting lists grow on the spill thread
+    PostingList byComponent[LOG_COMPONENT_COUNT];
+    TrainPostings *byTrain;       // Open addressing, trainSlots is a power of two
+    unsigned int trainSlots;
+    unsigned int trainCount;
+} EventStore;
+
+// What the log panel shows. With a train selected the component filter is
+// ignored. end is the filtered position one past the bottom line, or -1 to
+// follow new events.
+typedef struct {
+    int component; // -1 for all
+    int trainId;   // 0 for all
+    long long end;
+} LogFilter;
+
+// Recording file layout: a RecordingHeader, frames in time order, then the
+// keyframe index and a RecordingTrailer. Each frame is a RecordFrame followed
+// by count entries of the type's record. A keyframe is a RECORD_KEYFRAME frame
+// followed by frames holding the complete state at the same time, so playback
+// can start from any keyframe.
+typedef enum {
+    RECORD_KEYFRAME = 1,
+    RECORD_TRAIN_INFO, // RecordedTrainInfo, when a train first appears and in keyframes
+    RECORD_TRAINS,     // RecordedTrain, trains with a new position report
+    RECORD_SIGNALS,    // RecordedDevice
+    RECORD_SWITCHES    // RecordedDevice
+} RecordType;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int tickMs;
+    unsigned int keyframeIntervalMs;
+    unsigned long long startTime; // Unix time the recording started
+} RecordingHeader;
+
+typedef struct {
+    unsigned short type;
+    unsigned short reserved;
+    unsigned int count;
+    unsigned long long timeMs; // Since the start of the recording
+} RecordFrame;
+
+typedef struct {
+    int id;
+    int zoneId;
+    int section;
+    int speed;
+    int direction;
+    int atStation;
+    float x;
+    float y;
+} RecordedTrain;
+
+typedef struct {
+    int id;
+    char color[20];
+} RecordedTrainInfo;
+
+typedef struct {
+    int id;
+    int state;
+} RecordedDevice;
+
+typedef struct {
+    unsigned long long timeMs;
+    unsigned long long offset; // Of the RECORD_KEYFRAME frame
+} KeyframeIndexEntry;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int count;
+    unsigned long long indexOffset;
+    unsigned long long durationMs;
+} RecordingTrailer;
+
+// Live recording: the recorder thread samples the train table and the
+// signal/switch state every RECORD_TICK_MS and writes what changed
+typedef struct {
+    FILE *file;
+    unsigned long long startNs;
+    unsigned long long lastTimeMs;
+    KeyframeIndexEntry *index;
+    unsigned int indexCount;
+    unsigned int indexCapacity;
+    TrainSlot *trains;             // Snapshot buffers, grown with the train table
+    RecordedTrain *changed;
+    RecordedTrainInfo *infos;
+    unsigned long long *recordedNs; // Report time last recorded, per slot
+    int capacity;
+    int knownTrains;               // Slots whose RECORD_TRAIN_INFO has been written
+    SystemState lastState;
+} Recorder;
+
+// Playback of a recording, mapped read-only. The shared state and train table
+// are driven from it, so the normal renderer draws the replay.
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    unsigned long long framesEnd;
+    KeyframeIndexEntry *index;
+    unsigned int indexCount;
+    int ownsIndex;                 // Rebuilt by scanning rather than read from the file
+    unsigned long long durationMs;
+    unsigned long long cursor;     // Offset of the next frame to apply
+    double appliedMs;              // State is current up to this time
+    double positionMs;
+    int speedStep;
+    int playing;
+    unsigned long long lastTickNs;
+} Replay;
+
+// Phases timed by the profiler. The ingest phase is recorded by the ingest
+// thread, everything else by the render loop.
+typedef enum {
+    PHASE_FRAME,
+    PHASE_CAMERA,
+    PHASE_BAKE,
+    PHASE_STATE_SNAPSHOT,
+    PHASE_TRAIN_SNAPSHOT,
+    PHASE_EXTRAPOLATE,
+    PHASE_COMPOSITE,
+    PHASE_HEATMAP,
+    PHASE_SIGNALS,
+    PHASE_SWITCHES,
+    PHASE_TRAINS,
+    PHASE_LOGS,
+    PHASE_STATUS,
+    PHASE_OVERLAY,
+    PHASE_END_DRAWING,
+    PHASE_INGEST_BATCH,
+    PHASE_COUNT
+} ProfilePhase;
+
+// Rolling window of the most recent samples for one phase, in microseconds
+typedef struct {
+    double samples[PROFILE_WINDOW];
+    unsigned int next;
+    unsigned long long total;
+} PhaseProfile;
+
+typedef struct {
+    unsigned long long samples;
+    double p50, p99, max;
+} PhaseStats;
+
 // Process management
 typedef struct {
     char name[32];
     pid_t pid;
     int running;
+    int ready; // Reported readiness over the ready pipe
+    char executable[MAX_PROCESS_ARG_LENGTH];
+    char args[MAX_PROCESS_ARGS][MAX_PROCESS_ARG_LENGTH];
+    char *argv[MAX_PROCESS_ARGS + 1]; // Points into args, kept for restarts
+    unsigned long long startedNs;
+    // Supervisor bookkeeping
+    int restarts;
+    unsigned long long exitNs;        // When the last exit was seen, 0 once recovered
+    unsigned long long restartDueNs;  // Pending restart time, 0 if none
+    unsigned int backoffMs;
+    unsigned int lastRecoveryMs;      // Exit to ready, for the last restart
+    unsigned int maxRecoveryMs;
 } ProcessInfo;
 
 // Global variables
-TrackSegment trackSegments[MAX_SECTIONS];
-Station stations[MAX_STATIONS];
-int trackSegmentCount = 0;
+TrackGeometry track;
+Station *stations = NULL;
 int stationCount = 0;
+Rectangle zoneExtents[MAX_ZONES + 1]; // Indexed by zone id; width 0 if the zone has no track
+Camera2D camera = {{0, 0}, {0, 0}, 0, 1.0f};
 ProcessInfo processes[MAX_PROCESSES];
 int processCount = 0;
 SharedState *sharedState;
@@ -117,6 +407,81 @@ const char *shmName = "/cbtc_state";
 int isCleanupDone = 0;  // Flag to prevent multiple cleanups
 int positionMulticastSocket;
 const char *positionMulticastGroup = "239.0.0.1";
+pthread_t ingestThread;
+int ingestRunning = 0;
+int ingestStarted = 0;
+int positionTransportShm = 0; // Trains write the train table directly (POSITION_TRANSPORT=shm)
+TrainTable trainTable = {-1, MAP_FAILED, 0};
+pthread_t logSpillThreadId;
+int logSpillRunning = 0;
+FILE *logSpillFile = NULL;
+EventStore eventStore = {.fd = -1};
+LogFilter logFilter = {-1, 0, -1};
+const char *componentNames[LOG_COMPONENT_COUNT] = {"ORCH", "CCS", "ZC", "WAYSIDE", "TRAIN"};
+int isHeadless = 0;
+volatile sig_atomic_t stopSignal = 0; // SIGINT/SIGTERM seen; the main thread tears down
+int readyPipe[2] = {-1, -1}; // Components report readiness on readyPipe[1]
+pthread_t supervisorThreadId;
+int supervisorRunning = 0;
+int supervisorStarted = 0;
+int childSignalFd = -1;
+int configWatchFd = -1;  // inotify on CONFIG_FILE, read by the supervisor
+pid_t compilerPid = 0;   // Topology compiler started by the supervisor, 0 if none
+int recompilePending = 0; // The config changed again while compiling
+int totalRestarts = 0;
+int zygoteSocket = -1; // Spawn requests to the train zygote, -1 if not running
+pid_t zygotePid = -1;
+pthread_mutex_t zygoteLock = PTHREAD_MUTEX_INITIALIZER; // Launches and restarts share the socket
+RenderTexture2D staticLayer = {0};
+int staticLayerDirty = 1; // Set whenever the static layer must be rebaked
+PhaseProfile profile[PHASE_COUNT];
+int showProfiler = 0;
+const char *profileCsvPath = NULL;
+const char *phaseNames[PHASE_COUNT] = {
+    "frame", "camera", "static bake", "state snapshot", "train snapshot", "extrapolate",
+    "composite", "heatmap", "signals", "switches", "trains", "log lines", "status text",
+    "profiler overlay", "EndDrawing", "ingest batch",
+};
+const char *trainShmName = "/cbtc_trains";
+const char *recordPath = NULL;
+Recorder recorder;
+pthread_t recorderThreadId;
+int recorderRunning = 0;
+int recorderStarted = 0;
+const char *replayPath = NULL;
+int replayMode = 0;
+Replay replay;
+const double replaySpeeds[] = {0.25, 0.5, 1, 2, 5, 10, 30, 60};
+SectionStats *sectionStats = NULL;     // Indexed by section id
+int *stationForSection = NULL;         // Section id -> station index, -1 if none
+TrainOccupancy *trainOccupancy = NULL; // Indexed by train table slot
+DwellStats *dwellStats = NULL;         // Indexed like stations
+unsigned long long heatmapMaxOccupancyNs = 0; // Top of the heatmap colour scales
+unsigned int heatmapMaxTraversals = 0;
+int heatmapMaxSpeed = 0;
+HeatmapMode heatmapMode = HEATMAP_OFF;
+const char *heatmapModeNames[HEATMAP_MODE_COUNT] = {"off", "occupancy", "traversals", "mean speed"};
+DeclutterGrid arrowGrid;
+DeclutterGrid labelGrid;
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+unsigned long long monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Record the time since *mark against phase and move the mark to now, so
+// consecutive phases can be timed with one clock read each
+void profilePhase(ProfilePhase phase, unsigned long long *mark) {
+    unsigned long long now = monotonicNs();
+    PhaseProfile *p = &profile[phase];
+    unsigned int slot = __atomic_load_n(&p->next, __ATOMIC_RELAXED) % PROFILE_WINDOW;
+    p->samples[slot] = (now - *mark) / 1000.0;
+    __atomic_store_n(&p->next, slot + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&p->total, 1, __ATOMIC_RELAXED);
+    *mark = now;
+}
 
 // Function to initialize shared memory
 void initSharedMemory() {
@@ -151,280 +516,766 @@ void initSharedMemory() {
     // Initialize shared memory
     memset(sharedState, 0, sizeof(SharedState));
     
-    // Initialize mutex with shared attribute
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&sharedState->mutex, &attr);
-    pthread_mutexattr_destroy(&attr);
+    // Create the train table, sized for the largest fleet we may see
+    unsigned int maxTrains = TRAIN_TABLE_DEFAULT_MAX_CAPACITY;
+    const char *maxTrainsStr = getenv("CBTC_MAX_TRAINS");
+    if (maxTrainsStr && atoi(maxTrainsStr) > 0) {
+        maxTrains = atoi(maxTrainsStr);
+    }
+    if (trainTableCreate(&trainTable, trainShmName, maxTrains) != 0) {
+        munmap(sharedState, sizeof(SharedState));
+        close(shmFd);
+        shm_unlink(shmName);
+        exit(EXIT_FAILURE);
+    }
     
-    printf("Shared memory initialized\n");
+    printf("Shared memory initialized (train table up to %u trains)\n",
+           trainTable.header->maxCapacity);
 }
 
 // Function to add a log to the shared state
 void addLog(const char *message) {
-    pthread_mutex_lock(&sharedState->mutex);
+    logRingAppend(&sharedState->log, message);
+}
+
+// Log an orchestrator event with a severity
+void addLogEvent(LogSeverity severity, const char *message) {
+    logRingAppendEvent(&sharedState->log, LOG_COMPONENT_ORCHESTRATOR, severity, 0, 0, message);
+}
+
+// Format a log timestamp as HH:MM:SS, converting each second only once
+void formatLogTime(unsigned int timestamp, char *out, size_t size) {
+    static __thread unsigned int cachedTimestamp = 0;
+    static __thread char cached[20] = "";
+    
+    if (timestamp != cachedTimestamp) {
+        time_t seconds = timestamp;
+        struct tm timeinfo;
+        localtime_r(&seconds, &timeinfo);
+        strftime(cached, sizeof(cached), "%H:%M:%S", &timeinfo);
+        cachedTimestamp = timestamp;
+    }
+    snprintf(out, size, "%s", cached);
+}
+
+static int postingListAppend(PostingList *list, unsigned int record) {
+    if (list->count == list->capacity) {
+        unsigned int capacity = list->capacity ? list->capacity * 2 : 256;
+        unsigned int *grown = realloc(list->items, capacity * sizeof(unsigned int));
+        if (!grown) return -1;
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = record;
+    return 0;
+}
+
+// First position in list whose record number is >= record
+static unsigned int postingListLowerBound(const PostingList *list, unsigned long long record) {
+    unsigned int low = 0, high = list->count;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if (list->items[mid] < record) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Posting list for a train, created on first use. Called with indexLock held.
+static PostingList *eventStoreTrainList(EventStore *store, int trainId, int create) {
+    if (create && (store->trainCount + 1) * 4 > store->trainSlots * 3) {
+        unsigned int slots = store->trainSlots ? store->trainSlots * 2 : 64;
+        TrainPostings *table = calloc(slots, sizeof(TrainPostings));
+        if (!table) return NULL;
+        for (unsigned int i = 0; i < store->trainSlots; i++) {
+            if (!store->byTrain[i].trainId) continue;
+            unsigned int j = trainTableHash(store->byTrain[i].trainId, slots);
+            while (table[j].trainId) j = (j + 1) & (slots - 1);
+            table[j] = store->byTrain[i];
+        }
+        free(store->byTrain);
+        store->byTrain = table;
+        store->trainSlots = slots;
+    }
+    if (!store->trainSlots) return NULL;
+    
+    unsigned int i = trainTableHash(trainId, store->trainSlots);
+    while (store->byTrain[i].trainId) {
+        if (store->byTrain[i].trainId == trainId) return &store->byTrain[i].events;
+        i = (i + 1) & (store->trainSlots - 1);
+    }
+    if (!create) return NULL;
+    store->byTrain[i].trainId = trainId;
+    store->trainCount++;
+    return &store->byTrain[i].events;
+}
+
+// Create the event store file, truncating any previous run's events
+int eventStoreOpen(EventStore *store, const char *path, unsigned long long maxRecords) {
+    store->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (store->fd == -1) {
+        perror("Opening event store failed");
+        return -1;
+    }
     
-    if (sharedState->logCount >= MAX_LOGS) {
-        // Shift logs up
-        for (int i = 0; i < MAX_LOGS - 1; i++) {
-            strcpy(sharedState->logs[i], sharedState->logs[i + 1]);
+    store->maxRecords = maxRecords;
+    store->capacity = EVENT_STORE_GROW_RECORDS < maxRecords ? EVENT_STORE_GROW_RECORDS : maxRecords;
+    store->mappedBytes = sizeof(EventStoreHeader) + maxRecords * sizeof(EventRecord);
+    if (ftruncate(store->fd, sizeof(EventStoreHeader) + store->capacity * sizeof(EventRecord)) == -1) {
+        perror("Sizing event store failed");
+        close(store->fd);
+        store->fd = -1;
+        return -1;
+    }
+    
+    void *base = mmap(NULL, store->mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Mapping event store failed");
+        close(store->fd);
+        store->fd = -1;
+        return -1;
+    }
+    store->header = base;
+    store->records = (EventRecord *)((char *)base + sizeof(EventStoreHeader));
+    store->header->magic = EVENT_STORE_MAGIC;
+    store->header->version = EVENT_STORE_VERSION;
+    store->header->recordSize = sizeof(EventRecord);
+    pthread_mutex_init(&store->indexLock, NULL);
+    return 0;
+}
+
+// Append one ring entry and index it. Only the spill thread appends.
+static void eventStoreAppend(EventStore *store, const LogEntry *entry) {
+    unsigned long long count = store->header->count;
+    if (count == store->capacity) {
+        unsigned long long capacity = store->capacity * 2;
+        if (capacity > store->maxRecords) capacity = store->maxRecords;
+        if (capacity == store->capacity ||
+            ftruncate(store->fd, sizeof(EventStoreHeader) + capacity * sizeof(EventRecord)) == -1) {
+            store->header->lost++;
+            return;
         }
-        sharedState->logCount = MAX_LOGS - 1;
+        store->capacity = capacity;
     }
     
-    time_t now = time(NULL);
-    struct tm *timeinfo = localtime(&now);
-    char timestamp[20];
-    strftime(timestamp, sizeof(timestamp), "%H:%M:%S", timeinfo);
+    EventRecord *record = &store->records[count];
+    record->monotonicNs = entry->monotonicNs;
+    record->timestamp = entry->timestamp;
+    record->component = entry->component;
+    record->severity = entry->severity;
+    record->trainId = entry->trainId;
+    record->zoneId = entry->zoneId;
+    memcpy(record->text, entry->text, sizeof(record->text));
+    
+    pthread_mutex_lock(&store->indexLock);
+    if (entry->component < LOG_COMPONENT_COUNT) {
+        postingListAppend(&store->byComponent[entry->component], (unsigned int)count);
+    }
+    if (entry->trainId) {
+        PostingList *list = eventStoreTrainList(store, entry->trainId, 1);
+        if (list) postingListAppend(list, (unsigned int)count);
+    }
+    pthread_mutex_unlock(&store->indexLock);
+    
+    __atomic_store_n(&store->header->count, count + 1, __ATOMIC_RELEASE);
+}
+
+void eventStoreClose(EventStore *store) {
+    if (store->fd == -1) return;
+    
+    // Trim the file to the records actually written
+    unsigned long long count = store->header->count;
+    msync(store->header, sizeof(EventStoreHeader) + count * sizeof(EventRecord), MS_ASYNC);
+    munmap(store->header, store->mappedBytes);
+    if (ftruncate(store->fd, sizeof(EventStoreHeader) + count * sizeof(EventRecord)) == -1) {
+        perror("Trimming event store failed");
+    }
+    close(store->fd);
+    store->fd = -1;
+    
+    for (int i = 0; i < LOG_COMPONENT_COUNT; i++) {
+        free(store->byComponent[i].items);
+    }
+    for (unsigned int i = 0; i < store->trainSlots; i++) {
+        free(store->byTrain[i].events.items);
+    }
+    free(store->byTrain);
+    pthread_mutex_destroy(&store->indexLock);
+}
+
+// Copy the lines the panel should show for filter, oldest first. Sets *total
+// to the number of events matching the filter. Constant time in the size of
+// the store; only the visible records are touched.
+int eventStoreQuery(EventStore *store, const LogFilter *filter, EventRecord *out, int maxLines,
+                    unsigned long long *total) {
+    unsigned int positions[MAX_LOGS];
+    unsigned long long committed = __atomic_load_n(&store->header->count, __ATOMIC_ACQUIRE);
+    unsigned long long end, start;
+    int count = 0;
+    
+    if (maxLines > MAX_LOGS) maxLines = MAX_LOGS;
+    pthread_mutex_lock(&store->indexLock);
+    const PostingList *list = NULL;
+    if (filter->trainId) {
+        list = eventStoreTrainList(store, filter->trainId, 0);
+    } else if (filter->component >= 0) {
+        list = &store->byComponent[filter->component];
+    }
+    
+    if (filter->trainId || filter->component >= 0) {
+        // Entries past the committed count are indexed but not yet visible
+        *total = list ? postingListLowerBound(list, committed) : 0;
+    } else {
+        *total = committed;
+    }
+    end = filter->end < 0 || (unsigned long long)filter->end > *total ? *total : (unsigned long long)filter->end;
+    start = end > (unsigned long long)maxLines ? end - maxLines : 0;
+    for (unsigned long long i = start; i < end; i++) {
+        positions[count++] = list ? list->items[i] : (unsigned int)i;
+    }
+    pthread_mutex_unlock(&store->indexLock);
+    
+    for (int i = 0; i < count; i++) {
+        out[i] = store->records[positions[i]];
+    }
+    return count;
+}
+
+// Record number one past the bottom line of the panel, so a filter change
+// can keep the same moment in view. -1 when following new events.
+static long long logPanelAnchor(EventStore *store) {
+    if (logFilter.end < 0) return -1;
+    if (!logFilter.trainId && logFilter.component < 0) return logFilter.end;
+    
+    pthread_mutex_lock(&store->indexLock);
+    const PostingList *list = logFilter.trainId ? eventStoreTrainList(store, logFilter.trainId, 0)
+                                                : &store->byComponent[logFilter.component];
+    long long record = 0;
+    if (list && logFilter.end > 0) {
+        unsigned int end = logFilter.end < list->count ? (unsigned int)logFilter.end : list->count;
+        record = end ? (long long)list->items[end - 1] + 1 : 0;
+    }
+    pthread_mutex_unlock(&store->indexLock);
+    return record;
+}
+
+// Switch filters, keeping the same point in time at the bottom of the panel.
+// Finding it in the new posting list is a binary search.
+void setLogFilter(int component, int trainId) {
+    long long anchor = eventStore.fd != -1 ? logPanelAnchor(&eventStore) : -1;
+    logFilter.component = component;
+    logFilter.trainId = trainId;
+    if (anchor < 0) {
+        logFilter.end = -1;
+        return;
+    }
+    
+    if (!trainId && component < 0) {
+        logFilter.end = anchor;
+        return;
+    }
+    pthread_mutex_lock(&eventStore.indexLock);
+    const PostingList *list = trainId ? eventStoreTrainList(&eventStore, trainId, 0)
+                                      : &eventStore.byComponent[component];
+    logFilter.end = list ? postingListLowerBound(list, (unsigned long long)anchor) : 0;
+    pthread_mutex_unlock(&eventStore.indexLock);
+}
+
+// Copy log messages from the ring into the event store and, if configured,
+// the text spill file. The ring is read behind the writers' backs, so
+// appending never waits for the disk.
+void *logSpillThread(void *arg) {
+    (void)arg;
+    unsigned long long cursor = 0;
+    
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    for (;;) {
+        int running = __atomic_load_n(&logSpillRunning, __ATOMIC_ACQUIRE);
+        unsigned long long head = __atomic_load_n(&sharedState->log.head, __ATOMIC_ACQUIRE);
+        
+        if (head - cursor > LOG_RING_SIZE) {
+            unsigned long long lost = head - cursor - LOG_RING_SIZE;
+            if (logSpillFile) fprintf(logSpillFile, "[log spill lost %llu messages]\n", lost);
+            if (eventStore.fd != -1) eventStore.header->lost += lost;
+            cursor = head - LOG_RING_SIZE;
+        }
+        
+        while (cursor < head) {
+            LogEntry entry;
+            if (!logRingRead(&sharedState->log, cursor, &entry)) {
+                // Still being written: wait for it unless the writer looks stuck
+                unsigned long long sequence = __atomic_load_n(
+                    &sharedState->log.entries[cursor & (LOG_RING_SIZE - 1)].sequence, __ATOMIC_ACQUIRE);
+                if (sequence < 2 * cursor + 2 && head - cursor < LOG_RING_SIZE / 2) break;
+                cursor++;
+                continue;
+            }
+            if (eventStore.fd != -1) {
+                eventStoreAppend(&eventStore, &entry);
+            }
+            if (logSpillFile) {
+                char timestamp[20];
+                formatLogTime(entry.timestamp, timestamp, sizeof(timestamp));
+                fprintf(logSpillFile, "[%s] %s\n", timestamp, entry.text);
+            }
+            cursor++;
+        }
+        if (logSpillFile) fflush(logSpillFile);
+        
+        if (!running) break;
+        usleep(LOG_SPILL_INTERVAL_MS * 1000);
+    }
+    
+    return NULL;
+}
+
+// Start spilling the log ring into the event store (CBTC_EVENT_STORE, default
+// cbtc_events.bin) and, if CBTC_LOG_FILE is set, a plain text file
+void startLogSpill() {
+    const char *storePath = getenv("CBTC_EVENT_STORE");
+    if (!storePath || !*storePath) storePath = "cbtc_events.bin";
+    unsigned long long maxRecords = EVENT_STORE_DEFAULT_MAX_RECORDS;
+    const char *maxStr = getenv("CBTC_EVENT_STORE_MAX");
+    if (maxStr && strtoull(maxStr, NULL, 10) > 0) maxRecords = strtoull(maxStr, NULL, 10);
+    if (eventStoreOpen(&eventStore, storePath, maxRecords) == 0) {
+        printf("Storing events in %s\n", storePath);
+    }
+    
+    const char *path = getenv("CBTC_LOG_FILE");
+    if (path && *path) {
+        logSpillFile = fopen(path, "a");
+        if (!logSpillFile) {
+            perror("Opening log spill file failed");
+        } else {
+            printf("Spilling logs to %s\n", path);
+        }
+    }
+    if (eventStore.fd == -1 && !logSpillFile) {
+        return;
+    }
+    
+    __atomic_store_n(&logSpillRunning, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&logSpillThreadId, NULL, logSpillThread, NULL) != 0) {
+        perror("Failed to start log spill thread");
+        __atomic_store_n(&logSpillRunning, 0, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+// Stop the log spill thread after it has written everything logged so far
+void stopLogSpill() {
+    if (__atomic_load_n(&logSpillRunning, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&logSpillRunning, 0, __ATOMIC_RELEASE);
+        pthread_join(logSpillThreadId, NULL);
+    }
+    if (logSpillFile) {
+        fclose(logSpillFile);
+        logSpillFile = NULL;
+    }
+    eventStoreClose(&eventStore);
+}
+
+// Segment index for a section id, or -1
+int trackSegmentForSection(int section) {
+    if (section < 0 || section > track.maxSectionId) return -1;
+    return track.sectionLookup[section];
+}
+
+// Bucket every segment into the uniform grid cells its bounding box touches
+static void buildTrackGrid() {
+    float width = track.extent.width + 1.0f;
+    float height = track.extent.height + 1.0f;
+    
+    // Aim for about one segment per cell, without letting the grid run away
+    track.cellSize = sqrtf(width * height / (track.count ? track.count : 1));
+    if (track.cellSize < TRACK_GRID_MIN_CELL_SIZE) track.cellSize = TRACK_GRID_MIN_CELL_SIZE;
+    for (;;) {
+        track.gridColumns = (int)ceilf(width / track.cellSize);
+        track.gridRows = (int)ceilf(height / track.cellSize);
+        if ((long)track.gridColumns * track.gridRows <= TRACK_GRID_MAX_CELLS) break;
+        track.cellSize *= 2.0f;
+    }
+    
+    int cellCount = track.gridColumns * track.gridRows;
+    track.cellStart = calloc(cellCount + 1, sizeof(int));
+    if (!track.cellStart) {
+        perror("Track grid allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Two passes: count per cell, then fill in prefix-sum order
+    for (int pass = 0; pass < 2; pass++) {
+        int *cursor = NULL;
+        if (pass == 1) {
+            for (int c = 0; c < cellCount; c++) {
+                track.cellStart[c + 1] += track.cellStart[c];
+            }
+            track.cellItems = malloc((track.cellStart[cellCount] + 1) * sizeof(int));
+            cursor = malloc(cellCount * sizeof(int));
+            if (!track.cellItems || !cursor) {
+                perror("Track grid allocation failed");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(cursor, track.cellStart, cellCount * sizeof(int));
+        }
+        
+        for (int i = 0; i < track.count; i++) {
+            int colStart = (int)((fminf(track.x0[i], track.x1[i]) - track.extent.x) / track.cellSize);
+            int colEnd = (int)((fmaxf(track.x0[i], track.x1[i]) - track.extent.x) / track.cellSize);
+            int rowStart = (int)((fminf(track.y0[i], track.y1[i]) - track.extent.y) / track.cellSize);
+            int rowEnd = (int)((fmaxf(track.y0[i], track.y1[i]) - track.extent.y) / track.cellSize);
+            for (int row = rowStart; row <= rowEnd && row < track.gridRows; row++) {
+                for (int col = colStart; col <= colEnd && col < track.gridColumns; col++) {
+                    int cell = row * track.gridColumns + col;
+                    if (pass == 0) {
+                        track.cellStart[cell + 1]++;
+                    } else {
+                        track.cellItems[cursor[cell]++] = i;
+                    }
+                }
+            }
+        }
+        free(cursor);
+    }
+}
+
+// Collect the segments whose cells intersect view into track.visible.
+// Returns how many there are.
+int trackGeometryQuery(Rectangle view) {
+    int colStart = (int)floorf((view.x - track.extent.x) / track.cellSize);
+    int colEnd = (int)floorf((view.x + view.width - track.extent.x) / track.cellSize);
+    int rowStart = (int)floorf((view.y - track.extent.y) / track.cellSize);
+    int rowEnd = (int)floorf((view.y + view.height - track.extent.y) / track.cellSize);
+    if (colStart < 0) colStart = 0;
+    if (rowStart < 0) rowStart = 0;
+    if (colEnd >= track.gridColumns) colEnd = track.gridColumns - 1;
+    if (rowEnd >= track.gridRows) rowEnd = track.gridRows - 1;
+    
+    if (++track.visitEpoch == 0) {
+        memset(track.visitMark, 0, track.count * sizeof(unsigned int));
+        track.visitEpoch = 1;
+    }
+    
+    int visibleCount = 0;
+    for (int row = rowStart; row <= rowEnd; row++) {
+        for (int col = colStart; col <= colEnd; col++) {
+            int cell = row * track.gridColumns + col;
+            for (int k = track.cellStart[cell]; k < track.cellStart[cell + 1]; k++) {
+                int i = track.cellItems[k];
+                if (track.visitMark[i] != track.visitEpoch) {
+                    track.visitMark[i] = track.visitEpoch;
+                    track.visible[visibleCount++] = i;
+                }
+            }
+        }
+    }
+    return visibleCount;
+}
+
+// In a forked child before exec: start with no signals blocked. Every
+// orchestrator thread blocks SIGCHLD and the background threads also block
+// SIGINT and SIGTERM; a blocked mask survives exec, and the components rely
+// on the default actions to stop.
+void resetChildSignalMask() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+}
+
+// Run topology_compiler on CONFIG_FILE. Returns its pid, or -1.
+pid_t startTopologyCompiler() {
+    const char *imagePath = topologyImagePath();
+    printf("Compiling %s into %s\n", CONFIG_FILE, imagePath);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        resetChildSignalMask();
+        execl(TOPOLOGY_COMPILER, TOPOLOGY_COMPILER, CONFIG_FILE, imagePath, (char *)NULL);
+        perror("Exec of topology compiler failed");
+        _exit(127);
+    }
+    return pid;
+}
+
+// Compile the topology image if it is missing, stale or of another version.
+// Runs before any component starts, so they all map the same image.
+void ensureTopologyImage() {
+    const char *imagePath = topologyImagePath();
+    struct stat configInfo, imageInfo;
+    int haveConfig = stat(CONFIG_FILE, &configInfo) == 0;
+    if (stat(imagePath, &imageInfo) == 0 &&
+        (!haveConfig || imageInfo.st_mtim.tv_sec > configInfo.st_mtim.tv_sec ||
+         (imageInfo.st_mtim.tv_sec == configInfo.st_mtim.tv_sec &&
+          imageInfo.st_mtim.tv_nsec >= configInfo.st_mtim.tv_nsec))) {
+        Topology probe;
+        if (topologyOpen(&probe, imagePath) == 0) {
+            topologyClose(&probe);
+            return;
+        }
+    }
+    if (!haveConfig) {
+        fprintf(stderr, "No %s to compile %s from\n", CONFIG_FILE, imagePath);
+        exit(EXIT_FAILURE);
+    }
+    
+    pid_t pid = startTopologyCompiler();
+    if (pid < 0) {
+        exit(EXIT_FAILURE);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Compiling %s failed\n", CONFIG_FILE);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Initialize signals in shared memory from the topology image. Runs before
+// any wayside process exists, so the orchestrator is still each slot's only
+// writer; each wayside process then reports its real state.
+void initializeSignals(const Topology *topology) {
+    int count = topology->header->signalCount;
+    if (count > MAX_SIGNALS) {
+        fprintf(stderr, "%d signals in the topology, only the first %d are run\n", count, MAX_SIGNALS);
+        count = MAX_SIGNALS;
+    }
     
-    snprintf(sharedState->logs[sharedState->logCount], MAX_LOG_LENGTH, 
-             "[%s] %s", timestamp, message);
-    sharedState->logCount++;
+    for (int i = 0; i < count; i++) {
+        const TopologySignal *signal = &topology->signals[i];
+        SignalSlot *slot = &sharedState->signals[i];
+        seqWriteBegin(&slot->sequence);
+        slot->device = (SignalState){signal->id, signal->zone, signal->section, signal->x, signal->y, 2}; // GREEN
+        seqWriteEnd(&slot->sequence);
+    }
+    __atomic_store_n(&sharedState->signalCount, count, __ATOMIC_RELEASE);
+}
+
+// Initialize switches in shared memory; each is drawn at the end of its section
+void initializeSwitches(const Topology *topology) {
+    int count = topology->header->switchCount;
+    if (count > MAX_SWITCHES) {
+        fprintf(stderr, "%d switches in the topology, only the first %d are run\n", count, MAX_SWITCHES);
+        count = MAX_SWITCHES;
+    }
     
-    pthread_mutex_unlock(&sharedState->mutex);
+    for (int i = 0; i < count; i++) {
+        const TopologySwitch *device = &topology->switches[i];
+        const TopologySection *section = topologySection(topology, device->section);
+        SwitchSlot *slot = &sharedState->switches[i];
+        seqWriteBegin(&slot->sequence);
+        slot->device = (SwitchState){device->id, section->zone, device->section, section->x1, section->y1, 0}; // NORMAL
+        seqWriteEnd(&slot->sequence);
+    }
+    __atomic_store_n(&sharedState->switchCount, count, __ATOMIC_RELEASE);
 }
 
-// Function to initialize track layout for visualization
+// Load track geometry and stations from the topology image
 void initializeTrackLayout() {
-    // Define track segments (each segment is a section)
-    // Main line
-    for (int i = 0; i < 20; i++) {
-        trackSegments[trackSegmentCount].start = (Vector2){100 + i * 40, 300};
-        trackSegments[trackSegmentCount].end = (Vector2){140 + i * 40, 300};
-        trackSegments[trackSegmentCount].zoneId = (i < 7) ? 1 : ((i < 14) ? 2 : 3);
-        trackSegments[trackSegmentCount].section = i + 1;
-        trackSegmentCount++;
-    }
-    
-    // Branch line
-    trackSegments[trackSegmentCount].start = (Vector2){420, 300};
-    trackSegments[trackSegmentCount].end = (Vector2){420, 260};
-    trackSegments[trackSegmentCount].zoneId = 2;
-    trackSegments[trackSegmentCount].section = 21;
-    trackSegmentCount++;
-    
-    trackSegments[trackSegmentCount].start = (Vector2){420, 260};
-    trackSegments[trackSegmentCount].end = (Vector2){500, 260};
-    trackSegments[trackSegmentCount].zoneId = 2;
-    trackSegments[trackSegmentCount].section = 22;
-    trackSegmentCount++;
-    
-    trackSegments[trackSegmentCount].start = (Vector2){500, 260};
-    trackSegments[trackSegmentCount].end = (Vector2){580, 260};
-    trackSegments[trackSegmentCount].zoneId = 2;
-    trackSegments[trackSegmentCount].section = 23;
-    trackSegmentCount++;
-    
-    trackSegments[trackSegmentCount].start = (Vector2){580, 260};
-    trackSegments[trackSegmentCount].end = (Vector2){580, 300};
-    trackSegments[trackSegmentCount].zoneId = 2;
-    trackSegments[trackSegmentCount].section = 24;
-    trackSegmentCount++;
-
-    // Define stations
-    stations[stationCount].id = 1;
-    stations[stationCount].position = (Vector2){170, 280};
-    stations[stationCount].name = "Westgate";
-    stations[stationCount].section = 2;
-    stations[stationCount].stopTime = 5;
-    stations[stationCount].bounds = (Rectangle){
-        stations[stationCount].position.x,
-        stations[stationCount].position.y,
-        STATION_WIDTH,
-        STATION_HEIGHT
-    };
-    stationCount++;
-    
-    stations[stationCount].id = 2;
-    stations[stationCount].position = (Vector2){370, 280};
-    stations[stationCount].name = "Central";
-    stations[stationCount].section = 7;
-    stations[stationCount].stopTime = 10;
-    stations[stationCount].bounds = (Rectangle){
-        stations[stationCount].position.x,
-        stations[stationCount].position.y,
-        STATION_WIDTH,
-        STATION_HEIGHT
-    };
-    stationCount++;
-    
-    stations[stationCount].id = 3;
-    stations[stationCount].position = (Vector2){520, 240};
-    stations[stationCount].name = "North";
-    stations[stationCount].section = 23;
-    stations[stationCount].stopTime = 7;
-    stations[stationCount].bounds = (Rectangle){
-        stations[stationCount].position.x,
-        stations[stationCount].position.y,
-        STATION_WIDTH,
-        STATION_HEIGHT
-    };
-    stationCount++;
-    
-    stations[stationCount].id = 4;
-    stations[stationCount].position = (Vector2){610, 280};
-    stations[stationCount].name = "Eastgate";
-    stations[stationCount].section = 13;
-    stations[stationCount].stopTime = 5;
-    stations[stationCount].bounds = (Rectangle){
-        stations[stationCount].position.x,
-        stations[stationCount].position.y,
-        STATION_WIDTH,
-        STATION_HEIGHT
-    };
-    stationCount++;
-    
-    stations[stationCount].id = 5;
-    stations[stationCount].position = (Vector2){810, 280};
-    stations[stationCount].name = "Terminal";
-    stations[stationCount].section = 18;
-    stations[stationCount].stopTime = 15;
-    stations[stationCount].bounds = (Rectangle){
-        stations[stationCount].position.x,
-        stations[stationCount].position.y,
-        STATION_WIDTH,
-        STATION_HEIGHT
-    };
-    stationCount++;
-}
-
-// Initialize signal positions in shared memory
-void initializeSignals() {
-    pthread_mutex_lock(&sharedState->mutex);
-    
-    // Signal 1
-    sharedState->signals[0].id = 1;
-    sharedState->signals[0].zoneId = 1;
-    sharedState->signals[0].section = 1;
-    sharedState->signals[0].x = 130;
-    sharedState->signals[0].y = 280;
-    sharedState->signals[0].state = 2; // GREEN
-    
-    // Signal 2
-    sharedState->signals[1].id = 2;
-    sharedState->signals[1].zoneId = 1;
-    sharedState->signals[1].section = 5;
-    sharedState->signals[1].x = 290;
-    sharedState->signals[1].y = 280;
-    sharedState->signals[1].state = 2; // GREEN
-    
-    // Signal 3
-    sharedState->signals[2].id = 3;
-    sharedState->signals[2].zoneId = 2;
-    sharedState->signals[2].section = 9;
-    sharedState->signals[2].x = 450;
-    sharedState->signals[2].y = 280;
-    sharedState->signals[2].state = 2; // GREEN
-    
-    // Signal 4
-    sharedState->signals[3].id = 4;
-    sharedState->signals[3].zoneId = 2;
-    sharedState->signals[3].section = 21;
-    sharedState->signals[3].x = 400;
-    sharedState->signals[3].y = 260;
-    sharedState->signals[3].state = 1; // YELLOW
-    
-    // Signal 5
-    sharedState->signals[4].id = 5;
-    sharedState->signals[4].zoneId = 3;
-    sharedState->signals[4].section = 15;
-    sharedState->signals[4].x = 690;
-    sharedState->signals[4].y = 280;
-    sharedState->signals[4].state = 2; // GREEN
-    
-    sharedState->signalCount = 5;
-    
-    pthread_mutex_unlock(&sharedState->mutex);
-}
-
-// Initialize switch positions in shared memory
-void initializeSwitches() {
-    pthread_mutex_lock(&sharedState->mutex);
-    
-    // Switch 1
-    sharedState->switches[0].id = 1;
-    sharedState->switches[0].zoneId = 2;
-    sharedState->switches[0].section = 8;
-    sharedState->switches[0].x = 420;
-    sharedState->switches[0].y = 300;
-    sharedState->switches[0].state = 0; // NORMAL
-    
-    // Switch 2
-    sharedState->switches[1].id = 2;
-    sharedState->switches[1].zoneId = 2;
-    sharedState->switches[1].section = 12;
-    sharedState->switches[1].x = 580;
-    sharedState->switches[1].y = 300;
-    sharedState->switches[1].state = 0; // NORMAL
-    
-    sharedState->switchCount = 2;
-    
-    pthread_mutex_unlock(&sharedState->mutex);
+    ensureTopologyImage();
+    Topology topology;
+    if (topologyOpen(&topology, topologyImagePath()) < 0) {
+        fprintf(stderr, "Error loading topology image: %s\n", topologyImagePath());
+        exit(EXIT_FAILURE);
+    }
+    
+    int count = topology.header->sectionCount;
+    track.count = count;
+    track.x0 = malloc(count * sizeof(float));
+    track.y0 = malloc(count * sizeof(float));
+    track.x1 = malloc(count * sizeof(float));
+    track.y1 = malloc(count * sizeof(float));
+    track.section = malloc(count * sizeof(int));
+    track.zoneId = malloc(count * sizeof(int));
+    track.visitMark = calloc(count ? count : 1, sizeof(unsigned int));
+    track.visible = malloc((count ? count : 1) * sizeof(int));
+    if (!track.x0 || !track.y0 || !track.x1 || !track.y1 || !track.section ||
+        !track.zoneId || !track.visitMark || !track.visible) {
+        perror("Track geometry allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    for (int z = 0; z <= MAX_ZONES; z++) {
+        zoneExtents[z] = (Rectangle){0, 0, 0, 0};
+    }
+    
+    // Structure-of-arrays copy for the renderer's culling loops
+    track.maxSectionId = topology.header->maxSectionId;
+    for (int i = 0; i < count; i++) {
+        const TopologySection *section = &topology.sections[i];
+        track.section[i] = section->id;
+        track.zoneId[i] = section->zone;
+        track.x0[i] = section->x0;
+        track.y0[i] = section->y0;
+        track.x1[i] = section->x1;
+        track.y1[i] = section->y1;
+        
+        float segMinX = fminf(track.x0[i], track.x1[i]), segMaxX = fmaxf(track.x0[i], track.x1[i]);
+        float segMinY = fminf(track.y0[i], track.y1[i]), segMaxY = fmaxf(track.y0[i], track.y1[i]);
+        minX = fminf(minX, segMinX);
+        minY = fminf(minY, segMinY);
+        maxX = fmaxf(maxX, segMaxX);
+        maxY = fmaxf(maxY, segMaxY);
+        
+        int z = track.zoneId[i];
+        if (z >= 1 && z <= MAX_ZONES) {
+            Rectangle *zoneExtent = &zoneExtents[z];
+            if (zoneExtent->width == 0 && zoneExtent->height == 0 && zoneExtent->x == 0) {
+                *zoneExtent = (Rectangle){segMinX, segMinY, segMaxX - segMinX, segMaxY - segMinY};
+            } else {
+                float left = fminf(zoneExtent->x, segMinX);
+                float top = fminf(zoneExtent->y, segMinY);
+                float right = fmaxf(zoneExtent->x + zoneExtent->width, segMaxX);
+                float bottom = fmaxf(zoneExtent->y + zoneExtent->height, segMaxY);
+                *zoneExtent = (Rectangle){left, top, right - left, bottom - top};
+            }
+        }
+    }
+    if (count == 0) {
+        minX = minY = maxX = maxY = 0;
+    }
+    track.extent = (Rectangle){minX, minY, maxX - minX, maxY - minY};
+    
+    track.sectionLookup = malloc((track.maxSectionId + 1) * sizeof(int));
+    if (!track.sectionLookup) {
+        perror("Track geometry allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= track.maxSectionId; i++) {
+        track.sectionLookup[i] = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (track.section[i] >= 0) {
+            track.sectionLookup[track.section[i]] = i;
+        }
+    }
+    
+    buildTrackGrid();
+    
+    // Stations sit just above the middle of their section
+    int stationTotal = topology.header->stationCount;
+    stations = calloc(stationTotal ? stationTotal : 1, sizeof(Station));
+    if (!stations) {
+        perror("Station allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < stationTotal; i++) {
+        const TopologyStation *station = &topology.stations[i];
+        int segment = trackSegmentForSection(station->section);
+        
+        Station *s = &stations[stationCount];
+        s->id = stationCount + 1;
+        s->section = track.section[segment];
+        s->stopTime = station->stopTime;
+        memcpy(s->name, station->name, sizeof(s->name));
+        s->name[sizeof(s->name) - 1] = '\0';
+        s->position = (Vector2){
+            (track.x0[segment] + track.x1[segment]) / 2 - STATION_WIDTH / 2,
+            fminf(track.y0[segment], track.y1[segment]) - STATION_HEIGHT
+        };
+        s->bounds = (Rectangle){s->position.x, s->position.y, STATION_WIDTH, STATION_HEIGHT};
+        stationCount++;
+    }
+    
+    // Signals and switches, and so the wayside processes, come from the same image
+    initializeSignals(&topology);
+    initializeSwitches(&topology);
+    
+    topologyClose(&topology);
+    printf("Loaded track layout: %d sections, %d stations, %dx%d grid of %.0f px cells\n",
+           track.count, stationCount, track.gridColumns, track.gridRows, track.cellSize);
+}
+
+void freeTrackLayout() {
+    free(track.x0);
+    free(track.y0);
+    free(track.x1);
+    free(track.y1);
+    free(track.section);
+    free(track.zoneId);
+    free(track.sectionLookup);
+    free(track.cellStart);
+    free(track.cellItems);
+    free(track.visitMark);
+    free(track.visible);
+    free(stations);
+    memset(&track, 0, sizeof(track));
+    stations = NULL;
+    stationCount = 0;
+}
+
+// Register a train in the train table with its launch position
+void addTrain(int id, int zoneId, int section, float x, float y, const char *color) {
+    int slot = trainTableRegister(&trainTable, id, color);
+    if (slot < 0) {
+        fprintf(stderr, "Train table full, cannot add train %d\n", id);
+        return;
+    }
+    
+    TrainSlot *train = &trainTableSlots(trainTable.header)[slot];
+    trainSlotWriteBegin(train);
+    train->zoneId = zoneId;
+    train->section = section;
+    train->x = x;
+    train->y = y;
+    train->speed = 0;
+    train->targetSpeed = 40;
+    train->stationStopTime = 0;
+    train->stationTimer = 0;
+    train->atStation = 0;
+    train->direction = 1;
+    train->lastUpdateNs = monotonicNs(); // Stale age counts from launch
+    trainSlotWriteEnd(train);
 }
 
 // Initialize train positions in shared memory
 void initializeTrains() {
-    pthread_mutex_lock(&sharedState->mutex);
-    
-    // Train 1
-    sharedState->trains[0].id = 101;
-    sharedState->trains[0].zoneId = 1;
-    sharedState->trains[0].section = 1;
-    sharedState->trains[0].x = 110;
-    sharedState->trains[0].y = 300;
-    sharedState->trains[0].speed = 0;
-    sharedState->trains[0].targetSpeed = 40;
-    sharedState->trains[0].stationStopTime = 0;
-    sharedState->trains[0].stationTimer = 0;
-    sharedState->trains[0].atStation = 0;
-    sharedState->trains[0].direction = 1;
-    strcpy(sharedState->trains[0].color, "RED");
-    
-    // Train 2
-    sharedState->trains[1].id = 102;
-    sharedState->trains[1].zoneId = 2;
-    sharedState->trains[1].section = 10;
-    sharedState->trains[1].x = 490;
-    sharedState->trains[1].y = 300;
-    sharedState->trains[1].speed = 0;
-    sharedState->trains[1].targetSpeed = 40;
-    sharedState->trains[1].stationStopTime = 0;
-    sharedState->trains[1].stationTimer = 0;
-    sharedState->trains[1].atStation = 0;
-    sharedState->trains[1].direction = 1;
-    strcpy(sharedState->trains[1].color, "BLUE");
-    
-    // Train 3
-    sharedState->trains[2].id = 103;
-    sharedState->trains[2].zoneId = 3;
-    sharedState->trains[2].section = 17;
-    sharedState->trains[2].x = 770;
-    sharedState->trains[2].y = 300;
-    sharedState->trains[2].speed = 0;
-    sharedState->trains[2].targetSpeed = 40;
-    sharedState->trains[2].stationStopTime = 0;
-    sharedState->trains[2].stationTimer = 0;
-    sharedState->trains[2].atStation = 0;
-    sharedState->trains[2].direction = 1;
-    strcpy(sharedState->trains[2].color, "GREEN");
-    
-    sharedState->trainCount = 3;
-    
-    pthread_mutex_unlock(&sharedState->mutex);
+    addTrain(101, 1, 1, 110, 300, "RED");
+    addTrain(102, 2, 10, 490, 300, "BLUE");
+    addTrain(103, 3, 17, 770, 300, "GREEN");
 }
 
 // Add environment variables for component communication
 void setupEnvironmentVars() {
     // Set environment variables for shared memory and ports
     setenv("CBTC_SHM_NAME", shmName, 1);
+    setenv("CBTC_TRAIN_SHM_NAME", trainShmName, 1);
     setenv("CCS_PORT", "8000", 1);
     setenv("ZC_BASE_PORT", "8100", 1);
     setenv("MULTICAST_PORT", "8200", 1);
     setenv("POSITION_MULTICAST_PORT", "8300", 1);
     setenv("POSITION_MULTICAST_GROUP", "239.0.0.1", 1);
+    
+    // Opt-in single-host transport: trains write their own train table slots
+    const char *transport = getenv("POSITION_TRANSPORT");
+    positionTransportShm = transport && strcmp(transport, "shm") == 0;
+    setenv("POSITION_TRANSPORT", positionTransportShm ? "shm" : "multicast", 1);
     setenv("SO_REUSEADDR", "1", 1);  // Signal to components to set SO_REUSEADDR
     setenv("CONFIG_FILE", "track_config.json", 1);
+    setenv(TOPOLOGY_IMAGE_ENV, topologyImagePath(), 1);
+}
+
+// Each run starts the CCS on a fresh journal, so it only carries state across
+// CCS restarts within the run. The last run's journal is kept beside it.
+void rotateCcsJournal() {
+    const char *path = getenv("CCS_JOURNAL");
+    if (!path) path = "ccs_journal.bin";
+    if (!*path) return;
+    char previous[4096];
+    if (snprintf(previous, sizeof(previous), "%s.prev", path) >= (int)sizeof(previous)) return;
+    if (rename(path, previous) < 0 && errno != ENOENT) {
+        perror("Rotating CCS journal failed");
+    }
 }
 
 // Set up position multicast listener
@@ -443,6 +1294,25 @@ void setupPositionMulticastListener() {
         exit(EXIT_FAILURE);
     }
 
+    // Room for bursts from large fleets, and kernel drop counts on each datagram
+    int rcvbuf = INGEST_SOCKET_BUFFER;
+    if (setsockopt(positionMulticastSocket, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                   sizeof(rcvbuf)) < 0) {
+        perror("Setting SO_RCVBUF failed");
+    }
+    int reportDrops = 1;
+    if (setsockopt(positionMulticastSocket, SOL_SOCKET, SO_RXQ_OVFL, &reportDrops,
+                   sizeof(reportDrops)) < 0) {
+        perror("Setting SO_RXQ_OVFL failed");
+    }
+    
+    // Bound blocking receives so the ingest thread can notice shutdown
+    struct timeval timeout = {0, INGEST_POLL_TIMEOUT_MS * 1000};
+    if (setsockopt(positionMulticastSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                   sizeof(timeout)) < 0) {
+        perror("Setting SO_RCVTIMEO failed");
+    }
+
     struct sockaddr_in localAddr;
     memset(&localAddr, 0, sizeof(localAddr));
     localAddr.sin_family = AF_INET;
@@ -469,234 +1339,2459 @@ void setupPositionMulticastListener() {
     printf("Joined train position multicast group: %s\n", positionMulticastGroup);
 }
 
-// Process position updates from trains
-void processPositionUpdate(char *message) {
-    int trainId, direction, speed, section;
-    float x, y;
-    int atStation = 0;
+// Allocate the heatmap and dwell statistics. Needs the track layout and the
+// train table.
+void initializeSectionStats() {
+    sectionStats = calloc(track.maxSectionId + 1, sizeof(SectionStats));
+    stationForSection = malloc((track.maxSectionId + 1) * sizeof(int));
+    trainOccupancy = calloc(trainTable.header->maxCapacity, sizeof(TrainOccupancy));
+    dwellStats = calloc(stationCount ? stationCount : 1, sizeof(DwellStats));
+    if (!sectionStats || !stationForSection || !trainOccupancy || !dwellStats) {
+        perror("Section statistics allocation failed");
+        exit(EXIT_FAILURE);
+    }
     
-    if (sscanf(message, "TRAIN_POSITION %d %f %f %d %d %d %d", 
-               &trainId, &x, &y, &direction, &speed, &section, &atStation) >= 6) {
-        
-        pthread_mutex_lock(&sharedState->mutex);
-        
-        // Find the train in our shared state
-        for (int i = 0; i < sharedState->trainCount; i++) {
-            if (sharedState->trains[i].id == trainId) {
-                // Update train position and movement data
-                sharedState->trains[i].x = x;
-                sharedState->trains[i].y = y;
-                sharedState->trains[i].direction = direction;
-                sharedState->trains[i].speed = speed;
-                sharedState->trains[i].section = section;
-                sharedState->trains[i].atStation = atStation;
-                break;
+    for (int i = 0; i <= track.maxSectionId; i++) {
+        stationForSection[i] = -1;
+    }
+    for (int i = stationCount - 1; i >= 0; i--) {
+        stationForSection[stations[i].section] = i;
+    }
+}
+
+// Start the statistics over, e.g. when a replay jumps
+void resetSectionStats() {
+    if (!sectionStats) return;
+    memset(sectionStats, 0, (track.maxSectionId + 1) * sizeof(SectionStats));
+    memset(trainOccupancy, 0, trainTable.header->maxCapacity * sizeof(TrainOccupancy));
+    memset(dwellStats, 0, (stationCount ? stationCount : 1) * sizeof(DwellStats));
+    heatmapMaxOccupancyNs = 0;
+    heatmapMaxTraversals = 0;
+    heatmapMaxSpeed = 0;
+}
+
+void freeSectionStats() {
+    free(sectionStats);
+    free(stationForSection);
+    free(trainOccupancy);
+    free(dwellStats);
+    sectionStats = NULL;
+    stationForSection = NULL;
+    trainOccupancy = NULL;
+    dwellStats = NULL;
+}
+
+// Fold one position update into the section and dwell statistics in O(1).
+// The time since the train's previous update is credited to the section it
+// was on then (at most STALE_TRAIN_AGE_MS, so a silent train does not pile
+// up occupancy), a change of section counts as a traversal, and a station
+// stop is timed from the update that sets atStation to the one that clears
+// it. Only the thread applying updates calls this; the renderer reads the
+// counters as they are.
+static void sectionStatsUpdate(int slot, int section, int speed, int atStation,
+                               unsigned long long nowNs) {
+    if (!trainOccupancy) return;
+    TrainOccupancy *train = &trainOccupancy[slot];
+    int known = section >= 0 && section <= track.maxSectionId;
+    
+    if (train->updateNs && train->section >= 0 && nowNs > train->updateNs) {
+        unsigned long long gap = nowNs - train->updateNs;
+        if (gap > STALE_TRAIN_AGE_MS * 1000000ULL) gap = STALE_TRAIN_AGE_MS * 1000000ULL;
+        unsigned long long occupancy =
+            __atomic_add_fetch(&sectionStats[train->section].occupancyNs, gap, __ATOMIC_RELAXED);
+        if (occupancy > heatmapMaxOccupancyNs) {
+            __atomic_store_n(&heatmapMaxOccupancyNs, occupancy, __ATOMIC_RELAXED);
+        }
+    }
+    
+    if (known) {
+        SectionStats *stats = &sectionStats[section];
+        if (!train->updateNs || section != train->section) {
+            unsigned int traversals = __atomic_add_fetch(&stats->traversals, 1, __ATOMIC_RELAXED);
+            if (traversals > heatmapMaxTraversals) {
+                __atomic_store_n(&heatmapMaxTraversals, traversals, __ATOMIC_RELAXED);
+            }
+        }
+        __atomic_add_fetch(&stats->speedSum, speed > 0 ? speed : 0, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->speedSamples, 1, __ATOMIC_RELAXED);
+        if (speed > heatmapMaxSpeed) {
+            __atomic_store_n(&heatmapMaxSpeed, speed, __ATOMIC_RELAXED);
+        }
+    }
+    
+    if (atStation && !train->atStation) {
+        // A stop already under way when the train is first seen is not timed
+        train->dwellStation = train->updateNs && known ? stationForSection[section] : -1;
+        train->dwellStartNs = nowNs;
+    } else if (!atStation && train->atStation && train->dwellStation >= 0) {
+        DwellStats *dwell = &dwellStats[train->dwellStation];
+        unsigned int dwellMs = (unsigned int)((nowNs - train->dwellStartNs) / 1000000ULL);
+        unsigned int bucket = dwellMs / DWELL_BUCKET_MS;
+        if (bucket >= DWELL_HISTOGRAM_BUCKETS) bucket = DWELL_HISTOGRAM_BUCKETS - 1;
+        __atomic_add_fetch(&dwell->histogram[bucket], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&dwell->totalMs, dwellMs, __ATOMIC_RELAXED);
+        if (!dwell->count || dwellMs < dwell->minMs) {
+            __atomic_store_n(&dwell->minMs, dwellMs, __ATOMIC_RELAXED);
+        }
+        if (dwellMs > dwell->maxMs) {
+            __atomic_store_n(&dwell->maxMs, dwellMs, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&dwell->count, 1, __ATOMIC_RELEASE);
+        train->dwellStation = -1;
+    }
+    
+    train->section = known ? section : -1;
+    train->atStation = atStation;
+    train->updateNs = nowNs;
+}
+
+// Apply a position update from a train to the train table, registering the
+// train on first sight. Only the ingest thread writes position data, so each
+// slot is updated under its own sequence counter without further locking.
+// Returns 1 for a known train, 2 for a newly registered one, 0 if the table
+// is full and -1 if the message is malformed.
+int applyPositionUpdate(const char *message, unsigned long long receivedNs) {
+    int trainId, direction, speed, section;
+    float x, y;
+    int atStation = 0;
+    int result = 1;
+    
+    if (sscanf(message, "TRAIN_POSITION %d %f %f %d %d %d %d", 
+               &trainId, &x, &y, &direction, &speed, &section, &atStation) < 6) {
+        return -1;
+    }
+    
+    int slot = trainTableFind(&trainTable, trainId);
+    if (slot < 0) {
+        slot = trainTableRegister(&trainTable, trainId, trainTableNextColor(&trainTable));
+        if (slot < 0) return 0;
+        result = 2;
+    }
+    
+    // Update train position and movement data
+    TrainSlot *train = &trainTableSlots(trainTable.header)[slot];
+    trainSlotWriteBegin(train);
+    train->x = x;
+    train->y = y;
+    train->direction = direction;
+    train->speed = speed;
+    train->section = section;
+    train->atStation = atStation;
+    train->lastUpdateNs = receivedNs;
+    trainSlotWriteEnd(train);
+    sectionStatsUpdate(slot, section, speed, atStation, receivedNs);
+    return result;
+}
+
+// Publish the ingest rate once a second
+static void updateIngestRate(IngestStats *stats, struct timespec *windowStart,
+                             unsigned long long *windowPackets) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - windowStart->tv_sec) +
+                     (now.tv_nsec - windowStart->tv_nsec) / 1e9;
+    if (elapsed >= 1.0) {
+        __atomic_store_n(&stats->packetsPerSecond,
+                         (unsigned int)(*windowPackets / elapsed), __ATOMIC_RELAXED);
+        *windowPackets = 0;
+        *windowStart = now;
+    }
+}
+
+// Drain the position multicast socket in recvmmsg batches and apply them to
+// the train table. Runs until stopPositionIngest() clears ingestRunning.
+void *positionIngestThread(void *arg) {
+    (void)arg;
+    static char buffers[INGEST_BATCH_SIZE][BUFFER_SIZE];
+    static char controls[INGEST_BATCH_SIZE][CMSG_SPACE(sizeof(unsigned int))];
+    struct mmsghdr msgs[INGEST_BATCH_SIZE];
+    struct iovec iovecs[INGEST_BATCH_SIZE];
+    IngestStats *stats = &sharedState->ingest;
+    struct timespec windowStart;
+    unsigned long long windowPackets = 0;
+    
+    // Termination signals are handled by the main thread
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    clock_gettime(CLOCK_MONOTONIC, &windowStart);
+    
+    while (__atomic_load_n(&ingestRunning, __ATOMIC_ACQUIRE)) {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < INGEST_BATCH_SIZE; i++) {
+            iovecs[i].iov_base = buffers[i];
+            iovecs[i].iov_len = BUFFER_SIZE - 1;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+        
+        // Blocks for the first datagram (bounded by SO_RCVTIMEO), then takes
+        // whatever else is already queued without waiting
+        int received = recvmmsg(positionMulticastSocket, msgs, INGEST_BATCH_SIZE,
+                                MSG_WAITFORONE, NULL);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Position ingest recvmmsg failed");
+                usleep(100000);
+            }
+            received = 0;
+        }
+        
+        if (received > 0) {
+            unsigned long long applied = 0, registered = 0, rejected = 0, malformed = 0;
+            
+            unsigned long long receivedNs = monotonicNs();
+            unsigned long long batchMark = receivedNs;
+            for (int i = 0; i < received; i++) {
+                buffers[i][msgs[i].msg_len] = '\0';
+                int result = applyPositionUpdate(buffers[i], receivedNs);
+                if (result > 0) applied++;
+                if (result == 2) registered++;
+                else if (result == 0) rejected++;
+                else if (result < 0) malformed++;
+            }
+            profilePhase(PHASE_INGEST_BATCH, &batchMark);
+            
+            // The kernel reports its cumulative drop count on every datagram
+            for (int i = received - 1; i >= 0; i--) {
+                struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+                if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    unsigned int drops;
+                    memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                    __atomic_store_n(&stats->kernelDrops, drops, __ATOMIC_RELAXED);
+                    break;
+                }
+            }
+            
+            __atomic_add_fetch(&stats->packets, received, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->updates, applied, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->registered, registered, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->rejected, rejected, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&stats->malformed, malformed, __ATOMIC_RELAXED);
+            __atomic_store_n(&stats->queueDepth, received, __ATOMIC_RELAXED);
+            if ((unsigned int)received > stats->maxQueueDepth) {
+                __atomic_store_n(&stats->maxQueueDepth, received, __ATOMIC_RELAXED);
+            }
+            windowPackets += received;
+        } else {
+            __atomic_store_n(&stats->queueDepth, 0, __ATOMIC_RELAXED);
+        }
+        updateIngestRate(stats, &windowStart, &windowPackets);
+    }
+    
+    return NULL;
+}
+
+// Shared-memory transport: trains write their own slots, so ingest is a
+// pass over the train table every POSITION_POLL_INTERVAL_MS that picks out
+// the slots with a new report for the section statistics and counters.
+// The renderer and recorder read the table directly either way.
+void *positionPollThread(void *arg) {
+    (void)arg;
+    IngestStats *stats = &sharedState->ingest;
+    unsigned long long *seenNs = NULL; // Report time last seen per slot
+    int seenCapacity = 0;
+    struct timespec windowStart;
+    unsigned long long windowPackets = 0;
+    struct timespec interval = {0, POSITION_POLL_INTERVAL_MS * 1000000L};
+    
+    // Termination signals are handled by the main thread
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    clock_gettime(CLOCK_MONOTONIC, &windowStart);
+    
+    while (__atomic_load_n(&ingestRunning, __ATOMIC_ACQUIRE)) {
+        nanosleep(&interval, NULL);
+        
+        unsigned long long passMark = monotonicNs();
+        int count = (int)__atomic_load_n(&trainTable.header->count, __ATOMIC_ACQUIRE);
+        if (count > seenCapacity) {
+            unsigned long long *grown = realloc(seenNs, count * sizeof(unsigned long long));
+            if (!grown) continue;
+            memset(grown + seenCapacity, 0, (count - seenCapacity) * sizeof(unsigned long long));
+            seenNs = grown;
+            seenCapacity = count;
+        }
+        
+        TrainSlot *slots = trainTableSlots(trainTable.header);
+        unsigned int applied = 0;
+        for (int i = 0; i < count; i++) {
+            if (__atomic_load_n(&slots[i].lastUpdateNs, __ATOMIC_RELAXED) == seenNs[i]) continue;
+            TrainSlot train;
+            trainSlotRead(&slots[i], &train);
+            seenNs[i] = train.lastUpdateNs;
+            sectionStatsUpdate(i, train.section, train.speed, train.atStation, train.lastUpdateNs);
+            applied++;
+        }
+        profilePhase(PHASE_INGEST_BATCH, &passMark);
+        
+        __atomic_add_fetch(&stats->updates, applied, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->queueDepth, applied, __ATOMIC_RELAXED);
+        if (applied > stats->maxQueueDepth) {
+            __atomic_store_n(&stats->maxQueueDepth, applied, __ATOMIC_RELAXED);
+        }
+        windowPackets += applied;
+        updateIngestRate(stats, &windowStart, &windowPackets);
+    }
+    
+    free(seenNs);
+    return NULL;
+}
+
+// Start the position ingest thread
+void startPositionIngest() {
+    __atomic_store_n(&ingestRunning, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&ingestThread, NULL,
+                       positionTransportShm ? positionPollThread : positionIngestThread, NULL) != 0) {
+        perror("Failed to start position ingest thread");
+        exit(EXIT_FAILURE);
+    }
+    ingestStarted = 1;
+}
+
+// Stop the position ingest thread and wait for it to finish its batch
+void stopPositionIngest() {
+    if (ingestStarted) {
+        __atomic_store_n(&ingestRunning, 0, __ATOMIC_RELEASE);
+        pthread_join(ingestThread, NULL);
+        ingestStarted = 0;
+    }
+}
+
+// Append one frame to the recording
+static void recordFrame(Recorder *rec, RecordType type, unsigned long long timeMs,
+                        const void *entries, unsigned int count, size_t entrySize) {
+    RecordFrame frame = {(unsigned short)type, 0, count, timeMs};
+    fwrite(&frame, sizeof(frame), 1, rec->file);
+    if (count) fwrite(entries, entrySize, count, rec->file);
+}
+
+// Write everything that changed since the last tick, preceded by a keyframe
+// with the full state every RECORD_KEYFRAME_INTERVAL_MS
+static void recorderTick(Recorder *rec) {
+    unsigned long long timeMs = (monotonicNs() - rec->startNs) / 1000000ULL;
+    int keyframe = rec->indexCount == 0 ||
+                   timeMs - rec->index[rec->indexCount - 1].timeMs >= RECORD_KEYFRAME_INTERVAL_MS;
+    
+    int capacity = (int)__atomic_load_n(&trainTable.header->capacity, __ATOMIC_ACQUIRE);
+    if (capacity > rec->capacity) {
+        TrainSlot *trains = realloc(rec->trains, capacity * sizeof(TrainSlot));
+        if (trains) rec->trains = trains;
+        RecordedTrain *changed = realloc(rec->changed, capacity * sizeof(RecordedTrain));
+        if (changed) rec->changed = changed;
+        RecordedTrainInfo *infos = realloc(rec->infos, capacity * sizeof(RecordedTrainInfo));
+        if (infos) rec->infos = infos;
+        unsigned long long *recordedNs = realloc(rec->recordedNs, capacity * sizeof(unsigned long long));
+        if (recordedNs) {
+            memset(recordedNs + rec->capacity, 0, (capacity - rec->capacity) * sizeof(unsigned long long));
+            rec->recordedNs = recordedNs;
+        }
+        if (!trains || !changed || !infos || !recordedNs) return;
+        rec->capacity = capacity;
+    }
+    int count = trainTableSnapshot(&trainTable, rec->trains, rec->capacity);
+    static SystemState state;
+    sharedStateSnapshot(sharedState, &state);
+    
+    if (keyframe) {
+        if (rec->indexCount == rec->indexCapacity) {
+            unsigned int grownCapacity = rec->indexCapacity ? rec->indexCapacity * 2 : 256;
+            KeyframeIndexEntry *grown = realloc(rec->index, grownCapacity * sizeof(KeyframeIndexEntry));
+            if (!grown) return;
+            rec->index = grown;
+            rec->indexCapacity = grownCapacity;
+        }
+        rec->index[rec->indexCount].timeMs = timeMs;
+        rec->index[rec->indexCount].offset = (unsigned long long)ftello(rec->file);
+        rec->indexCount++;
+        recordFrame(rec, RECORD_KEYFRAME, timeMs, NULL, 0, 0);
+    }
+    
+    int first = keyframe ? 0 : rec->knownTrains;
+    for (int i = first; i < count; i++) {
+        rec->infos[i - first].id = rec->trains[i].id;
+        memcpy(rec->infos[i - first].color, rec->trains[i].color, sizeof(rec->infos[i - first].color));
+    }
+    if (count > first) {
+        recordFrame(rec, RECORD_TRAIN_INFO, timeMs, rec->infos, count - first, sizeof(RecordedTrainInfo));
+    }
+    rec->knownTrains = count;
+    
+    unsigned int changedCount = 0;
+    for (int i = 0; i < count; i++) {
+        const TrainSlot *train = &rec->trains[i];
+        if (!keyframe && train->lastUpdateNs == rec->recordedNs[i]) continue;
+        rec->recordedNs[i] = train->lastUpdateNs;
+        rec->changed[changedCount++] = (RecordedTrain){train->id, train->zoneId, train->section, train->speed,
+                                                       train->direction, train->atStation, train->x, train->y};
+    }
+    if (changedCount) {
+        recordFrame(rec, RECORD_TRAINS, timeMs, rec->changed, changedCount, sizeof(RecordedTrain));
+    }
+    
+    RecordedDevice devices[MAX_SIGNALS > MAX_SWITCHES ? MAX_SIGNALS : MAX_SWITCHES];
+    unsigned int deviceCount = 0;
+    for (int i = 0; i < state.signalCount; i++) {
+        if (keyframe || state.signals[i].state != rec->lastState.signals[i].state) {
+            devices[deviceCount++] = (RecordedDevice){state.signals[i].id, state.signals[i].state};
+        }
+    }
+    if (deviceCount) {
+        recordFrame(rec, RECORD_SIGNALS, timeMs, devices, deviceCount, sizeof(RecordedDevice));
+    }
+    deviceCount = 0;
+    for (int i = 0; i < state.switchCount; i++) {
+        if (keyframe || state.switches[i].state != rec->lastState.switches[i].state) {
+            devices[deviceCount++] = (RecordedDevice){state.switches[i].id, state.switches[i].state};
+        }
+    }
+    if (deviceCount) {
+        recordFrame(rec, RECORD_SWITCHES, timeMs, devices, deviceCount, sizeof(RecordedDevice));
+    }
+    rec->lastState = state;
+    rec->lastTimeMs = timeMs;
+    
+    // A crash loses at most one tick; replay rebuilds a missing index
+    fflush(rec->file);
+}
+
+void *recorderThread(void *arg) {
+    (void)arg;
+    
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    while (__atomic_load_n(&recorderRunning, __ATOMIC_ACQUIRE)) {
+        recorderTick(&recorder);
+        usleep(RECORD_TICK_MS * 1000);
+    }
+    recorderTick(&recorder);
+    return NULL;
+}
+
+// Start recording positions and signal/switch state to recordPath
+void startRecording() {
+    if (!recordPath) return;
+    
+    recorder.file = fopen(recordPath, "wb");
+    if (!recorder.file) {
+        perror("Opening recording failed");
+        return;
+    }
+    setvbuf(recorder.file, NULL, _IOFBF, 1 << 20);
+    RecordingHeader header = {RECORD_MAGIC, RECORD_VERSION, RECORD_TICK_MS, RECORD_KEYFRAME_INTERVAL_MS,
+                              (unsigned long long)time(NULL)};
+    fwrite(&header, sizeof(header), 1, recorder.file);
+    recorder.startNs = monotonicNs();
+    
+    __atomic_store_n(&recorderRunning, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&recorderThreadId, NULL, recorderThread, NULL) != 0) {
+        perror("Failed to start recorder thread");
+        __atomic_store_n(&recorderRunning, 0, __ATOMIC_RELEASE);
+        fclose(recorder.file);
+        recorder.file = NULL;
+        return;
+    }
+    recorderStarted = 1;
+    printf("Recording to %s\n", recordPath);
+}
+
+// Stop recording and append the keyframe index
+void stopRecording() {
+    if (!recorderStarted) return;
+    __atomic_store_n(&recorderRunning, 0, __ATOMIC_RELEASE);
+    pthread_join(recorderThreadId, NULL);
+    recorderStarted = 0;
+    
+    RecordingTrailer trailer = {RECORD_INDEX_MAGIC, recorder.indexCount,
+                                (unsigned long long)ftello(recorder.file), recorder.lastTimeMs};
+    fwrite(recorder.index, sizeof(KeyframeIndexEntry), recorder.indexCount, recorder.file);
+    fwrite(&trailer, sizeof(trailer), 1, recorder.file);
+    if (fclose(recorder.file) != 0) {
+        perror("Closing recording failed");
+    }
+    recorder.file = NULL;
+    printf("Recorded %.1f s (%u keyframes) to %s\n", recorder.lastTimeMs / 1000.0, recorder.indexCount, recordPath);
+    
+    free(recorder.index);
+    free(recorder.trains);
+    free(recorder.changed);
+    free(recorder.infos);
+    free(recorder.recordedNs);
+}
+
+static size_t recordEntrySize(unsigned int type) {
+    switch (type) {
+    case RECORD_KEYFRAME: return 0;
+    case RECORD_TRAIN_INFO: return sizeof(RecordedTrainInfo);
+    case RECORD_TRAINS: return sizeof(RecordedTrain);
+    case RECORD_SIGNALS:
+    case RECORD_SWITCHES: return sizeof(RecordedDevice);
+    default: return (size_t)-1;
+    }
+}
+
+// Frame at offset, or NULL if it is past the end or truncated
+static const RecordFrame *replayFrameAt(unsigned long long offset) {
+    if (offset + sizeof(RecordFrame) > replay.framesEnd) return NULL;
+    const RecordFrame *frame = (const RecordFrame *)(replay.data + offset);
+    size_t entrySize = recordEntrySize(frame->type);
+    if (entrySize == (size_t)-1 ||
+        (unsigned long long)frame->count * entrySize > replay.framesEnd - offset - sizeof(RecordFrame)) {
+        return NULL;
+    }
+    return frame;
+}
+
+static unsigned long long replayFrameSize(const RecordFrame *frame) {
+    return sizeof(RecordFrame) + (unsigned long long)frame->count * recordEntrySize(frame->type);
+}
+
+// Open a recording for playback. Uses the keyframe index at the end of the
+// file, or rebuilds it with one pass over the frames if the recording was cut
+// short. Returns 0 on success.
+int replayOpen(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Opening replay failed");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(RecordingHeader)) {
+        fprintf(stderr, "%s is not a recording\n", path);
+        close(fd);
+        return -1;
+    }
+    replay.size = st.st_size;
+    replay.data = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (replay.data == MAP_FAILED) {
+        perror("Mapping replay failed");
+        return -1;
+    }
+    
+    const RecordingHeader *header = (const RecordingHeader *)replay.data;
+    if (header->magic != RECORD_MAGIC || header->version != RECORD_VERSION) {
+        fprintf(stderr, "%s is not a recording (or an unsupported version)\n", path);
+        munmap(replay.data, replay.size);
+        return -1;
+    }
+    
+    const RecordingTrailer *trailer = NULL;
+    if (replay.size >= sizeof(RecordingHeader) + sizeof(RecordingTrailer)) {
+        trailer = (const RecordingTrailer *)(replay.data + replay.size - sizeof(RecordingTrailer));
+        if (trailer->magic != RECORD_INDEX_MAGIC ||
+            trailer->indexOffset + (unsigned long long)trailer->count * sizeof(KeyframeIndexEntry) +
+                sizeof(RecordingTrailer) != replay.size) {
+            trailer = NULL;
+        }
+    }
+    
+    if (trailer) {
+        replay.framesEnd = trailer->indexOffset;
+        replay.index = (KeyframeIndexEntry *)(replay.data + trailer->indexOffset);
+        replay.indexCount = trailer->count;
+        replay.durationMs = trailer->durationMs;
+    } else {
+        replay.framesEnd = replay.size;
+        unsigned int capacity = 0;
+        unsigned long long offset = sizeof(RecordingHeader);
+        const RecordFrame *frame;
+        while ((frame = replayFrameAt(offset)) != NULL) {
+            if (frame->type == RECORD_KEYFRAME) {
+                if (replay.indexCount == capacity) {
+                    capacity = capacity ? capacity * 2 : 256;
+                    KeyframeIndexEntry *grown = realloc(replay.index, capacity * sizeof(KeyframeIndexEntry));
+                    if (!grown) break;
+                    replay.index = grown;
+                }
+                replay.index[replay.indexCount++] = (KeyframeIndexEntry){frame->timeMs, offset};
+            }
+            replay.durationMs = frame->timeMs;
+            offset += replayFrameSize(frame);
+        }
+        replay.framesEnd = offset;
+        replay.ownsIndex = 1;
+        printf("Recording has no index (cut short?), rebuilt %u keyframes\n", replay.indexCount);
+    }
+    
+    if (!replay.indexCount) {
+        fprintf(stderr, "%s has no keyframes\n", path);
+        munmap(replay.data, replay.size);
+        if (replay.ownsIndex) free(replay.index);
+        return -1;
+    }
+    
+    replay.cursor = replay.index[0].offset;
+    replay.appliedMs = -1;
+    replay.positionMs = 0;
+    replay.speedStep = 2; // 1x
+    replay.playing = 1;
+    replay.lastTickNs = monotonicNs();
+    replayMode = 1;
+    
+    time_t started = (time_t)header->startTime;
+    printf("Replaying %s: %.1f s, %u keyframes, recorded %s", path, replay.durationMs / 1000.0,
+           replay.indexCount, ctime(&started));
+    return 0;
+}
+
+void replayClose() {
+    if (!replayMode) return;
+    munmap(replay.data, replay.size);
+    if (replay.ownsIndex) free(replay.index);
+    replayMode = 0;
+}
+
+static void replayApplyFrame(const RecordFrame *frame) {
+    unsigned long long reportNs = REPLAY_CLOCK_BASE_NS + frame->timeMs * 1000000ULL;
+    TrainSlot *slots = trainTableSlots(trainTable.header);
+    
+    switch (frame->type) {
+    case RECORD_KEYFRAME: {
+        // Hide every train; the keyframe's RECORD_TRAINS brings back the ones
+        // that exist at this point. NaN positions never pass the view cull.
+        int count = (int)__atomic_load_n(&trainTable.header->count, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < count; i++) {
+            trainSlotWriteBegin(&slots[i]);
+            slots[i].x = NAN;
+            slots[i].y = NAN;
+            slots[i].speed = 0;
+            trainSlotWriteEnd(&slots[i]);
+        }
+        break;
+    }
+    case RECORD_TRAIN_INFO: {
+        const RecordedTrainInfo *infos = (const RecordedTrainInfo *)(frame + 1);
+        for (unsigned int i = 0; i < frame->count; i++) {
+            char color[sizeof(infos[i].color)];
+            memcpy(color, infos[i].color, sizeof(color));
+            color[sizeof(color) - 1] = '\0';
+            int slot = trainTableRegister(&trainTable, infos[i].id, color);
+            if (slot >= 0 && trainTableSlots(trainTable.header)[slot].lastUpdateNs == 0) {
+                // Not positioned until its first RECORD_TRAINS entry
+                trainSlotWriteBegin(&slots[slot]);
+                slots[slot].x = NAN;
+                slots[slot].y = NAN;
+                trainSlotWriteEnd(&slots[slot]);
+            }
+        }
+        break;
+    }
+    case RECORD_TRAINS: {
+        const RecordedTrain *trains = (const RecordedTrain *)(frame + 1);
+        for (unsigned int i = 0; i < frame->count; i++) {
+            int slot = trainTableFind(&trainTable, trains[i].id);
+            if (slot < 0) {
+                slot = trainTableRegister(&trainTable, trains[i].id, trainTableNextColor(&trainTable));
+                if (slot < 0) continue;
+            }
+            TrainSlot *train = &slots[slot];
+            trainSlotWriteBegin(train);
+            train->zoneId = trains[i].zoneId;
+            train->section = trains[i].section;
+            train->speed = trains[i].speed;
+            train->direction = trains[i].direction;
+            train->atStation = trains[i].atStation;
+            train->x = trains[i].x;
+            train->y = trains[i].y;
+            train->lastUpdateNs = reportNs;
+            trainSlotWriteEnd(train);
+            sectionStatsUpdate(slot, trains[i].section, trains[i].speed, trains[i].atStation, reportNs);
+        }
+        break;
+    }
+    case RECORD_SIGNALS:
+    case RECORD_SWITCHES: {
+        const RecordedDevice *devices = (const RecordedDevice *)(frame + 1);
+        for (unsigned int i = 0; i < frame->count; i++) {
+            if (frame->type == RECORD_SIGNALS) {
+                int index = sharedStateFindSignal(sharedState, devices[i].id);
+                if (index >= 0) sharedStateSetSignal(sharedState, index, devices[i].state);
+            } else {
+                int index = sharedStateFindSwitch(sharedState, devices[i].id);
+                if (index >= 0) sharedStateSetSwitch(sharedState, index, devices[i].state);
+            }
+        }
+        break;
+    }
+    }
+}
+
+// Bring the shared state to timeMs. The last keyframe at or before timeMs is
+// found by binary search; playback restarts from it when going backwards or
+// when it lies past the frames already applied, so any seek replays at most
+// one keyframe interval of deltas.
+void replaySeek(double timeMs) {
+    unsigned int low = 0, high = replay.indexCount;
+    while (low < high) {
+        unsigned int mid = low + (high - low) / 2;
+        if (replay.index[mid].timeMs <= timeMs) low = mid + 1;
+        else high = mid;
+    }
+    const KeyframeIndexEntry *keyframe = &replay.index[low ? low - 1 : 0];
+    
+    if (timeMs < replay.appliedMs || keyframe->offset > replay.cursor) {
+        // The heatmap and dwell figures cover what has played since the jump
+        replay.cursor = keyframe->offset;
+        resetSectionStats();
+    }
+    const RecordFrame *frame;
+    while ((frame = replayFrameAt(replay.cursor)) != NULL && frame->timeMs <= timeMs) {
+        replayApplyFrame(frame);
+        replay.cursor += replayFrameSize(frame);
+    }
+    replay.appliedMs = timeMs;
+}
+
+// Replay clock for extrapolating trains, in the same timebase as the report
+// times replayApplyFrame writes
+unsigned long long replayClockNs() {
+    return REPLAY_CLOCK_BASE_NS + (unsigned long long)(replay.positionMs * 1e6);
+}
+
+// Playback controls, then advance the replay clock and apply the frames due.
+// Space plays/pauses, Up/Down change speed, Left/Right jump 10 s, Home goes
+// to the start and clicking or dragging on the timeline seeks.
+void updateReplay() {
+    unsigned long long now = monotonicNs();
+    double elapsedMs = (now - replay.lastTickNs) / 1e6;
+    replay.lastTickNs = now;
+    
+    if (IsKeyPressed(KEY_SPACE)) {
+        if (!replay.playing && replay.positionMs >= replay.durationMs) replay.positionMs = 0;
+        replay.playing = !replay.playing;
+    }
+    int speedCount = sizeof(replaySpeeds) / sizeof(replaySpeeds[0]);
+    if (IsKeyPressed(KEY_UP) && replay.speedStep < speedCount - 1) replay.speedStep++;
+    if (IsKeyPressed(KEY_DOWN) && replay.speedStep > 0) replay.speedStep--;
+    if (IsKeyPressed(KEY_RIGHT)) replay.positionMs += REPLAY_STEP_MS;
+    if (IsKeyPressed(KEY_LEFT)) replay.positionMs -= REPLAY_STEP_MS;
+    if (IsKeyPressed(KEY_HOME)) replay.positionMs = 0;
+    
+    Vector2 mouse = GetMousePosition();
+    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && mouse.y >= WORLD_VIEW_HEIGHT - TIMELINE_HEIGHT &&
+        mouse.y < WORLD_VIEW_HEIGHT) {
+        float fraction = (mouse.x - 10) / (GetScreenWidth() - 20);
+        if (fraction < 0) fraction = 0;
+        if (fraction > 1) fraction = 1;
+        replay.positionMs = fraction * replay.durationMs;
+    } else if (replay.playing) {
+        replay.positionMs += elapsedMs * replaySpeeds[replay.speedStep];
+    }
+    
+    if (replay.positionMs < 0) replay.positionMs = 0;
+    if (replay.positionMs >= replay.durationMs) {
+        replay.positionMs = replay.durationMs;
+        replay.playing = 0;
+    }
+    replaySeek(replay.positionMs);
+}
+
+static void formatDuration(double ms, char *out, size_t size) {
+    unsigned long long seconds = (unsigned long long)(ms / 1000);
+    snprintf(out, size, "%02llu:%02llu:%02llu", seconds / 3600, seconds / 60 % 60, seconds % 60);
+}
+
+// Timeline along the bottom of the track view
+void drawReplayTimeline() {
+    int top = WORLD_VIEW_HEIGHT - TIMELINE_HEIGHT;
+    int width = GetScreenWidth();
+    DrawRectangle(0, top, width, TIMELINE_HEIGHT, Fade(LIGHTGRAY, 0.9f));
+    DrawRectangle(10, top + 4, width - 20, 4, GRAY);
+    float fraction = replay.durationMs ? (float)(replay.positionMs / replay.durationMs) : 0;
+    DrawRectangle(10, top + 4, (int)((width - 20) * fraction), 4, DARKBLUE);
+    DrawCircle(10 + (int)((width - 20) * fraction), top + 6, 5, DARKBLUE);
+    
+    char position[24], duration[24], info[160];
+    formatDuration(replay.positionMs, position, sizeof(position));
+    formatDuration(replay.durationMs, duration, sizeof(duration));
+    snprintf(info, sizeof(info), "%s  %s / %s  x%g  (Space, Up/Down, Left/Right, Home, click to seek)",
+             replay.playing ? "PLAY " : "PAUSE", position, duration, replaySpeeds[replay.speedStep]);
+    DrawText(info, 10, top + 11, 10, BLACK);
+}
+
+// Create the pipe components use to report readiness. Both ends are
+// close-on-exec; launchProcess clears the flag on the write end in the child.
+// The pipe stays open after launch so restarted components can report too.
+void openReadyPipe() {
+    if (pipe2(readyPipe, O_CLOEXEC) < 0) {
+        perror("Ready pipe creation failed");
+        exit(EXIT_FAILURE);
+    }
+    char fdStr[16];
+    snprintf(fdStr, sizeof(fdStr), "%d", readyPipe[1]);
+    setenv(READY_FD_ENV, fdStr, 1);
+}
+
+void closeReadyPipe() {
+    unsetenv(READY_FD_ENV);
+    for (int i = 0; i < 2; i++) {
+        if (readyPipe[i] != -1) {
+            close(readyPipe[i]);
+            readyPipe[i] = -1;
+        }
+    }
+}
+
+// Start the train zygote (see cbtc_zygote.h). Trains fall back to fork and
+// exec if it cannot be started or stops answering.
+void startTrainZygote() {
+    const char *enabled = getenv(ZYGOTE_ENV);
+    if (enabled && strcmp(enabled, "0") == 0) {
+        return;
+    }
+    
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("Zygote socket creation failed");
+        return;
+    }
+    char fdStr[16];
+    snprintf(fdStr, sizeof(fdStr), "%d", fds[1]);
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    } else if (pid == 0) {
+        // The zygote's trains inherit the ready pipe and signal mask from it
+        resetChildSignalMask();
+        fcntl(fds[1], F_SETFD, 0);
+        if (readyPipe[1] != -1) {
+            fcntl(readyPipe[1], F_SETFD, 0);
+        }
+        execl(TRAIN_EXECUTABLE, TRAIN_EXECUTABLE, ZYGOTE_FLAG, fdStr, (char *)NULL);
+        perror("Exec failed");
+        exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+    
+    // Never wait on a zygote that hangs: a stuck request falls back to exec
+    struct timeval timeout = {ZYGOTE_TIMEOUT_MS / 1000, (ZYGOTE_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    pid_t hello;
+    if (recv(fds[0], &hello, sizeof(hello), 0) != sizeof(hello) || hello != pid) {
+        fprintf(stderr, "Train zygote did not start, launching trains with fork and exec\n");
+        close(fds[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return;
+    }
+    zygoteSocket = fds[0];
+    zygotePid = pid;
+    
+    printf("Launched train zygote (PID: %d)\n", pid);
+    char logMsg[100];
+    snprintf(logMsg, sizeof(logMsg), "Launched train zygote (PID: %d)", pid);
+    addLog(logMsg);
+}
+
+// Ask the zygote to fork the train described by info. Returns its pid, or -1
+// after shutting the zygote out so the caller falls back to fork and exec.
+static pid_t zygoteSpawn(const ProcessInfo *info) {
+    ZygoteRequest request;
+    memset(&request, 0, sizeof(request));
+    for (; request.argc < ZYGOTE_MAX_ARGS && info->argv[request.argc]; request.argc++) {
+        strncpy(request.argv[request.argc], info->argv[request.argc], ZYGOTE_MAX_ARG_LENGTH - 1);
+    }
+    
+    pid_t pid = -1;
+    pthread_mutex_lock(&zygoteLock);
+    if (zygoteSocket != -1) {
+        if (send(zygoteSocket, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request) ||
+            recv(zygoteSocket, &pid, sizeof(pid), 0) != sizeof(pid)) {
+            perror("Train zygote request failed");
+            close(zygoteSocket);
+            zygoteSocket = -1;
+            addLogEvent(LOG_SEVERITY_WARNING, "Train zygote stopped answering, using fork and exec");
+            pid = -1;
+        } else if (pid < 0) {
+            fprintf(stderr, "Train zygote could not fork %s: %s\n", info->name, strerror(-pid));
+            pid = -1;
+        }
+    }
+    pthread_mutex_unlock(&zygoteLock);
+    return pid;
+}
+
+// Close the zygote's socket, which makes it exit, and reap it
+void stopTrainZygote() {
+    pthread_mutex_lock(&zygoteLock);
+    if (zygoteSocket != -1) {
+        close(zygoteSocket);
+        zygoteSocket = -1;
+    }
+    pthread_mutex_unlock(&zygoteLock);
+    
+    if (zygotePid > 0) {
+        // Already gone if the supervisor reaped it
+        if (waitpid(zygotePid, NULL, WNOHANG) == 0) {
+            kill(zygotePid, SIGTERM);
+            waitpid(zygotePid, NULL, 0);
+        }
+        zygotePid = -1;
+    }
+}
+
+// Fork and exec the component described by info, or have the zygote fork it
+// if it is a train
+int spawnProcess(ProcessInfo *info) {
+    if (zygoteSocket != -1 && strcmp(info->executable, TRAIN_EXECUTABLE) == 0) {
+        pid_t pid = zygoteSpawn(info);
+        if (pid > 0) {
+            info->pid = pid;
+            info->ready = 0;
+            info->startedNs = monotonicNs();
+            __atomic_store_n(&info->running, 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    
+    pid_t pid = fork();
+    
+    if (pid < 0) {
+        perror("Fork failed");
+        return -1;
+    } else if (pid == 0) {
+        // Child process: only launched components inherit the ready pipe
+        resetChildSignalMask();
+        if (readyPipe[1] != -1) {
+            fcntl(readyPipe[1], F_SETFD, 0);
+        }
+        execvp(info->executable, info->argv);
+        perror("Exec failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    // Parent process
+    info->pid = pid;
+    info->ready = 0;
+    info->startedNs = monotonicNs();
+    __atomic_store_n(&info->running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Launch a CBTC component as a separate process
+void launchProcess(const char *name, const char *executable, char *argv[]) {
+    if (processCount >= MAX_PROCESSES) {
+        fprintf(stderr, "Maximum number of processes reached\n");
+        return;
+    }
+    
+    // Keep our own copy of the command line so the supervisor can restart it
+    ProcessInfo *info = &processes[processCount];
+    memset(info, 0, sizeof(*info));
+    strncpy(info->name, name, sizeof(info->name) - 1);
+    strncpy(info->executable, executable, sizeof(info->executable) - 1);
+    int argCount = 0;
+    for (; argv[argCount] && argCount < MAX_PROCESS_ARGS; argCount++) {
+        strncpy(info->args[argCount], argv[argCount], MAX_PROCESS_ARG_LENGTH - 1);
+        info->argv[argCount] = info->args[argCount];
+    }
+    info->argv[argCount] = NULL;
+    
+    if (spawnProcess(info) < 0) {
+        return;
+    }
+    processCount++;
+    
+    printf("Launched %s (PID: %d)\n", name, info->pid);
+    char logMsg[100];
+    snprintf(logMsg, sizeof(logMsg), "Launched %s component (PID: %d)", name, info->pid);
+    addLog(logMsg);
+}
+
+// A restarted component reported ready: log how long it was out of service
+static void recordRecovery(ProcessInfo *info) {
+    unsigned int recoveryMs = (unsigned int)((monotonicNs() - info->exitNs) / 1000000ULL);
+    info->lastRecoveryMs = recoveryMs;
+    if (recoveryMs > info->maxRecoveryMs) {
+        info->maxRecoveryMs = recoveryMs;
+    }
+    info->exitNs = 0;
+    
+    char logMsg[100];
+    snprintf(logMsg, sizeof(logMsg), "%s recovered in %u ms (restart #%d)",
+             info->name, recoveryMs, info->restarts);
+    printf("%s\n", logMsg);
+    addLog(logMsg);
+}
+
+// Mark the processes whose pids arrived on the ready pipe. Returns how many
+// of them belong to the wave [first, last).
+static int drainReadyPipe(int first, int last) {
+    pid_t pids[64];
+    ssize_t bytesRead = read(readyPipe[0], pids, sizeof(pids));
+    if (bytesRead <= 0) {
+        return 0;
+    }
+    
+    int inWave = 0;
+    for (int n = 0; n < (int)(bytesRead / sizeof(pid_t)); n++) {
+        // Late reports from an earlier wave are recorded too
+        for (int i = 0; i < processCount; i++) {
+            if (processes[i].pid == pids[n] && !processes[i].ready) {
+                processes[i].ready = 1;
+                if (i >= first && i < last && processes[i].running) {
+                    inWave++;
+                }
+                if (processes[i].exitNs) {
+                    recordRecovery(&processes[i]);
+                }
+                break;
+            }
+        }
+    }
+    return inWave;
+}
+
+// Block until every process in the wave [first, last) has reported ready or
+// exited, or READY_TIMEOUT_MS has passed
+void waitForReady(int first, int last, const char *tier) {
+    int pending = 0;
+    for (int i = first; i < last; i++) {
+        if (processes[i].running && !processes[i].ready) {
+            pending++;
+        }
+    }
+    
+    unsigned long long start = monotonicNs();
+    unsigned long long deadline = start + (unsigned long long)READY_TIMEOUT_MS * 1000000ULL;
+    while (pending > 0 && !stopSignal) {
+        unsigned long long now = monotonicNs();
+        if (now >= deadline) {
+            break;
+        }
+        int timeoutMs = (int)((deadline - now) / 1000000ULL);
+        
+        // Wake up periodically to notice components that die before reporting
+        struct pollfd pfd = {readyPipe[0], POLLIN, 0};
+        int ready = poll(&pfd, 1, timeoutMs < 100 ? timeoutMs : 100);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("Ready pipe poll failed");
+            break;
+        }
+        if (ready > 0) {
+            pending -= drainReadyPipe(first, last);
+        }
+        
+        for (int i = first; i < last; i++) {
+            if (processes[i].running && !processes[i].ready) {
+                int status;
+                if (waitpid(processes[i].pid, &status, WNOHANG) == processes[i].pid) {
+                    // Left for the supervisor to restart once it starts
+                    processes[i].running = 0;
+                    processes[i].exitNs = monotonicNs();
+                    processes[i].backoffMs = RESTART_BACKOFF_MIN_MS;
+                    processes[i].restartDueNs = processes[i].exitNs + RESTART_BACKOFF_MIN_MS * 1000000ULL;
+                    pending--;
+                    
+                    char logMsg[100];
+                    snprintf(logMsg, sizeof(logMsg), "%s exited during startup", processes[i].name);
+                    addLogEvent(LOG_SEVERITY_ERROR, logMsg);
+                }
+            }
+        }
+    }
+    
+    int readyCount = 0;
+    for (int i = first; i < last; i++) {
+        if (processes[i].ready) readyCount++;
+    }
+    
+    char logMsg[100];
+    snprintf(logMsg, sizeof(logMsg), "%s ready: %d/%d in %llu ms%s", tier, readyCount, last - first,
+             (monotonicNs() - start) / 1000000ULL, pending > 0 ? " (timed out)" : "");
+    printf("%s\n", logMsg);
+    addLogEvent(pending > 0 ? LOG_SEVERITY_WARNING : LOG_SEVERITY_INFO, logMsg);
+}
+
+// Launch system components in dependency waves. Each wave starts as soon as
+// the previous one has reported ready: CCS, then zone controllers (which
+// register with the CCS), then wayside equipment and trains (which register
+// with their zone controller).
+void launchComponents() {
+    openReadyPipe();
+    
+    // Central Control System
+    int waveStart = processCount;
+    char *ccsArgs[] = {"./central_control_system", NULL};
+    launchProcess("Central Control System", "./central_control_system", ccsArgs);
+    waitForReady(waveStart, processCount, "Central Control System");
+    if (stopSignal) return;
+    
+    // Zone Controllers
+    waveStart = processCount;
+    for (int i = 1; i <= 3; i++) {
+        char zoneId[8];
+        sprintf(zoneId, "%d", i);
+        char *zcArgs[] = {"./zone_controller", zoneId, "127.0.0.1", NULL};
+        char name[32];
+        sprintf(name, "Zone Controller %d", i);
+        launchProcess(name, "./zone_controller", zcArgs);
+    }
+    waitForReady(waveStart, processCount, "Zone controllers");
+    if (stopSignal) return;
+    
+    // Wayside Equipment and Trains
+    waveStart = processCount;
+    for (int i = 0; i < sharedState->signalCount; i++) {
+        char id[8], type[8], zoneId[8], section[8];
+        sprintf(id, "%d", sharedState->signals[i].device.id);
+        sprintf(type, "0");  // 0 = signal
+        sprintf(zoneId, "%d", sharedState->signals[i].device.zoneId);
+        sprintf(section, "%d", sharedState->signals[i].device.section);
+        
+        char *signalArgs[] = {"./wayside_equipment", id, type, zoneId, section, "127.0.0.1", NULL};
+        char name[32];
+        sprintf(name, "Signal %d", sharedState->signals[i].device.id);
+        launchProcess(name, "./wayside_equipment", signalArgs);
+    }
+    
+    for (int i = 0; i < sharedState->switchCount; i++) {
+        char id[8], type[8], zoneId[8], section[8];
+        sprintf(id, "%d", sharedState->switches[i].device.id);
+        sprintf(type, "1");  // 1 = switch
+        sprintf(zoneId, "%d", sharedState->switches[i].device.zoneId);
+        sprintf(section, "%d", sharedState->switches[i].device.section);
+        
+        char *switchArgs[] = {"./wayside_equipment", id, type, zoneId, section, "127.0.0.1", NULL};
+        char name[32];
+        sprintf(name, "Switch %d", sharedState->switches[i].device.id);
+        launchProcess(name, "./wayside_equipment", switchArgs);
+    }
+    
+    TrainSlot *trainSlots = trainTableSlots(trainTable.header);
+    int launchCount = __atomic_load_n(&trainTable.header->count, __ATOMIC_ACQUIRE);
+    if (launchCount > 0) {
+        startTrainZygote();
+    }
+    unsigned long long trainLaunchStart = monotonicNs();
+    for (int i = 0; i < launchCount && !stopSignal; i++) {
+        TrainSlot train;
+        trainSlotRead(&trainSlots[i], &train);
+        
+        char id[16], zoneId[8], section[8], initX[16], initY[16];
+        sprintf(id, "%d", train.id);
+        sprintf(zoneId, "%d", train.zoneId);
+        sprintf(section, "%d", train.section);
+        sprintf(initX, "%.1f", train.x);
+        sprintf(initY, "%.1f", train.y);
+        
+        char *trainArgs[] = {TRAIN_EXECUTABLE, id, zoneId, section, "127.0.0.1", initX, initY, NULL};
+        char name[32];
+        sprintf(name, "Train %d", train.id);
+        launchProcess(name, TRAIN_EXECUTABLE, trainArgs);
+    }
+    if (launchCount > 0) {
+        char logMsg[100];
+        snprintf(logMsg, sizeof(logMsg), "Spawned %d trains in %.1f ms%s", launchCount,
+                 (monotonicNs() - trainLaunchStart) / 1e6, zygoteSocket != -1 ? " via zygote" : "");
+        printf("%s\n", logMsg);
+        addLog(logMsg);
+    }
+    waitForReady(waveStart, processCount, "Wayside equipment and trains");
+    if (stopSignal) return;
+    
+    // Add a final log message
+    addLog("All CBTC components launched successfully");
+    
+    // // Wait for system to stabilize
+    // sleep(2);
+    // 
+    // // Route Train 102 to North station
+    // addLog("Routing Train 102 to North station");
+    // system("echo 'route 102 23' | nc localhost 8000");
+}
+
+// Reap every exited child and schedule its restart
+static void reapChildren() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == compilerPid) {
+            // The CCS and zone controllers pick the new image up themselves
+            int compiled = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            addLogEvent(compiled ? LOG_SEVERITY_INFO : LOG_SEVERITY_ERROR,
+                        compiled ? "Track config recompiled, components reloading"
+                                 : "Track config did not compile, components keep the old layout");
+            compilerPid = 0;
+            if (recompilePending) {
+                recompilePending = 0;
+                compilerPid = startTopologyCompiler();
+                if (compilerPid < 0) compilerPid = 0;
+            }
+            continue;
+        }
+        for (int i = 0; i < processCount; i++) {
+            ProcessInfo *info = &processes[i];
+            if (info->pid != pid || !info->running) continue;
+            
+            unsigned long long now = monotonicNs();
+            __atomic_store_n(&info->running, 0, __ATOMIC_RELEASE);
+            if (!info->exitNs) {
+                info->exitNs = now; // Still counting from an earlier exit if it never recovered
+            }
+            
+            // Restart at once unless the component is crash-looping
+            if (now - info->startedNs >= RESTART_STABLE_MS * 1000000ULL) {
+                info->backoffMs = 0;
+            } else {
+                info->backoffMs = info->backoffMs ? info->backoffMs * 2 : RESTART_BACKOFF_MIN_MS;
+                if (info->backoffMs > RESTART_BACKOFF_MAX_MS) {
+                    info->backoffMs = RESTART_BACKOFF_MAX_MS;
+                }
+            }
+            info->restartDueNs = now + info->backoffMs * 1000000ULL;
+            
+            char logMsg[100];
+            if (WIFSIGNALED(status)) {
+                snprintf(logMsg, sizeof(logMsg), "%s (PID: %d) killed by signal %d, restarting",
+                         info->name, pid, WTERMSIG(status));
+            } else {
+                snprintf(logMsg, sizeof(logMsg), "%s (PID: %d) exited with status %d, restarting",
+                         info->name, pid, WEXITSTATUS(status));
+            }
+            printf("%s\n", logMsg);
+            addLogEvent(LOG_SEVERITY_WARNING, logMsg);
+            break;
+        }
+    }
+}
+
+// Restart components whose restart time has come. Returns the delay in ms
+// until the next pending restart, or SUPERVISOR_POLL_MS if there is none.
+static int restartDueProcesses() {
+    unsigned long long now = monotonicNs();
+    unsigned long long nextDue = 0;
+    
+    for (int i = 0; i < processCount; i++) {
+        ProcessInfo *info = &processes[i];
+        if (!info->restartDueNs) continue;
+        
+        if (info->restartDueNs > now) {
+            if (!nextDue || info->restartDueNs < nextDue) nextDue = info->restartDueNs;
+            continue;
+        }
+        
+        info->restartDueNs = 0;
+        if (spawnProcess(info) < 0) {
+            info->restartDueNs = now + RESTART_BACKOFF_MAX_MS * 1000000ULL;
+            continue;
+        }
+        info->restarts++;
+        __atomic_add_fetch(&totalRestarts, 1, __ATOMIC_RELAXED);
+        
+        char logMsg[100];
+        snprintf(logMsg, sizeof(logMsg), "Restarted %.31s (PID: %d) %llu ms after exit",
+                 info->name, info->pid, (monotonicNs() - info->exitNs) / 1000000ULL);
+        printf("%s\n", logMsg);
+        addLog(logMsg);
+    }
+    
+    if (!nextDue) return SUPERVISOR_POLL_MS;
+    int delayMs = (int)((nextDue - now + 999999ULL) / 1000000ULL);
+    return delayMs < SUPERVISOR_POLL_MS ? delayMs : SUPERVISOR_POLL_MS;
+}
+
+// Supervisor thread: child exits arrive on a signalfd and are restarted with
+// the same argv; readiness reports on the ready pipe close out the recovery
+// time. Owns processes[] from startSupervisor() until stopSupervisor().
+void *supervisorThread(void *arg) {
+    (void)arg;
+    
+    // Termination signals are handled on the main thread
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    // Pick up anything that exited between launch and now
+    reapChildren();
+    int timeoutMs = restartDueProcesses();
+    
+    while (__atomic_load_n(&supervisorRunning, __ATOMIC_ACQUIRE)) {
+        struct pollfd fds[3] = {
+            {childSignalFd, POLLIN, 0},
+            {readyPipe[0], POLLIN, 0},
+            {configWatchFd, POLLIN, 0}, // Ignored by poll while -1
+        };
+        int ready = poll(fds, 3, timeoutMs);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("Supervisor poll failed");
+            break;
+        }
+        
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info[16];
+            // Only used as a wakeup: several exits can share one SIGCHLD
+            while (read(childSignalFd, info, sizeof(info)) > 0) {}
+            reapChildren();
+        }
+        if (fds[1].revents & POLLIN) {
+            drainReadyPipe(0, 0);
+        }
+        if ((fds[2].revents & POLLIN) && topologyWatchChanged(configWatchFd, CONFIG_FILE)) {
+            // Editors save in bursts; a change during a compile gets one more run
+            if (compilerPid) {
+                recompilePending = 1;
+            } else if ((compilerPid = startTopologyCompiler()) < 0) {
+                compilerPid = 0;
+            }
+        }
+        timeoutMs = restartDueProcesses();
+    }
+    
+    return NULL;
+}
+
+// SIGCHLD must already be blocked in every thread (see main) so that it is
+// only ever delivered through the signalfd
+void startSupervisor() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    childSignalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (childSignalFd < 0) {
+        perror("signalfd for SIGCHLD failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    fcntl(readyPipe[0], F_SETFL, fcntl(readyPipe[0], F_GETFL) | O_NONBLOCK);
+    
+    // Edits to the track config are compiled into a new image, which the
+    // CCS and zone controllers apply without restarting
+    configWatchFd = topologyWatchOpen(CONFIG_FILE);
+    if (configWatchFd < 0) {
+        perror("Watching the track config failed, edits need a restart");
+    }
+    
+    __atomic_store_n(&supervisorRunning, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&supervisorThreadId, NULL, supervisorThread, NULL) != 0) {
+        perror("Failed to start supervisor thread");
+        exit(EXIT_FAILURE);
+    }
+    supervisorStarted = 1;
+}
+
+// Stop restarting components; call before terminating them
+void stopSupervisor() {
+    if (supervisorStarted) {
+        __atomic_store_n(&supervisorRunning, 0, __ATOMIC_RELEASE);
+        pthread_join(supervisorThreadId, NULL);
+        supervisorStarted = 0;
+    }
+    if (childSignalFd != -1) {
+        close(childSignalFd);
+        childSignalFd = -1;
+    }
+    if (configWatchFd != -1) {
+        close(configWatchFd);
+        configWatchFd = -1;
+    }
+    closeReadyPipe();
+}
+
+// Terminate all child processes with proper signal handling
+void terminateProcesses() {
+    stopTrainZygote();
+    
+    // First ask nicely with SIGTERM
+    for (int i = 0; i < processCount; i++) {
+        if (processes[i].running) {
+            printf("Sending SIGTERM to %s (PID: %d)\n", processes[i].name, processes[i].pid);
+            kill(processes[i].pid, SIGTERM);
+        }
+    }
+    
+    // Give processes a chance to terminate gracefully
+    sleep(1);
+    
+    // Now check which ones are still running and force quit with SIGKILL if needed
+    for (int i = 0; i < processCount; i++) {
+        if (processes[i].running) {
+            int status;
+            pid_t result = waitpid(processes[i].pid, &status, WNOHANG);
+            
+            if (result == 0) {
+                // Process still running, force quit
+                printf("Sending SIGKILL to %s (PID: %d)\n", processes[i].name, processes[i].pid);
+                kill(processes[i].pid, SIGKILL);
+                waitpid(processes[i].pid, &status, 0);
             }
+            
+            processes[i].running = 0;
+        }
+    }
+    
+    printf("All processes terminated\n");
+}
+
+// Clean up shared memory and ensure it's properly unlinked
+void cleanupSharedMemory() {
+    if (!isCleanupDone) {
+        if (sharedState != MAP_FAILED) {
+            munmap(sharedState, sizeof(SharedState));
+        }
+        trainTableClose(&trainTable);
+        shm_unlink(trainShmName);
+        
+        if (shmFd >= 0) {
+            close(shmFd);
+        }
+        
+        shm_unlink(shmName);
+        printf("Shared memory cleaned up\n");
+        isCleanupDone = 1;
+    }
+}
+
+// World-space rectangle currently visible above the log panel
+Rectangle cameraView() {
+    Vector2 topLeft = GetScreenToWorld2D((Vector2){0, 0}, camera);
+    Vector2 bottomRight = GetScreenToWorld2D((Vector2){(float)GetScreenWidth(), WORLD_VIEW_HEIGHT}, camera);
+    return (Rectangle){topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y};
+}
+
+// Grow a rectangle on every side, so markers straddling its edge are kept
+static Rectangle expandRect(Rectangle r, float margin) {
+    return (Rectangle){r.x - margin, r.y - margin, r.width + 2 * margin, r.height + 2 * margin};
+}
+
+// Wheel zooms around the cursor, right or middle drag pans, R resets.
+// Any change marks the static layer for rebaking.
+void updateCamera() {
+    Vector2 mouse = GetMousePosition();
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0 && mouse.y < WORLD_VIEW_HEIGHT) {
+        Vector2 anchor = GetScreenToWorld2D(mouse, camera);
+        camera.offset = mouse;
+        camera.target = anchor;
+        camera.zoom *= wheel > 0 ? 1.25f : 0.8f;
+        if (camera.zoom < CAMERA_MIN_ZOOM) camera.zoom = CAMERA_MIN_ZOOM;
+        if (camera.zoom > CAMERA_MAX_ZOOM) camera.zoom = CAMERA_MAX_ZOOM;
+        staticLayerDirty = 1;
+    }
+    
+    if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT) || IsMouseButtonDown(MOUSE_BUTTON_MIDDLE)) {
+        Vector2 delta = GetMouseDelta();
+        if (delta.x != 0 || delta.y != 0) {
+            camera.target.x -= delta.x / camera.zoom;
+            camera.target.y -= delta.y / camera.zoom;
+            staticLayerDirty = 1;
+        }
+    }
+    
+    if (IsKeyPressed(KEY_R)) {
+        camera = (Camera2D){{0, 0}, {0, 0}, 0, 1.0f};
+        staticLayerDirty = 1;
+    }
+}
+
+// Draw the visible part of the track, in world space
+void drawTrackGeometry(Rectangle view) {
+    int visibleCount = trackGeometryQuery(expandRect(view, 20));
+    for (int v = 0; v < visibleCount; v++) {
+        int i = track.visible[v];
+        Color trackColor;
+        switch(track.zoneId[i]) {
+            case 1: trackColor = (Color){200, 220, 255, 255}; break; // Light blue
+            case 2: trackColor = (Color){220, 255, 220, 255}; break; // Light green
+            case 3: trackColor = (Color){255, 220, 220, 255}; break; // Light red
+            default: trackColor = LIGHTGRAY;
+        }
+        
+        Vector2 start = {track.x0[i], track.y0[i]};
+        Vector2 end = {track.x1[i], track.y1[i]};
+        DrawLineEx(start, end, 6, trackColor);
+        DrawLineEx(start, end, 2, BLACK);
+        
+        // Draw section number
+        Vector2 midpoint = {(start.x + end.x) / 2, (start.y + end.y) / 2 + 15};
+        char sectionText[12];
+        sprintf(sectionText, "%d", track.section[i]);
+        DrawText(sectionText, midpoint.x - 5, midpoint.y, 16, DARKGRAY);
+    }
+    
+    // Draw stations
+    for (int i = 0; i < stationCount; i++) {
+        if (!CheckCollisionRecs(stations[i].bounds, view)) continue;
+        DrawRectangleRec(stations[i].bounds, LIGHTGRAY);
+        DrawRectangleLinesEx(stations[i].bounds, 2, BLACK);
+        DrawText(stations[i].name, stations[i].position.x + 5, 
+               stations[i].position.y + 5, 10, BLACK);
+    }
+    
+    // Draw zone boundaries and labels
+    static const Color zoneLabelColors[] = {DARKGRAY, DARKBLUE, DARKGREEN, MAROON};
+    for (int z = 1; z <= MAX_ZONES; z++) {
+        Rectangle extent = zoneExtents[z];
+        if (extent.width == 0 && extent.height == 0) continue;
+        
+        if (extent.x > track.extent.x) {
+            DrawLine(extent.x, track.extent.y - 100, extent.x,
+                     track.extent.y + track.extent.height + 100, GRAY);
+        }
+        char zoneLabel[16];
+        snprintf(zoneLabel, sizeof(zoneLabel), "ZONE %d", z);
+        DrawText(zoneLabel, extent.x + extent.width / 2 - 40, extent.y + extent.height + 80,
+                 20, zoneLabelColors[z]);
+    }
+}
+
+// Draw everything that only changes with the camera: the visible track,
+// section numbers, stations, zone boundaries, the log panel frame and titles
+void drawStaticLayer() {
+    BeginMode2D(camera);
+    drawTrackGeometry(cameraView());
+    EndMode2D();
+    
+    // Draw log panel
+    DrawRectangle(20, 420, 960, 160, LIGHTGRAY);
+    DrawRectangleLines(20, 420, 960, 160, BLACK);
+    DrawText("CBTC System Logs", 30, 425, 20, BLACK);
+    
+    // Draw help text
+    DrawText("Railway CBTC Simulation Orchestrator", 30, 30, 24, BLACK);
+    DrawText("Running distributed CBTC components", 30, 60, 16, DARKGRAY);
+    DrawText("Press ESC to exit and terminate all components", 30, 80, 16, DARKGRAY);
+    DrawText("Wheel to zoom, right-drag to pan, R to reset, F3 profiler, H heatmap", 30, 100, 16, DARKGRAY);
+}
+
+// Render the static layer into its texture; redone only when the camera moves
+void bakeStaticLayer() {
+    if (staticLayer.id == 0) {
+        staticLayer = LoadRenderTexture(GetScreenWidth(), GetScreenHeight());
+    }
+    
+    BeginTextureMode(staticLayer);
+    ClearBackground(RAYWHITE);
+    drawStaticLayer();
+    EndTextureMode();
+    
+    staticLayerDirty = 0;
+}
+
+// Green through yellow to red as value goes from 0 to 1
+static Color heatColor(float value) {
+    if (value < 0) value = 0;
+    if (value > 1) value = 1;
+    if (value < 0.5f) return (Color){(unsigned char)(510 * value), 190, 0, 255};
+    return (Color){255, (unsigned char)(380 * (1 - value)), 0, 255};
+}
+
+// Colour the visible sections by the current heatmap figure, hottest in red.
+// Slow sections are the hot ones for mean speed. Sections no train has
+// reported from keep their normal colour.
+void drawHeatmap(Rectangle visible) {
+    unsigned long long maxOccupancyNs = __atomic_load_n(&heatmapMaxOccupancyNs, __ATOMIC_RELAXED);
+    unsigned int maxTraversals = __atomic_load_n(&heatmapMaxTraversals, __ATOMIC_RELAXED);
+    int maxSpeed = __atomic_load_n(&heatmapMaxSpeed, __ATOMIC_RELAXED);
+    
+    int visibleCount = trackGeometryQuery(visible);
+    for (int v = 0; v < visibleCount; v++) {
+        int i = track.visible[v];
+        if (track.section[i] < 0) continue;
+        const SectionStats *stats = &sectionStats[track.section[i]];
+        
+        float value;
+        if (heatmapMode == HEATMAP_OCCUPANCY) {
+            unsigned long long occupancyNs = __atomic_load_n(&stats->occupancyNs, __ATOMIC_RELAXED);
+            if (!occupancyNs) continue;
+            value = (float)occupancyNs / maxOccupancyNs;
+        } else if (heatmapMode == HEATMAP_TRAVERSALS) {
+            unsigned int traversals = __atomic_load_n(&stats->traversals, __ATOMIC_RELAXED);
+            if (!traversals) continue;
+            value = (float)traversals / maxTraversals;
+        } else {
+            unsigned int samples = __atomic_load_n(&stats->speedSamples, __ATOMIC_RELAXED);
+            if (!samples) continue;
+            float meanSpeed = (float)__atomic_load_n(&stats->speedSum, __ATOMIC_RELAXED) / samples;
+            value = maxSpeed > 0 ? 1 - meanSpeed / maxSpeed : 1;
+        }
+        
+        Vector2 start = {track.x0[i], track.y0[i]};
+        Vector2 end = {track.x1[i], track.y1[i]};
+        DrawLineEx(start, end, 8, heatColor(value));
+        DrawLineEx(start, end, 2, BLACK);
+    }
+}
+
+// Smallest dwell time at or above the given fraction of stops, to the
+// resolution of the histogram
+unsigned int dwellPercentile(const DwellStats *dwell, double fraction) {
+    unsigned int count = __atomic_load_n(&dwell->count, __ATOMIC_ACQUIRE);
+    if (!count) return 0;
+    unsigned long long target = (unsigned long long)ceil(count * fraction);
+    unsigned long long seen = 0;
+    unsigned int maxMs = __atomic_load_n(&dwell->maxMs, __ATOMIC_RELAXED);
+    for (int b = 0; b < DWELL_HISTOGRAM_BUCKETS; b++) {
+        seen += __atomic_load_n(&dwell->histogram[b], __ATOMIC_RELAXED);
+        if (seen >= target) {
+            unsigned int upperMs = (b + 1) * DWELL_BUCKET_MS;
+            return upperMs < maxMs ? upperMs : maxMs;
+        }
+    }
+    return maxMs;
+}
+
+// Heatmap legend and station dwell times against the configured stop time.
+// Percentiles are recomputed a few times a second, not per frame.
+void drawHeatmapOverlay() {
+    static unsigned int p95Ms[DWELL_OVERLAY_MAX_ROWS];
+    static unsigned long long lastRefresh = 0;
+    int rows = stationCount < DWELL_OVERLAY_MAX_ROWS ? stationCount : DWELL_OVERLAY_MAX_ROWS;
+    unsigned long long now = monotonicNs();
+    if (now - lastRefresh >= PROFILE_OVERLAY_REFRESH_MS * 1000000ULL) {
+        for (int i = 0; i < rows; i++) {
+            p95Ms[i] = dwellPercentile(&dwellStats[i], 0.95);
+        }
+        lastRefresh = now;
+    }
+    
+    char scale[48];
+    if (heatmapMode == HEATMAP_OCCUPANCY) {
+        snprintf(scale, sizeof(scale), "red = %.1f train-min",
+                 __atomic_load_n(&heatmapMaxOccupancyNs, __ATOMIC_RELAXED) / 60e9);
+    } else if (heatmapMode == HEATMAP_TRAVERSALS) {
+        snprintf(scale, sizeof(scale), "red = %u trains",
+                 __atomic_load_n(&heatmapMaxTraversals, __ATOMIC_RELAXED));
+    } else {
+        snprintf(scale, sizeof(scale), "green = %d km/h, red = stopped",
+                 __atomic_load_n(&heatmapMaxSpeed, __ATOMIC_RELAXED));
+    }
+    
+    int x = 20, y = 130, lineHeight = 14;
+    DrawRectangle(x, y, 380, (rows + 3) * lineHeight, Fade(BLACK, 0.75f));
+    char legend[100];
+    snprintf(legend, sizeof(legend), "Heatmap: %s, %s (H to cycle)", heatmapModeNames[heatmapMode], scale);
+    DrawText(legend, x + 8, y + 4, 10, YELLOW);
+    DrawText("station            stops    min    mean    p95   stop s", x + 8, y + 4 + lineHeight, 10, RAYWHITE);
+    for (int i = 0; i < rows; i++) {
+        const DwellStats *dwell = &dwellStats[i];
+        unsigned int count = __atomic_load_n(&dwell->count, __ATOMIC_ACQUIRE);
+        double meanMs = count ? (double)__atomic_load_n(&dwell->totalMs, __ATOMIC_RELAXED) / count : 0;
+        char line[100];
+        snprintf(line, sizeof(line), "%-16.16s %7u %6.1f %7.1f %6.1f %7d",
+                 stations[i].name, count, __atomic_load_n(&dwell->minMs, __ATOMIC_RELAXED) / 1000.0,
+                 meanMs / 1000.0, p95Ms[i] / 1000.0, stations[i].stopTime);
+        // Flag stations whose p95 overruns the timetabled stop
+        int late = count && p95Ms[i] > stations[i].stopTime * 1000u + DWELL_BUCKET_MS;
+        DrawText(line, x + 8, y + 4 + (i + 2) * lineHeight, 10, late ? ORANGE : RAYWHITE);
+    }
+}
+
+// Dynamic entities are drawn in one rlgl pass per primitive type instead of
+// a handful of draw calls per entity, so the whole fleet costs a few batch
+// flushes. Circles use a segment count to match their size on screen.
+static int circleSegments(float radius) {
+    int segments = (int)(radius * camera.zoom * 2);
+    if (segments < CIRCLE_MIN_SEGMENTS) return CIRCLE_MIN_SEGMENTS;
+    if (segments > CIRCLE_MAX_SEGMENTS) return CIRCLE_MAX_SEGMENTS;
+    return segments;
+}
+
+// Unit circle points for the given segment count, computed when it changes
+static const Vector2 *unitCircle(int segments) {
+    static Vector2 points[CIRCLE_MAX_SEGMENTS + 1];
+    static int cached = 0;
+    if (segments != cached) {
+        for (int i = 0; i <= segments; i++) {
+            float angle = 2 * PI * i / segments;
+            points[i] = (Vector2){cosf(angle), sinf(angle)};
         }
-        
-        pthread_mutex_unlock(&sharedState->mutex);
+        cached = segments;
     }
+    return points;
 }
 
-// Launch a CBTC component as a separate process
-void launchProcess(const char *name, const char *executable, char *argv[]) {
-    if (processCount >= MAX_PROCESSES) {
-        fprintf(stderr, "Maximum number of processes reached\n");
+// The batch* helpers only emit vertices: fills inside rlBegin(RL_TRIANGLES),
+// outlines inside rlBegin(RL_LINES). Triangles keep raylib's winding so
+// backface culling never drops them.
+static void batchTriangle(Vector2 a, Vector2 b, Vector2 c, Color color) {
+    rlColor4ub(color.r, color.g, color.b, color.a);
+    if ((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x) > 0) {
+        Vector2 swap = b;
+        b = c;
+        c = swap;
+    }
+    rlVertex2f(a.x, a.y);
+    rlVertex2f(b.x, b.y);
+    rlVertex2f(c.x, c.y);
+}
+
+static void batchCircle(Vector2 center, float radius, const Vector2 *unit, int segments, Color color) {
+    rlCheckRenderBatchLimit(3 * segments);
+    rlColor4ub(color.r, color.g, color.b, color.a);
+    for (int i = 0; i < segments; i++) {
+        rlVertex2f(center.x, center.y);
+        rlVertex2f(center.x + unit[i + 1].x * radius, center.y + unit[i + 1].y * radius);
+        rlVertex2f(center.x + unit[i].x * radius, center.y + unit[i].y * radius);
+    }
+}
+
+static void batchCircleOutline(Vector2 center, float radius, const Vector2 *unit, int segments, Color color) {
+    rlCheckRenderBatchLimit(2 * segments);
+    rlColor4ub(color.r, color.g, color.b, color.a);
+    for (int i = 0; i < segments; i++) {
+        rlVertex2f(center.x + unit[i].x * radius, center.y + unit[i].y * radius);
+        rlVertex2f(center.x + unit[i + 1].x * radius, center.y + unit[i + 1].y * radius);
+    }
+}
+
+static void batchRectangle(Rectangle r, Color color) {
+    rlCheckRenderBatchLimit(6);
+    batchTriangle((Vector2){r.x, r.y}, (Vector2){r.x, r.y + r.height},
+                  (Vector2){r.x + r.width, r.y + r.height}, color);
+    batchTriangle((Vector2){r.x, r.y}, (Vector2){r.x + r.width, r.y + r.height},
+                  (Vector2){r.x + r.width, r.y}, color);
+}
+
+static void batchRectangleOutline(Rectangle r, Color color) {
+    Vector2 corners[5] = {{r.x, r.y}, {r.x + r.width, r.y}, {r.x + r.width, r.y + r.height},
+                          {r.x, r.y + r.height}, {r.x, r.y}};
+    rlCheckRenderBatchLimit(8);
+    rlColor4ub(color.r, color.g, color.b, color.a);
+    for (int i = 0; i < 4; i++) {
+        rlVertex2f(corners[i].x, corners[i].y);
+        rlVertex2f(corners[i + 1].x, corners[i + 1].y);
+    }
+}
+
+// Start a frame's worth of claims over the visible area. Grids that would be
+// too fine for the view are disabled, and every claim on them fails.
+static void declutterReset(DeclutterGrid *grid, Rectangle visible, float cellWidth, float cellHeight) {
+    grid->originX = visible.x;
+    grid->originY = visible.y;
+    grid->cellWidth = cellWidth;
+    grid->cellHeight = cellHeight;
+    grid->columns = (int)(visible.width / cellWidth) + 1;
+    grid->rows = (int)(visible.height / cellHeight) + 1;
+    if ((long long)grid->columns * grid->rows > DECLUTTER_MAX_CELLS) {
+        grid->columns = grid->rows = 0;
         return;
     }
+    int cells = grid->columns * grid->rows;
+    if (cells > grid->capacity) {
+        unsigned int *grown = calloc(cells, sizeof(unsigned int));
+        if (!grown) {
+            grid->columns = grid->rows = 0;
+            return;
+        }
+        free(grid->stamp);
+        grid->stamp = grown;
+        grid->capacity = cells;
+        grid->epoch = 0;
+    }
+    if (++grid->epoch == 0) {
+        memset(grid->stamp, 0, grid->capacity * sizeof(unsigned int));
+        grid->epoch = 1;
+    }
+}
+
+// Claim the cell containing a point; fails if something already has it
+static int declutterClaim(DeclutterGrid *grid, float x, float y) {
+    int column = (int)((x - grid->originX) / grid->cellWidth);
+    int row = (int)((y - grid->originY) / grid->cellHeight);
+    if (column < 0 || row < 0 || column >= grid->columns || row >= grid->rows) return 0;
+    unsigned int *stamp = &grid->stamp[row * grid->columns + column];
+    if (*stamp == grid->epoch) return 0;
+    *stamp = grid->epoch;
+    return 1;
+}
+
+void drawSignals(const SystemState *view, Rectangle visible) {
+    static const Color signalColors[] = {RED, YELLOW, GREEN};
+    int segments = circleSegments(6);
+    const Vector2 *unit = unitCircle(segments);
+    
+    rlBegin(RL_TRIANGLES);
+    for (int i = 0; i < view->signalCount; i++) {
+        Vector2 position = {view->signals[i].x, view->signals[i].y};
+        if (!CheckCollisionPointRec(position, visible)) continue;
+        int state = view->signals[i].state;
+        batchCircle(position, 6, unit, segments, state >= 0 && state <= 2 ? signalColors[state] : GRAY);
+    }
+    rlEnd();
     
-    pid_t pid = fork();
-    
-    if (pid < 0) {
-        perror("Fork failed");
-        return;
-    } else if (pid == 0) {
-        // Child process
-        execvp(executable, argv);
-        perror("Exec failed");
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        processes[processCount].pid = pid;
-        strncpy(processes[processCount].name, name, sizeof(processes[processCount].name) - 1);
-        processes[processCount].running = 1;
-        processCount++;
+    rlBegin(RL_LINES);
+    for (int i = 0; i < view->signalCount; i++) {
+        Vector2 position = {view->signals[i].x, view->signals[i].y};
+        if (!CheckCollisionPointRec(position, visible)) continue;
+        batchCircleOutline(position, 6, unit, segments, BLACK);
+    }
+    rlEnd();
+}
+
+void drawSwitches(const SystemState *view, Rectangle visible) {
+    rlBegin(RL_TRIANGLES);
+    for (int i = 0; i < view->switchCount; i++) {
+        float x = view->switches[i].x;
+        float y = view->switches[i].y;
+        if (!CheckCollisionPointRec((Vector2){x, y}, visible)) continue;
+        Rectangle switchNormal = {x - 20, y - 10, 40, 20};
+        Rectangle switchReverse = {x - 10, y - 20, 20, 40};
+        int reverse = view->switches[i].state != 0;
         
-        printf("Launched %s (PID: %d)\n", name, pid);
-        char logMsg[100];
-        snprintf(logMsg, sizeof(logMsg), "Launched %s component (PID: %d)", name, pid);
-        addLog(logMsg);
+        // The inactive leg first so the active one is drawn over it
+        batchRectangle(reverse ? switchNormal : switchReverse, GRAY);
+        batchRectangle(reverse ? switchReverse : switchNormal, DARKGREEN);
     }
+    rlEnd();
+    
+    rlBegin(RL_LINES);
+    for (int i = 0; i < view->switchCount; i++) {
+        float x = view->switches[i].x;
+        float y = view->switches[i].y;
+        if (!CheckCollisionPointRec((Vector2){x, y}, visible)) continue;
+        Rectangle switchNormal = {x - 20, y - 10, 40, 20};
+        Rectangle switchReverse = {x - 10, y - 20, 20, 40};
+        int reverse = view->switches[i].state != 0;
+        batchRectangleOutline(reverse ? switchNormal : switchReverse, DARKGRAY);
+        batchRectangleOutline(reverse ? switchReverse : switchNormal, BLACK);
+    }
+    rlEnd();
 }
 
-// Launch system components in the correct order with delays
-void launchComponents() {
-    // First launch the Central Control System and wait for it to initialize
-    char *ccsArgs[] = {"./central_control_system", NULL};
-    launchProcess("Central Control System", "./central_control_system", ccsArgs);
-    sleep(1);  // Give CCS time to start up
-    
-    // Launch Zone Controllers with delays
-    for (int i = 1; i <= 3; i++) {
-        char zoneId[8];
-        sprintf(zoneId, "%d", i);
-        char *zcArgs[] = {"./zone_controller", zoneId, "127.0.0.1", NULL};
-        char name[32];
-        sprintf(name, "Zone Controller %d", i);
-        launchProcess(name, "./zone_controller", zcArgs);
-        usleep(500000);  // 500ms delay between zone controller launches
+// Work out which way a train is heading: along its last displacement if it
+// moved, otherwise along its section (or the x axis) in its direction
+static void trainHeading(const TrainMotion *motion, const TrainSlot *train, float *hx, float *hy) {
+    if (motion->updateNs && motion->direction == train->direction) {
+        float dx = train->x - motion->baseX;
+        float dy = train->y - motion->baseY;
+        float length = sqrtf(dx * dx + dy * dy);
+        if (length > 0.5f) {
+            *hx = dx / length;
+            *hy = dy / length;
+            return;
+        }
     }
     
-    sleep(1);  // Wait for zone controllers to connect to CCS
-    
-    // Launch Wayside Equipment with delays
-    for (int i = 0; i < sharedState->signalCount; i++) {
-        char id[8], type[8], zoneId[8], section[8];
-        sprintf(id, "%d", sharedState->signals[i].id);
-        sprintf(type, "0");  // 0 = signal
-        sprintf(zoneId, "%d", sharedState->signals[i].zoneId);
-        sprintf(section, "%d", sharedState->signals[i].section);
+    int segment = trackSegmentForSection(train->section);
+    if (segment >= 0) {
+        float dx = track.x1[segment] - track.x0[segment];
+        float dy = track.y1[segment] - track.y0[segment];
+        float length = sqrtf(dx * dx + dy * dy);
+        if (length > 0) {
+            *hx = dx / length * train->direction;
+            *hy = dy / length * train->direction;
+            return;
+        }
+    }
+    *hx = (float)train->direction;
+    *hy = 0;
+}
+
+// Replace each train's reported position with a dead-reckoned one: extrapolate
+// from the last report using its speed and receive time, and fold the jump a
+// new report causes into an offset that decays over DEAD_RECKONING_CORRECTION_MS
+void extrapolateTrains(TrainSlot *trains, TrainMotion *motions, int count, unsigned long long now) {
+    for (int i = 0; i < count; i++) {
+        TrainSlot *train = &trains[i];
+        TrainMotion *motion = &motions[i];
         
-        char *signalArgs[] = {"./wayside_equipment", id, type, zoneId, section, "127.0.0.1", NULL};
-        char name[32];
-        sprintf(name, "Signal %d", sharedState->signals[i].id);
-        launchProcess(name, "./wayside_equipment", signalArgs);
-        usleep(200000);  // 200ms delay
+        if (train->lastUpdateNs != motion->updateNs) {
+            int hadReport = motion->updateNs != 0;
+            trainHeading(motion, train, &motion->headingX, &motion->headingY);
+            motion->updateNs = train->lastUpdateNs;
+            motion->correctionNs = now;
+            motion->baseX = train->x;
+            motion->baseY = train->y;
+            motion->direction = train->direction;
+            motion->velocity = train->atStation ? 0 : train->speed * TRAIN_PX_PER_SPEED_UNIT;
+            motion->errorX = 0;
+            motion->errorY = 0;
+            
+            if (hadReport) {
+                float age = (now > motion->updateNs ? now - motion->updateNs : 0) / 1e9f;
+                if (age > DEAD_RECKONING_MAX_MS / 1000.0f) age = DEAD_RECKONING_MAX_MS / 1000.0f;
+                float errorX = motion->drawX - (motion->baseX + motion->headingX * motion->velocity * age);
+                float errorY = motion->drawY - (motion->baseY + motion->headingY * motion->velocity * age);
+                if (errorX * errorX + errorY * errorY < DEAD_RECKONING_SNAP_PX * DEAD_RECKONING_SNAP_PX) {
+                    motion->errorX = errorX;
+                    motion->errorY = errorY;
+                }
+            }
+        }
+        
+        float age = (now > motion->updateNs ? now - motion->updateNs : 0) / 1e9f;
+        if (age > DEAD_RECKONING_MAX_MS / 1000.0f) age = DEAD_RECKONING_MAX_MS / 1000.0f;
+        float decay = expf(-((now - motion->correctionNs) / 1e6f) / DEAD_RECKONING_CORRECTION_MS);
+        motion->drawX = motion->baseX + motion->headingX * motion->velocity * age + motion->errorX * decay;
+        motion->drawY = motion->baseY + motion->headingY * motion->velocity * age + motion->errorY * decay;
+        
+        train->x = motion->drawX;
+        train->y = motion->drawY;
+    }
+}
+
+static Color trainColor(const char *name) {
+    if (strcmp(name, "RED") == 0) return RED;
+    if (strcmp(name, "BLUE") == 0) return BLUE;
+    if (strcmp(name, "GREEN") == 0) return GREEN;
+    if (strcmp(name, "ORANGE") == 0) return ORANGE;
+    if (strcmp(name, "PURPLE") == 0) return PURPLE;
+    return YELLOW;
+}
+
+// Draw the fleet in batched passes with level of detail: trains shrink to
+// dots when they are only a few pixels across, direction arrows need a
+// readable size and a spot of their own, and labels are only drawn when
+// zoomed in, where they do not overlap another label, up to TRAIN_LABEL_MAX
+void drawTrains(const TrainSlot *trains, TrainMotion *motions, int count, Rectangle visible) {
+    float screenRadius = TRAIN_SIZE * camera.zoom;
+    int segments = circleSegments(TRAIN_SIZE);
+    const Vector2 *unit = unitCircle(segments);
+    int dots = screenRadius < TRAIN_DOT_MAX_PX;
+    int arrows = screenRadius >= TRAIN_ARROW_MIN_PX;
+    int labels = camera.zoom >= TRAIN_LABEL_MIN_ZOOM;
+    if (arrows) declutterReset(&arrowGrid, visible, 2 * TRAIN_SIZE, 2 * TRAIN_SIZE);
+    if (labels) declutterReset(&labelGrid, visible, TRAIN_LABEL_WIDTH, TRAIN_LABEL_HEIGHT);
+    
+    // Fills and arrows share the triangle pass
+    rlBegin(RL_TRIANGLES);
+    for (int i = 0; i < count; i++) {
+        const TrainSlot *train = &trains[i];
+        if (!CheckCollisionPointRec((Vector2){train->x, train->y}, visible)) continue;
+        if (motions[i].color.a == 0) motions[i].color = trainColor(train->color);
+        Color color = motions[i].color;
+        
+        if (dots) {
+            // A fixed-size square keeps distant trains visible
+            float half = TRAIN_DOT_MAX_PX / camera.zoom;
+            batchRectangle((Rectangle){train->x - half, train->y - half, 2 * half, 2 * half}, color);
+            continue;
+        }
+        batchCircle((Vector2){train->x, train->y}, TRAIN_SIZE, unit, segments, color);
+        
+        if (arrows && declutterClaim(&arrowGrid, train->x, train->y)) {
+            float dirX = train->direction * 8;
+            batchTriangle((Vector2){train->x + dirX, train->y},
+                          (Vector2){train->x - dirX / 2, train->y - 5},
+                          (Vector2){train->x - dirX / 2, train->y + 5}, color);
+        }
     }
+    rlEnd();
+    if (dots) return;
     
-    for (int i = 0; i < sharedState->switchCount; i++) {
-        char id[8], type[8], zoneId[8], section[8];
-        sprintf(id, "%d", sharedState->switches[i].id);
-        sprintf(type, "1");  // 1 = switch
-        sprintf(zoneId, "%d", sharedState->switches[i].zoneId);
-        sprintf(section, "%d", sharedState->switches[i].section);
+    rlBegin(RL_LINES);
+    for (int i = 0; i < count; i++) {
+        if (!CheckCollisionPointRec((Vector2){trains[i].x, trains[i].y}, visible)) continue;
+        batchCircleOutline((Vector2){trains[i].x, trains[i].y}, TRAIN_SIZE, unit, segments, BLACK);
+    }
+    rlEnd();
+    
+    if (!labels) return;
+    int labelCount = 0;
+    for (int i = 0; i < count && labelCount < TRAIN_LABEL_MAX; i++) {
+        const TrainSlot *train = &trains[i];
+        if (!CheckCollisionPointRec((Vector2){train->x, train->y}, visible)) continue;
+        if (!declutterClaim(&labelGrid, train->x, train->y - 25)) continue;
         
-        char *switchArgs[] = {"./wayside_equipment", id, type, zoneId, section, "127.0.0.1", NULL};
-        char name[32];
-        sprintf(name, "Switch %d", sharedState->switches[i].id);
-        launchProcess(name, "./wayside_equipment", switchArgs);
-        usleep(200000);  // 200ms delay
+        char trainInfo[60];
+        snprintf(trainInfo, sizeof(trainInfo), "%d (%d km/h) %s %s",
+                 train->id,
+                 train->speed,
+                 train->direction == 1 ? "→" : "←",
+                 train->atStation ? "STOPPED" : "");
+        DrawText(trainInfo, train->x - 30, train->y - 25, 10, BLACK);
+        labelCount++;
+    }
+}
+
+// Log panel input: wheel or Page Up/Down scrolls, End follows new events,
+// Tab cycles the component filter, clicking a train filters to it and
+// Backspace clears the filter
+void updateLogPanel(const TrainSlot *trains, int count) {
+    Vector2 mouse = GetMousePosition();
+    int scroll = 0;
+    if (mouse.y >= WORLD_VIEW_HEIGHT) {
+        float wheel = GetMouseWheelMove();
+        if (wheel != 0) scroll = wheel > 0 ? -3 : 3;
+    }
+    if (IsKeyPressed(KEY_PAGE_UP)) scroll = -MAX_LOGS;
+    if (IsKeyPressed(KEY_PAGE_DOWN)) scroll = MAX_LOGS;
+    if (scroll && eventStore.fd != -1) {
+        EventRecord lines[MAX_LOGS];
+        unsigned long long total;
+        eventStoreQuery(&eventStore, &logFilter, lines, MAX_LOGS, &total);
+        long long end = logFilter.end < 0 ? (long long)total : logFilter.end;
+        end += scroll;
+        if (end < MAX_LOGS) end = total < MAX_LOGS ? (long long)total : MAX_LOGS;
+        logFilter.end = end >= (long long)total ? -1 : end;
     }
+    if (IsKeyPressed(KEY_END)) logFilter.end = -1;
     
-    sleep(1);  // Wait for wayside equipment to connect
+    if (IsKeyPressed(KEY_TAB)) {
+        int next = logFilter.trainId ? 0 : logFilter.component + 1;
+        setLogFilter(next >= LOG_COMPONENT_COUNT ? -1 : next, 0);
+    }
+    if (IsKeyPressed(KEY_BACKSPACE)) {
+        setLogFilter(-1, 0);
+    }
     
-    // Finally, launch Trains
-    for (int i = 0; i < sharedState->trainCount; i++) {
-        char id[8], zoneId[8], section[8], initX[16], initY[16];
-        sprintf(id, "%d", sharedState->trains[i].id);
-        sprintf(zoneId, "%d", sharedState->trains[i].zoneId);
-        sprintf(section, "%d", sharedState->trains[i].section);
-        sprintf(initX, "%.1f", sharedState->trains[i].x);
-        sprintf(initY, "%.1f", sharedState->trains[i].y);
-        
-        char *trainArgs[] = {"./train", id, zoneId, section, "127.0.0.1", initX, initY, NULL};
-        char name[32];
-        sprintf(name, "Train %d", sharedState->trains[i].id);
-        launchProcess(name, "./train", trainArgs);
-        usleep(300000);  // 300ms delay
+    int pickHeight = replayMode ? WORLD_VIEW_HEIGHT - TIMELINE_HEIGHT : WORLD_VIEW_HEIGHT;
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && mouse.y < pickHeight) {
+        Vector2 world = GetScreenToWorld2D(mouse, camera);
+        float pickRadius = (TRAIN_SIZE + 4) / (camera.zoom < 1 ? camera.zoom : 1);
+        for (int i = 0; i < count; i++) {
+            float dx = trains[i].x - world.x, dy = trains[i].y - world.y;
+            if (dx * dx + dy * dy <= pickRadius * pickRadius) {
+                setLogFilter(-1, trains[i].id);
+                break;
+            }
+        }
+    }
+}
+
+// Format one event as a panel line
+static void formatEventLine(const EventRecord *event, char *out, size_t size) {
+    char timestamp[20];
+    char source[24];
+    formatLogTime(event->timestamp, timestamp, sizeof(timestamp));
+    const char *component = event->component < LOG_COMPONENT_COUNT ? componentNames[event->component] : "?";
+    if (event->trainId) {
+        snprintf(source, sizeof(source), "%s %d", component, event->trainId);
+    } else if (event->zoneId) {
+        snprintf(source, sizeof(source), "%s Z%d", component, event->zoneId);
+    } else {
+        snprintf(source, sizeof(source), "%s", component);
+    }
+    snprintf(out, size, "[%s] %-12s %s", timestamp, source, event->text);
+}
+
+// Draw the filtered window of the event store into the (static) log panel
+void drawLogLines() {
+    if (eventStore.fd == -1) {
+        // No event store: show the newest ring entries
+        LogEntry logView[MAX_LOGS];
+        int logViewCount = logRingTail(&sharedState->log, logView, MAX_LOGS);
+        for (int i = 0; i < logViewCount; i++) {
+            char timestamp[20];
+            char logLine[MAX_LOG_LENGTH + 24];
+            formatLogTime(logView[i].timestamp, timestamp, sizeof(timestamp));
+            snprintf(logLine, sizeof(logLine), "[%s] %s", timestamp, logView[i].text);
+            DrawText(logLine, 30, 450 + i * LOG_LINE_HEIGHT, 10, BLACK);
+        }
+        return;
     }
     
-    // Add a final log message
-    addLog("All CBTC components launched successfully");
+    EventRecord lines[MAX_LOGS];
+    unsigned long long total;
+    int lineCount = eventStoreQuery(&eventStore, &logFilter, lines, MAX_LOGS, &total);
+    for (int i = 0; i < lineCount; i++) {
+        char logLine[MAX_LOG_LENGTH + 48];
+        formatEventLine(&lines[i], logLine, sizeof(logLine));
+        Color color = lines[i].severity == LOG_SEVERITY_ERROR ? RED : (lines[i].severity == LOG_SEVERITY_WARNING ? ORANGE : BLACK);
+        DrawText(logLine, 30, 450 + i * LOG_LINE_HEIGHT, 10, color);
+    }
     
-    // // Wait for system to stabilize
-    // sleep(2);
-    // 
-    // // Route Train 102 to North station
-    // addLog("Routing Train 102 to North station");
-    // system("echo 'route 102 23' | nc localhost 8000");
+    char filterInfo[120];
+    char filterName[32];
+    if (logFilter.trainId) {
+        snprintf(filterName, sizeof(filterName), "train %d", logFilter.trainId);
+    } else if (logFilter.component >= 0) {
+        snprintf(filterName, sizeof(filterName), "%s", componentNames[logFilter.component]);
+    } else {
+        snprintf(filterName, sizeof(filterName), "all");
+    }
+    unsigned long long end = logFilter.end < 0 ? total : (unsigned long long)logFilter.end;
+    snprintf(filterInfo, sizeof(filterInfo), "Filter: %s | %llu/%llu events | %s | Tab, click train, Bksp, PgUp/PgDn, End",
+             filterName, end, total, logFilter.end < 0 ? "live" : "scrolled");
+    DrawText(filterInfo, 230, 428, 10, DARKGRAY);
 }
 
-// Terminate all child processes with proper signal handling
-void terminateProcesses() {
-    // First ask nicely with SIGTERM
+void drawStatusText(int trainViewCount, int trainCapacity) {
+    if (replayMode) {
+        char replayInfo[80];
+        snprintf(replayInfo, sizeof(replayInfo), "Replay: %s", replayPath);
+        DrawText(replayInfo, 620, 60, 16, DARKGRAY);
+        char trainTableInfo[60];
+        snprintf(trainTableInfo, sizeof(trainTableInfo), "Trains: %d (capacity %d)",
+                 trainViewCount, trainCapacity);
+        DrawText(trainTableInfo, 620, 80, 16, DARKGRAY);
+        return;
+    }
+    
+    // Process count display
+    int alive = 0;
     for (int i = 0; i < processCount; i++) {
-        if (processes[i].running) {
-            printf("Sending SIGTERM to %s (PID: %d)\n", processes[i].name, processes[i].pid);
-            kill(processes[i].pid, SIGTERM);
+        if (__atomic_load_n(&processes[i].running, __ATOMIC_ACQUIRE)) alive++;
+    }
+    char procInfo[60];
+    snprintf(procInfo, sizeof(procInfo), "Running components: %d/%d, restarts %d",
+             alive, processCount, __atomic_load_n(&totalRestarts, __ATOMIC_RELAXED));
+    DrawText(procInfo, 620, 60, 16, DARKGRAY);
+    
+    // Position ingest counters
+    char ingestInfo[100];
+    snprintf(ingestInfo, sizeof(ingestInfo), "Ingest%s: %u /s, depth %u (max %u), drops %u",
+             positionTransportShm ? " (shm)" : "",
+             __atomic_load_n(&sharedState->ingest.packetsPerSecond, __ATOMIC_RELAXED),
+             __atomic_load_n(&sharedState->ingest.queueDepth, __ATOMIC_RELAXED),
+             __atomic_load_n(&sharedState->ingest.maxQueueDepth, __ATOMIC_RELAXED),
+             __atomic_load_n(&sharedState->ingest.kernelDrops, __ATOMIC_RELAXED));
+    DrawText(ingestInfo, 620, 80, 16, DARKGRAY);
+    
+    char trainTableInfo[60];
+    snprintf(trainTableInfo, sizeof(trainTableInfo), "Trains: %d (capacity %d)",
+             trainViewCount, trainCapacity);
+    DrawText(trainTableInfo, 620, 100, 16, DARKGRAY);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Percentiles over the current window of one phase
+PhaseStats phaseStats(ProfilePhase phase) {
+    static double sorted[PROFILE_WINDOW];
+    PhaseStats stats = {0, 0, 0, 0};
+    PhaseProfile *p = &profile[phase];
+    
+    stats.samples = __atomic_load_n(&p->total, __ATOMIC_RELAXED);
+    int count = stats.samples < PROFILE_WINDOW ? (int)stats.samples : PROFILE_WINDOW;
+    if (count == 0) return stats;
+    
+    memcpy(sorted, p->samples, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compareDoubles);
+    stats.p50 = sorted[count / 2];
+    stats.p99 = sorted[(count * 99) / 100];
+    stats.max = sorted[count - 1];
+    return stats;
+}
+
+// Toggled with F3. Figures are recomputed a few times a second, not per frame.
+void drawProfilerOverlay() {
+    static PhaseStats stats[PHASE_COUNT];
+    static unsigned long long lastRefresh = 0;
+    unsigned long long now = monotonicNs();
+    if (now - lastRefresh >= PROFILE_OVERLAY_REFRESH_MS * 1000000ULL) {
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            stats[i] = phaseStats(i);
         }
+        lastRefresh = now;
     }
     
-    // Give processes a chance to terminate gracefully
-    sleep(1);
+    int x = 560, y = 130, lineHeight = 14;
+    DrawRectangle(x, y, 420, (PHASE_COUNT + 2) * lineHeight, Fade(BLACK, 0.75f));
+    DrawText("phase                   p50 us     p99 us     max us", x + 8, y + 4, 10, RAYWHITE);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        char line[100];
+        snprintf(line, sizeof(line), "%-20s %9.1f  %9.1f  %9.1f",
+                 phaseNames[i], stats[i].p50, stats[i].p99, stats[i].max);
+        DrawText(line, x + 8, y + 4 + (i + 1) * lineHeight, 10, i == PHASE_FRAME ? YELLOW : RAYWHITE);
+    }
+}
+
+// Write the current per-phase figures to profileCsvPath, if one was given
+void dumpProfileCsv() {
+    if (!profileCsvPath) return;
     
-    // Now check which ones are still running and force quit with SIGKILL if needed
+    FILE *csv = fopen(profileCsvPath, "w");
+    if (!csv) {
+        perror("Failed to open profile CSV");
+        return;
+    }
+    fprintf(csv, "phase,samples,p50_us,p99_us,max_us\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        PhaseStats stats = phaseStats(i);
+        fprintf(csv, "%s,%llu,%.1f,%.1f,%.1f\n", phaseNames[i], stats.samples,
+                stats.p50, stats.p99, stats.max);
+    }
+    fclose(csv);
+    printf("Profile written to %s\n", profileCsvPath);
+}
+
+// Print one line of throughput, staleness and liveness figures
+void printHeadlessStats(double elapsed, double interval, unsigned long long *lastUpdates) {
+    static double *ages = NULL;
+    static int agesCapacity = 0;
+    IngestStats *ingest = &sharedState->ingest;
+    
+    unsigned long long updates = __atomic_load_n(&ingest->updates, __ATOMIC_RELAXED);
+    double updatesPerSecond = (updates - *lastUpdates) / interval;
+    *lastUpdates = updates;
+    
+    // Age of the newest position we hold for each train
+    int count = __atomic_load_n(&trainTable.header->count, __ATOMIC_ACQUIRE);
+    if (count > agesCapacity) {
+        double *grown = realloc(ages, count * sizeof(double));
+        if (!grown) return;
+        ages = grown;
+        agesCapacity = count;
+    }
+    TrainSlot *slots = trainTableSlots(trainTable.header);
+    unsigned long long now = monotonicNs();
+    int stale = 0;
+    for (int i = 0; i < count; i++) {
+        TrainSlot train;
+        trainSlotRead(&slots[i], &train);
+        ages[i] = train.lastUpdateNs < now ? (now - train.lastUpdateNs) / 1e6 : 0.0;
+        if (ages[i] > STALE_TRAIN_AGE_MS) stale++;
+    }
+    qsort(ages, count, sizeof(double), compareDoubles);
+    double ageP50 = count ? ages[count / 2] : 0.0;
+    double ageP99 = count ? ages[(count * 99) / 100] : 0.0;
+    double ageMax = count ? ages[count - 1] : 0.0;
+    
+    // Component liveness; the supervisor reaps and restarts
+    int alive = 0;
     for (int i = 0; i < processCount; i++) {
-        if (processes[i].running) {
-            int status;
-            pid_t result = waitpid(processes[i].pid, &status, WNOHANG);
-            
-            if (result == 0) {
-                // Process still running, force quit
-                printf("Sending SIGKILL to %s (PID: %d)\n", processes[i].name, processes[i].pid);
-                kill(processes[i].pid, SIGKILL);
-                waitpid(processes[i].pid, &status, 0);
-            }
-            
-            processes[i].running = 0;
+        if (__atomic_load_n(&processes[i].running, __ATOMIC_ACQUIRE)) {
+            alive++;
         }
     }
     
-    printf("All processes terminated\n");
+    printf("[%7.1fs] updates/s %.0f | packets %llu drops %u depth max %u | "
+           "trains %d stale %d age p50/p99/max %.0f/%.0f/%.0f ms | processes %d/%d alive, %d restarts\n",
+           elapsed, updatesPerSecond,
+           __atomic_load_n(&ingest->packets, __ATOMIC_RELAXED),
+           __atomic_load_n(&ingest->kernelDrops, __ATOMIC_RELAXED),
+           __atomic_load_n(&ingest->maxQueueDepth, __ATOMIC_RELAXED),
+           count, stale, ageP50, ageP99, ageMax, alive, processCount,
+           __atomic_load_n(&totalRestarts, __ATOMIC_RELAXED));
+    fflush(stdout);
 }
 
-// Clean up shared memory and ensure it's properly unlinked
-void cleanupSharedMemory() {
-    if (!isCleanupDone) {
-        if (sharedState != MAP_FAILED) {
-            pthread_mutex_destroy(&sharedState->mutex);
-            munmap(sharedState, sizeof(SharedState));
+static int compareSectionOccupancy(const void *a, const void *b) {
+    unsigned long long oa = sectionStats[*(const int *)a].occupancyNs;
+    unsigned long long ob = sectionStats[*(const int *)b].occupancyNs;
+    return (ob > oa) - (ob < oa);
+}
+
+// The most occupied sections and every station's dwell times, for spotting
+// bottlenecks after a headless run
+void printSectionReport() {
+    if (!sectionStats) return;
+    
+    int *order = malloc(track.count * sizeof(int));
+    int ranked = 0;
+    for (int i = 0; i < track.count && order; i++) {
+        if (track.section[i] >= 0 && sectionStats[track.section[i]].occupancyNs) {
+            order[ranked++] = track.section[i];
         }
-        
-        if (shmFd >= 0) {
-            close(shmFd);
+    }
+    if (ranked) {
+        qsort(order, ranked, sizeof(int), compareSectionOccupancy);
+        printf("Busiest sections:\n");
+        for (int i = 0; i < ranked && i < 10; i++) {
+            const SectionStats *stats = &sectionStats[order[i]];
+            printf("  section %-4d occupancy %8.1f train-s  traversals %6u  mean speed %5.1f km/h\n",
+                   order[i], stats->occupancyNs / 1e9, stats->traversals,
+                   stats->speedSamples ? (double)stats->speedSum / stats->speedSamples : 0.0);
+        }
+    }
+    free(order);
+    
+    for (int i = 0; i < stationCount; i++) {
+        const DwellStats *dwell = &dwellStats[i];
+        if (i == 0) printf("Station dwell (s):\n");
+        printf("  %-16s stops %6u  min %6.1f  mean %6.1f  p95 %6.1f  max %6.1f  stop_time %d\n",
+               stations[i].name, dwell->count, dwell->minMs / 1000.0,
+               dwell->count ? dwell->totalMs / 1000.0 / dwell->count : 0.0,
+               dwellPercentile(dwell, 0.95) / 1000.0, dwell->maxMs / 1000.0, stations[i].stopTime);
+    }
+    fflush(stdout);
+}
+
+// Per-component restart counts and time to recover
+void printRestartReport() {
+    if (!__atomic_load_n(&totalRestarts, __ATOMIC_RELAXED)) return;
+    
+    printf("Component restarts:\n");
+    for (int i = 0; i < processCount; i++) {
+        if (processes[i].restarts) {
+            printf("  %-24s restarts %3d  recover last %u ms, max %u ms%s\n",
+                   processes[i].name, processes[i].restarts,
+                   processes[i].lastRecoveryMs, processes[i].maxRecoveryMs,
+                   processes[i].exitNs ? " (not recovered)" : "");
         }
+    }
+    fflush(stdout);
+}
+
+// Run without a window: ingest keeps going on its own thread while this loop
+// ticks at a fixed rate and periodically reports. A duration of 0 runs until
+// the process is signalled.
+void runHeadless(double duration, double statsInterval) {
+    unsigned long long start = monotonicNs();
+    unsigned long long lastUpdates = 0;
+    double nextStats = statsInterval;
+    struct timespec tick = {0, HEADLESS_TICK_MS * 1000000L};
+    
+    printf("Running headless%s, stats every %.0fs\n",
+           duration > 0 ? "" : " until interrupted", statsInterval);
+    
+    while (!stopSignal) {
+        nanosleep(&tick, NULL);
+        double elapsed = (monotonicNs() - start) / 1e9;
         
-        shm_unlink(shmName);
-        printf("Shared memory cleaned up\n");
-        isCleanupDone = 1;
+        if (elapsed >= nextStats) {
+            printHeadlessStats(elapsed, statsInterval, &lastUpdates);
+            nextStats += statsInterval;
+        }
+        if (duration > 0 && elapsed >= duration) {
+            break;
+        }
     }
 }
 
-// Signal handler for clean termination
+void printUsage(const char *program) {
+    printf("Usage: %s [--headless] [--duration SECONDS] [--stats-interval SECONDS] [--profile-csv FILE]\n"
+           "       [--record FILE | --replay FILE]\n", program);
+    printf("  --headless           Run without a window (for soak tests and benchmarks)\n");
+    printf("  --duration N         Exit after N seconds (headless only, default: run forever)\n");
+    printf("  --stats-interval N   Seconds between headless stats lines (default: %d)\n",
+           HEADLESS_STATS_INTERVAL_S);
+    printf("  --profile-csv FILE   Write per-phase frame timings (p50/p99/max) to FILE on exit\n");
+    printf("  --record FILE        Record train positions and signal/switch states to FILE\n");
+    printf("  --replay FILE        Play back a recording instead of running the system (window only)\n");
+}
+
+// SIGINT/SIGTERM only ask the main thread to stop. The teardown takes locks
+// (the zygote socket, the event store index) and joins threads, so running it
+// here could deadlock on a lock the interrupted code already holds.
 void signalHandler(int sig) {
-    printf("\nCaught signal %d. Cleaning up...\n", sig);
+    stopSignal = sig;
+}
+
+// Stop components and background threads, then report. Runs on the main thread.
+void stopSystem() {
+    if (stopSignal) {
+        printf("\nCaught signal %d. Cleaning up...\n", (int)stopSignal);
+    }
+    stopRecording();
+    stopSupervisor();
+    printRestartReport();
     terminateProcesses();
+    stopPositionIngest();
+    if (isHeadless) printSectionReport();
+    dumpProfileCsv();
+    stopLogSpill();
+    replayClose();
     cleanupSharedMemory();
+}
+
+// Bring up the live system: ingest, logging, components and supervision
+void startSystem() {
+    // Set up environment variables
+    setupEnvironmentVars();
+    rotateCcsJournal();
     
-    // Close raylib window if it's open
-    if (IsWindowReady()) {
-        CloseWindow();
+    // Set up position multicast listener, unless trains write the table themselves
+    if (positionTransportShm) {
+        printf("Train positions via shared memory (%s)\n", trainShmName);
+    } else {
+        setupPositionMulticastListener();
     }
     
-    exit(0);
+    // Initialize system state
+    initializeTrains();
+    
+    // Initialize track layout for visualization, with the signals and switches
+    initializeTrackLayout();
+    initializeSectionStats();
+    
+    // Start applying train position updates in the background
+    startPositionIngest();
+    startLogSpill();
+    
+    // Launch CBTC components in the correct order, then keep them running
+    launchComponents();
+    startSupervisor();
+    startRecording();
 }
 
 // Main function
-int main() {
+int main(int argc, char *argv[]) {
+    double duration = 0;
+    double statsInterval = HEADLESS_STATS_INTERVAL_S;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            isHeadless = 1;
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+            profileCsvPath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+            statsInterval = atof(argv[++i]);
+            if (statsInterval <= 0) statsInterval = HEADLESS_STATS_INTERVAL_S;
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (replayPath && (isHeadless || recordPath)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
     // Set up signal handlers
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
     
+    // Child exits are read from a signalfd by the supervisor. Block SIGCHLD
+    // before any thread exists so every thread inherits the mask.
+    sigset_t childMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &childMask, NULL);
+    
     // Initialize shared memory for component communication
     initSharedMemory();
     
-    // Set up environment variables
-    setupEnvironmentVars();
-    
-    // Set up position multicast listener
-    setupPositionMulticastListener();
-    
-    // Initialize system state
-    initializeSignals();
-    initializeSwitches();
-    initializeTrains();
-    
-    // Initialize track layout for visualization
-    initializeTrackLayout();
+    // A replay drives the shared state from the recording; nothing is launched
+    if (replayPath) {
+        initializeTrackLayout();
+        initializeSectionStats();
+        if (replayOpen(replayPath) < 0) {
+            cleanupSharedMemory();
+            freeSectionStats();
+            freeTrackLayout();
+            return 1;
+        }
+    } else {
+        startSystem();
+    }
     
-    // Launch CBTC components in the correct order
-    launchComponents();
+    // A signal during startup skips the window and goes straight to teardown
+    if (isHeadless || stopSignal) {
+        if (isHeadless) {
+            addLog("CBTC System Orchestrator started (headless)");
+            runHeadless(duration, statsInterval);
+        }
+        stopSystem();
+        freeSectionStats();
+        freeTrackLayout();
+        return 0;
+    }
     
     // Initialize window
     SetTraceLogLevel(LOG_ERROR);
@@ -704,173 +3799,114 @@ int main() {
     SetTargetFPS(60);
     
     // Add initial log
-    addLog("CBTC System Orchestrator started");
+    addLog(replayMode ? "Replaying a recording" : "CBTC System Orchestrator started");
     
     // Main render loop
-    while (!WindowShouldClose()) {
-        // Check for train position updates
-        fd_set readfds;
-        struct timeval tv;
-        FD_ZERO(&readfds);
-        FD_SET(positionMulticastSocket, &readfds);
-        tv.tv_sec = 0;
-        tv.tv_usec = 1000; // 1ms timeout for non-blocking check
-
-        if (select(positionMulticastSocket + 1, &readfds, NULL, NULL, &tv) > 0) {
-            if (FD_ISSET(positionMulticastSocket, &readfds)) {
-                char buffer[BUFFER_SIZE];
-                struct sockaddr_in senderAddr;
-                socklen_t addrLen = sizeof(senderAddr);
-                int bytesRead = recvfrom(positionMulticastSocket, buffer, BUFFER_SIZE, 0,
-                                  (struct sockaddr *)&senderAddr, &addrLen);
-                if (bytesRead > 0) {
-                    buffer[bytesRead] = '\0';
-                    processPositionUpdate(buffer);
-                }
-            }
+    static SystemState view;
+    TrainSlot *trainView = NULL;
+    TrainMotion *trainMotion = NULL;
+    int trainViewCapacity = 0;
+    unsigned long long frameStart = monotonicNs();
+    while (!WindowShouldClose() && !stopSignal) {
+        unsigned long long mark = monotonicNs();
+        if (replayMode) {
+            updateReplay();
         }
-        
-        BeginDrawing();
-        ClearBackground(RAYWHITE);
-        
-        // Lock shared state for reading
-        pthread_mutex_lock(&sharedState->mutex);
-        
-        // Draw track segments
-        for (int i = 0; i < trackSegmentCount; i++) {
-            Color trackColor;
-            switch(trackSegments[i].zoneId) {
-                case 1: trackColor = (Color){200, 220, 255, 255}; break; // Light blue
-                case 2: trackColor = (Color){220, 255, 220, 255}; break; // Light green
-                case 3: trackColor = (Color){255, 220, 220, 255}; break; // Light red
-                default: trackColor = LIGHTGRAY;
-            }
-            
-            DrawLineEx(trackSegments[i].start, trackSegments[i].end, 6, trackColor);
-            DrawLineEx(trackSegments[i].start, trackSegments[i].end, 2, BLACK);
-            
-            // Draw section number
-            Vector2 midpoint = {
-                (trackSegments[i].start.x + trackSegments[i].end.x) / 2,
-                (trackSegments[i].start.y + trackSegments[i].end.y) / 2 + 15
-            };
-            char sectionText[10];
-            sprintf(sectionText, "%d", trackSegments[i].section);
-            DrawText(sectionText, midpoint.x - 5, midpoint.y, 16, DARKGRAY);
-        }
-        
-        // Draw stations
-        for (int i = 0; i < stationCount; i++) {
-            DrawRectangleRec(stations[i].bounds, LIGHTGRAY);
-            DrawRectangleLinesEx(stations[i].bounds, 2, BLACK);
-            DrawText(stations[i].name, stations[i].position.x + 5, 
-                   stations[i].position.y + 5, 10, BLACK);
-        }
-        
-        // Draw signals
-        for (int i = 0; i < sharedState->signalCount; i++) {
-            Color signalColor;
-            switch(sharedState->signals[i].state) {
-                case 0: signalColor = RED; break;
-                case 1: signalColor = YELLOW; break;
-                case 2: signalColor = GREEN; break;
-                default: signalColor = GRAY;
-            }
-            DrawCircle(sharedState->signals[i].x, sharedState->signals[i].y, 6, signalColor);
-            DrawCircleLines(sharedState->signals[i].x, sharedState->signals[i].y, 6, BLACK);
+        updateCamera();
+        if (IsKeyPressed(KEY_F3)) {
+            showProfiler = !showProfiler;
+        }
+        if (IsKeyPressed(KEY_H)) {
+            heatmapMode = (heatmapMode + 1) % HEATMAP_MODE_COUNT;
         }
+        profilePhase(PHASE_CAMERA, &mark);
         
-        // Draw switches
-        for (int i = 0; i < sharedState->switchCount; i++) {
-            float x = sharedState->switches[i].x;
-            float y = sharedState->switches[i].y;
-            Rectangle switchNormal = {x - 20, y - 10, 40, 20};
-            Rectangle switchReverse = {x - 10, y - 20, 20, 40};
-            
-            if (sharedState->switches[i].state == 0) { // NORMAL
-                DrawRectangleRec(switchNormal, DARKGREEN);
-                DrawRectangleLinesEx(switchNormal, 1, BLACK);
-                DrawRectangleRec(switchReverse, GRAY);
-                DrawRectangleLinesEx(switchReverse, 1, DARKGRAY);
-            } else { // REVERSE
-                DrawRectangleRec(switchNormal, GRAY);
-                DrawRectangleLinesEx(switchNormal, 1, DARKGRAY);
-                DrawRectangleRec(switchReverse, DARKGREEN);
-                DrawRectangleLinesEx(switchReverse, 1, BLACK);
-            }
+        // Static geometry only changes with the camera
+        if (staticLayerDirty) {
+            bakeStaticLayer();
+            profilePhase(PHASE_BAKE, &mark);
         }
         
-        // Draw trains
-        for (int i = 0; i < sharedState->trainCount; i++) {
-            Color trainColor;
-            if (strcmp(sharedState->trains[i].color, "RED") == 0)
-                trainColor = RED;
-            else if (strcmp(sharedState->trains[i].color, "BLUE") == 0)
-                trainColor = BLUE;
-            else if (strcmp(sharedState->trains[i].color, "GREEN") == 0)
-                trainColor = GREEN;
-            else
-                trainColor = YELLOW;
-                     
-            DrawCircle(sharedState->trains[i].x, sharedState->trains[i].y, TRAIN_SIZE, trainColor);
-                     
-            // Draw a small direction indicator
-            float dirX = sharedState->trains[i].direction * 8;
-            DrawTriangle(
-                (Vector2){sharedState->trains[i].x + dirX, sharedState->trains[i].y},
-                (Vector2){sharedState->trains[i].x - dirX/2, sharedState->trains[i].y - 5},
-                (Vector2){sharedState->trains[i].x - dirX/2, sharedState->trains[i].y + 5},
-                trainColor
-            );
-            
-            DrawCircleLines(sharedState->trains[i].x, sharedState->trains[i].y, TRAIN_SIZE, BLACK);
-            
-            char trainInfo[60];
-            sprintf(trainInfo, "%d (%d km/h) %s %s", 
-                    sharedState->trains[i].id, 
-                    sharedState->trains[i].speed, 
-                    sharedState->trains[i].direction == 1 ? "→" : "←",
-                    sharedState->trains[i].atStation ? "STOPPED" : "");
-            
-            DrawText(trainInfo, sharedState->trains[i].x - 30, 
-                   sharedState->trains[i].y - 25, 10, BLACK);
+        // Take a consistent copy of the shared state; drawing holds no lock
+        sharedStateSnapshot(sharedState, &view);
+        profilePhase(PHASE_STATE_SNAPSHOT, &mark);
+        int trainCapacity = __atomic_load_n(&trainTable.header->capacity, __ATOMIC_ACQUIRE);
+        if (trainCapacity > trainViewCapacity) {
+            TrainSlot *grown = realloc(trainView, trainCapacity * sizeof(TrainSlot));
+            if (grown) {
+                trainView = grown;
+                TrainMotion *grownMotion = realloc(trainMotion, trainCapacity * sizeof(TrainMotion));
+                if (grownMotion) {
+                    memset(grownMotion + trainViewCapacity, 0,
+                           (trainCapacity - trainViewCapacity) * sizeof(TrainMotion));
+                    trainMotion = grownMotion;
+                    trainViewCapacity = trainCapacity;
+                }
+            }
         }
+        int trainViewCount = trainTableSnapshot(&trainTable, trainView, trainViewCapacity);
+        profilePhase(PHASE_TRAIN_SNAPSHOT, &mark);
+        extrapolateTrains(trainView, trainMotion, trainViewCount, replayMode ? replayClockNs() : mark);
+        profilePhase(PHASE_EXTRAPOLATE, &mark);
         
-        // Draw zone boundaries
-        DrawLine(380, 200, 380, 400, GRAY);
-        DrawLine(660, 200, 660, 400, GRAY);
-        DrawText("ZONE 1", 200, 380, 20, DARKBLUE);
-        DrawText("ZONE 2", 500, 380, 20, DARKGREEN);
-        DrawText("ZONE 3", 780, 380, 20, MAROON);
+        BeginDrawing();
         
-        // Draw logs
-        DrawRectangle(20, 420, 960, 160, LIGHTGRAY);
-        DrawRectangleLines(20, 420, 960, 160, BLACK);
-        DrawText("CBTC System Logs", 30, 425, 20, BLACK);
+        // Composite the cached static layer (render textures are stored upside down)
+        DrawTextureRec(staticLayer.texture,
+                       (Rectangle){0, 0, (float)staticLayer.texture.width, (float)-staticLayer.texture.height},
+                       (Vector2){0, 0}, WHITE);
+        profilePhase(PHASE_COMPOSITE, &mark);
         
-        for (int i = 0; i < sharedState->logCount; i++) {
-            DrawText(sharedState->logs[i], 30, 450 + i * 20, 10, BLACK);
+        // Dynamic world layers, culled to the view and kept off the log panel
+        Rectangle visible = expandRect(cameraView(), 40);
+        BeginScissorMode(0, 0, GetScreenWidth(), WORLD_VIEW_HEIGHT);
+        BeginMode2D(camera);
+        if (heatmapMode != HEATMAP_OFF) {
+            drawHeatmap(visible);
+            profilePhase(PHASE_HEATMAP, &mark);
         }
+        drawSignals(&view, visible);
+        profilePhase(PHASE_SIGNALS, &mark);
+        drawSwitches(&view, visible);
+        profilePhase(PHASE_SWITCHES, &mark);
+        drawTrains(trainView, trainMotion, trainViewCount, visible);
+        EndMode2D();
+        EndScissorMode();
+        if (replayMode) {
+            drawReplayTimeline();
+        }
+        profilePhase(PHASE_TRAINS, &mark);
         
-        // Unlock shared state
-        pthread_mutex_unlock(&sharedState->mutex);
-        
-        // Draw help text
-        DrawText("Railway CBTC Simulation Orchestrator", 30, 30, 24, BLACK);
-        DrawText("Running distributed CBTC components", 30, 60, 16, DARKGRAY);
-        DrawText("Press ESC to exit and terminate all components", 30, 80, 16, DARKGRAY);
-        
-        // Process count display
-        char procInfo[50];
-        sprintf(procInfo, "Running components: %d", processCount);
-        DrawText(procInfo, 780, 60, 16, DARKGRAY);
+        updateLogPanel(trainView, trainViewCount);
+        drawLogLines();
+        profilePhase(PHASE_LOGS, &mark);
+        drawStatusText(trainViewCount, trainCapacity);
+        profilePhase(PHASE_STATUS, &mark);
+        if (heatmapMode != HEATMAP_OFF) {
+            drawHeatmapOverlay();
+        }
+        if (showProfiler) {
+            drawProfilerOverlay();
+            profilePhase(PHASE_OVERLAY, &mark);
+        }
         
+        // Includes the wait for the frame limiter and buffer swap
         EndDrawing();
+        profilePhase(PHASE_END_DRAWING, &mark);
+        profilePhase(PHASE_FRAME, &frameStart);
     }
     
     // Clean up
-    terminateProcesses();
-    cleanupSharedMemory();
+    stopSystem();
+    freeSectionStats();
+    freeTrackLayout();
+    free(trainView);
+    free(trainMotion);
+    free(arrowGrid.stamp);
+    free(labelGrid.stamp);
+    if (staticLayer.id != 0) {
+        UnloadRenderTexture(staticLayer);
+    }
     CloseWindow();
     
     return 0;
@@ -0,0 +1,34 @@
+#ifndef CBTC_READY_H
+#define CBTC_READY_H
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Startup readiness handshake. The orchestrator hands every component the
+// write end of a pipe through CBTC_READY_FD; a component writes its pid once
+// it can serve the components that depend on it, so the launcher can start
+// the next tier without guessing with sleeps.
+#define READY_FD_ENV "CBTC_READY_FD"
+
+// Report readiness to the orchestrator. Safe to call more than once (e.g. after
+// a reconnect); only the first call writes. Components started by hand have no
+// CBTC_READY_FD and this is a no-op.
+static inline void notifyReady(void) {
+    const char *fdStr = getenv(READY_FD_ENV);
+    if (!fdStr) return;
+
+    int fd = atoi(fdStr);
+    pid_t pid = getpid();
+    ssize_t written;
+    // sizeof(pid_t) is far below PIPE_BUF, so concurrent reports never interleave
+    do {
+        written = write(fd, &pid, sizeof(pid));
+    } while (written < 0 && errno == EINTR);
+
+    close(fd);
+    unsetenv(READY_FD_ENV);
+}
+
+#endif // CBTC_READY_H
@@ -0,0 +1,187 @@
+#ifndef CBTC_SEND_QUEUE_H
+#define CBTC_SEND_QUEUE_H
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "cbtc_latency.h"
+
+// Outgoing queue for one command link (CCS to zone controller, zone
+// controller to train). Messages are newline-terminated and queued in a
+// lane per priority; a flush writes the safety lane first, so a speed limit
+// or emergency stop goes out ahead of station tables queued before it. A
+// message already partly written is always finished first, so lanes never
+// interleave inside a line.
+//
+// Writes never block. What the socket cannot take stays in the lanes until
+// the connection is writable again (EPOLLOUT), and TCP_NOTSENT_LOWAT keeps
+// the kernel from holding more than a few kilobytes of unsent data, so a
+// backlog waits here where higher priorities can still overtake it.
+#define SEND_QUEUE_LIMIT (1 << 20) // Unsent bytes per connection before it is given up as stalled
+#define SEND_NOTSENT_LOWAT 4096
+
+typedef enum {
+    SEND_PRIORITY_SAFETY,  // Movement authority, speed limits, emergency stops
+    SEND_PRIORITY_CONTROL, // Registration replies, routes, switch commands
+    SEND_PRIORITY_BULK,    // Station tables and other resync traffic
+    SEND_PRIORITIES
+} SendPriority;
+
+static const char *const sendPriorityNames[SEND_PRIORITIES] = {"safety", "control", "bulk"};
+
+typedef struct {
+    unsigned long long end;      // Lane byte count at the end of the message
+    unsigned long long queuedNs;
+} SendMark;
+
+typedef struct {
+    char *bytes;
+    size_t start;               // First unsent byte
+    size_t length;              // Unsent bytes
+    size_t capacity;
+    unsigned long long sent;    // Bytes written to the socket so far
+    unsigned long long retired; // Bytes of messages written in full
+    SendMark *marks;            // Unsent messages, oldest first (circular)
+    int markHead;
+    int markCount;
+    int markCapacity;
+} SendLane;
+
+typedef struct {
+    SendLane lanes[SEND_PRIORITIES];
+    int partial;         // Lane with a partly written message, or -1
+    size_t queuedBytes;
+    LatencyStats *stats; // One per priority, queueing to written; may be shared
+} SendQueue;
+
+static inline void sendQueueInit(SendQueue *queue, LatencyStats *stats) {
+    memset(queue, 0, sizeof(*queue));
+    queue->partial = -1;
+    queue->stats = stats;
+}
+
+static inline void sendQueueFree(SendQueue *queue) {
+    for (int priority = 0; priority < SEND_PRIORITIES; priority++) {
+        free(queue->lanes[priority].bytes);
+        free(queue->lanes[priority].marks);
+    }
+    sendQueueInit(queue, queue->stats);
+}
+
+static inline int sendQueuePending(const SendQueue *queue, SendPriority priority) {
+    return queue->lanes[priority].length > 0;
+}
+
+// Queue a message, stamped with queuedNs (monotonicNs(); one reading can
+// serve a message queued to many connections). Returns -1 when it would take
+// the connection past SEND_QUEUE_LIMIT or out of memory; the peer is then
+// too far behind.
+static inline int sendQueuePush(SendQueue *queue, SendPriority priority, const char *message, size_t length,
+                                unsigned long long queuedNs) {
+    SendLane *lane = &queue->lanes[priority];
+    if (queue->queuedBytes + length > SEND_QUEUE_LIMIT) return -1;
+
+    if (lane->start + lane->length + length > lane->capacity) {
+        if (lane->start > 0) {
+            memmove(lane->bytes, lane->bytes + lane->start, lane->length);
+            lane->start = 0;
+        }
+        if (lane->length + length > lane->capacity) {
+            size_t capacity = lane->capacity ? lane->capacity : 1024;
+            while (capacity < lane->length + length) capacity *= 2;
+            char *grown = realloc(lane->bytes, capacity);
+            if (!grown) return -1;
+            lane->bytes = grown;
+            lane->capacity = capacity;
+        }
+    }
+    if (lane->markCount == lane->markCapacity) {
+        int capacity = lane->markCapacity ? lane->markCapacity * 2 : 16;
+        SendMark *grown = malloc(capacity * sizeof(SendMark));
+        if (!grown) return -1;
+        for (int i = 0; i < lane->markCount; i++) {
+            grown[i] = lane->marks[(lane->markHead + i) % lane->markCapacity];
+        }
+        free(lane->marks);
+        lane->marks = grown;
+        lane->markHead = 0;
+        lane->markCapacity = capacity;
+    }
+
+    memcpy(lane->bytes + lane->start + lane->length, message, length);
+    lane->length += length;
+    queue->queuedBytes += length;
+    SendMark *mark = &lane->marks[(lane->markHead + lane->markCount++) % lane->markCapacity];
+    mark->end = lane->sent + lane->length;
+    mark->queuedNs = queuedNs;
+    return 0;
+}
+
+// Write up to `limit` bytes of a lane. Returns 1 once they are written, 0
+// if the socket is full, -1 if the connection has failed.
+static inline int sendLaneWrite(SendQueue *queue, SendPriority priority, int fd, size_t limit) {
+    SendLane *lane = &queue->lanes[priority];
+    if (limit > lane->length) limit = lane->length;
+    while (limit > 0) {
+        ssize_t written = send(fd, lane->bytes + lane->start, limit, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        lane->start += written;
+        lane->length -= written;
+        lane->sent += written;
+        queue->queuedBytes -= written;
+        limit -= written;
+
+        unsigned long long now = 0;
+        while (lane->markCount > 0 && lane->marks[lane->markHead].end <= lane->sent) {
+            SendMark *mark = &lane->marks[lane->markHead];
+            if (!now) now = monotonicNs();
+            if (queue->stats) latencyRecord(&queue->stats[priority], now - mark->queuedNs);
+            lane->retired = mark->end;
+            lane->markHead = (lane->markHead + 1) % lane->markCapacity;
+            lane->markCount--;
+        }
+    }
+    if (lane->length == 0) lane->start = 0;
+    return 1;
+}
+
+// Write queued messages, highest priority first, down to and including
+// `lowest`, until the socket is full. Returns -1 if the connection has
+// failed, otherwise 0; check sendQueuePending for what is left.
+static inline int sendQueueFlush(SendQueue *queue, int fd, SendPriority lowest) {
+    if (queue->partial >= 0) {
+        SendLane *lane = &queue->lanes[queue->partial];
+        int result = sendLaneWrite(queue, queue->partial, fd, lane->marks[lane->markHead].end - lane->sent);
+        if (result <= 0) return result;
+        queue->partial = -1;
+    }
+    for (int priority = 0; priority <= (int)lowest; priority++) {
+        SendLane *lane = &queue->lanes[priority];
+        int result = sendLaneWrite(queue, priority, fd, lane->length);
+        if (result < 0) return -1;
+        if (result == 0) {
+            if (lane->sent > lane->retired) queue->partial = priority;
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Small commands go out at once, and the kernel holds little unsent data
+static inline void sendQueueConfigureSocket(int fd) {
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+#ifdef TCP_NOTSENT_LOWAT
+    int lowWater = SEND_NOTSENT_LOWAT;
+    setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowWater, sizeof(lowWater));
+#endif
+}
+
+#endif // CBTC_SEND_QUEUE_H
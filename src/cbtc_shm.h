@@ -0,0 +1,587 @@
+#ifndef CBTC_SHM_H
+#define CBTC_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Layout of the /cbtc_state and /cbtc_trains segments shared between the
+// orchestrator and the component processes. Keep this the single definition
+// of both structures.
+
+#define MAX_LOG_LENGTH 100
+#define LOG_RING_SIZE 1024 // Power of two
+#define MAX_SIGNALS 10
+#define MAX_SWITCHES 5
+#define CBTC_CACHE_LINE 64
+#define CBTC_CACHE_ALIGNED __attribute__((aligned(CBTC_CACHE_LINE)))
+
+typedef struct {
+    int id;
+    int zoneId;
+    int section;
+    float x;
+    float y;
+    int state; // 0=RED, 1=YELLOW, 2=GREEN
+} SignalState;
+
+typedef struct {
+    int id;
+    int zoneId;
+    int section;
+    float x;
+    float y;
+    int state; // 0=NORMAL, 1=REVERSE
+} SwitchState;
+
+// System state as seen by the renderer
+typedef struct {
+    SignalState signals[MAX_SIGNALS];
+    int signalCount;
+    SwitchState switches[MAX_SWITCHES];
+    int switchCount;
+} SystemState;
+
+// Sequence counter protocol used by every slot in both segments. A slot has
+// one writer at a time, which makes the counter odd, writes, and makes it
+// even again; readers copy the slot and retry if the counter moved.
+static inline void seqWriteBegin(unsigned int *sequence) {
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqWriteEnd(unsigned int *sequence) {
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE);
+}
+
+static inline void seqRead(unsigned int *sequence, void *out, const void *data, size_t size) {
+    unsigned int start;
+    do {
+        while ((start = __atomic_load_n(sequence, __ATOMIC_ACQUIRE)) & 1) {
+            sched_yield();
+        }
+        memcpy(out, data, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(sequence, __ATOMIC_RELAXED) != start);
+}
+
+// One signal or switch per cache line. Each device is written only by its
+// own wayside process (or by the orchestrator before the components start),
+// so device writers never share a line or a lock.
+typedef struct {
+    unsigned int sequence;
+    SignalState device;
+} CBTC_CACHE_ALIGNED SignalSlot;
+
+typedef struct {
+    unsigned int sequence;
+    SwitchState device;
+} CBTC_CACHE_ALIGNED SwitchSlot;
+
+// Position ingest counters, maintained by the orchestrator's ingest thread.
+// Updated with atomics outside the seqlock so monitors can poll them freely.
+typedef struct {
+    unsigned long long packets;     // Datagrams received
+    unsigned long long updates;     // Position updates applied to the train table
+    unsigned long long registered;  // Trains registered on first sight
+    unsigned long long rejected;    // Updates dropped because the train table is full
+    unsigned long long malformed;   // Datagrams that failed to parse
+    unsigned int kernelDrops;       // Datagrams dropped by the socket (SO_RXQ_OVFL)
+    unsigned int packetsPerSecond;
+    unsigned int queueDepth;        // Datagrams drained by the last recvmmsg batch
+    unsigned int maxQueueDepth;
+} IngestStats;
+
+// Which process logged an event
+typedef enum {
+    LOG_COMPONENT_ORCHESTRATOR,
+    LOG_COMPONENT_CCS,
+    LOG_COMPONENT_ZONE_CONTROLLER,
+    LOG_COMPONENT_WAYSIDE,
+    LOG_COMPONENT_TRAIN,
+    LOG_COMPONENT_COUNT
+} LogComponent;
+
+typedef enum {
+    LOG_SEVERITY_INFO,
+    LOG_SEVERITY_WARNING,
+    LOG_SEVERITY_ERROR
+} LogSeverity;
+
+// Log ring entry. The sequence is 2 * ticket + 1 while the entry is being
+// written and 2 * ticket + 2 once the ticket's message is complete. Entries
+// are cache-line aligned so writers holding consecutive tickets do not share
+// a line.
+typedef struct {
+    unsigned long long sequence;
+    unsigned long long monotonicNs; // CLOCK_MONOTONIC, for ordering and intervals
+    unsigned int timestamp;         // Coarse wall clock seconds
+    unsigned char component;        // LogComponent
+    unsigned char severity;         // LogSeverity
+    int trainId;                    // 0 if the event is not about a train
+    int zoneId;                     // 0 if the event is not about a zone
+    char text[MAX_LOG_LENGTH];
+} CBTC_CACHE_ALIGNED LogEntry;
+
+// Multi-producer log ring. Any process mapping the segment can append without
+// taking a lock; the newest LOG_RING_SIZE messages are kept.
+typedef struct {
+    unsigned long long head CBTC_CACHE_ALIGNED; // Next ticket to hand out
+    unsigned long long overwritten; // Messages lost to a faster writer lapping them
+    LogEntry entries[LOG_RING_SIZE];
+} LogRing;
+
+// Shared memory structure for system state. It is split into cache-line
+// aligned regions by writer: the device counts (fixed by the orchestrator
+// before any component starts), one slot per signal and switch (its wayside
+// process), the ingest counters (the orchestrator's ingest thread) and the
+// log ring (everyone, lock-free). Nothing in the segment takes a lock.
+typedef struct {
+    int signalCount;
+    int switchCount;
+    SignalSlot signals[MAX_SIGNALS];
+    SwitchSlot switches[MAX_SWITCHES];
+    IngestStats ingest CBTC_CACHE_ALIGNED;
+    LogRing log;
+} SharedState;
+
+// Index of the signal or switch with the given id, -1 if there is none
+static inline int sharedStateFindSignal(SharedState *shared, int id) {
+    int count = __atomic_load_n(&shared->signalCount, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count && i < MAX_SIGNALS; i++) {
+        if (shared->signals[i].device.id == id) return i;
+    }
+    return -1;
+}
+
+static inline int sharedStateFindSwitch(SharedState *shared, int id) {
+    int count = __atomic_load_n(&shared->switchCount, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count && i < MAX_SWITCHES; i++) {
+        if (shared->switches[i].device.id == id) return i;
+    }
+    return -1;
+}
+
+// Set the state of one device. Only that device's writer may call these.
+static inline void sharedStateSetSignal(SharedState *shared, int index, int state) {
+    SignalSlot *slot = &shared->signals[index];
+    seqWriteBegin(&slot->sequence);
+    slot->device.state = state;
+    seqWriteEnd(&slot->sequence);
+}
+
+static inline void sharedStateSetSwitch(SharedState *shared, int index, int state) {
+    SwitchSlot *slot = &shared->switches[index];
+    seqWriteBegin(&slot->sequence);
+    slot->device.state = state;
+    seqWriteEnd(&slot->sequence);
+}
+
+// Copy every device without blocking writers. Each device is read
+// consistently on its own; devices change independently, so there is no
+// cross-device state to keep consistent.
+static inline void sharedStateSnapshot(SharedState *shared, SystemState *out) {
+    out->signalCount = __atomic_load_n(&shared->signalCount, __ATOMIC_ACQUIRE);
+    out->switchCount = __atomic_load_n(&shared->switchCount, __ATOMIC_ACQUIRE);
+    if (out->signalCount > MAX_SIGNALS) out->signalCount = MAX_SIGNALS;
+    if (out->switchCount > MAX_SWITCHES) out->switchCount = MAX_SWITCHES;
+    for (int i = 0; i < out->signalCount; i++) {
+        seqRead(&shared->signals[i].sequence, &out->signals[i],
+                &shared->signals[i].device, sizeof(SignalState));
+    }
+    for (int i = 0; i < out->switchCount; i++) {
+        seqRead(&shared->switches[i].sequence, &out->switches[i],
+                &shared->switches[i].device, sizeof(SwitchState));
+    }
+}
+
+// Append a structured event to the log ring
+static inline void logRingAppendEvent(LogRing *ring, LogComponent component, LogSeverity severity,
+                                      int trainId, int zoneId, const char *message) {
+    unsigned long long ticket = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    LogEntry *entry = &ring->entries[ticket & (LOG_RING_SIZE - 1)];
+    unsigned long long writing = 2 * ticket + 1;
+    unsigned long long current = __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED);
+
+    // Claim the entry. It only collides with another writer once the ring has
+    // wrapped; the newer ticket wins and an older one simply drops its message.
+    for (;;) {
+        if (current >= writing) {
+            __atomic_add_fetch(&ring->overwritten, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (current & 1) {
+            sched_yield();
+            current = __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&entry->sequence, &current, writing, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    entry->timestamp = (unsigned int)now.tv_sec;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    entry->monotonicNs = (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+    entry->component = (unsigned char)component;
+    entry->severity = (unsigned char)severity;
+    entry->trainId = trainId;
+    entry->zoneId = zoneId;
+    snprintf(entry->text, MAX_LOG_LENGTH, "%s", message);
+
+    __atomic_store_n(&entry->sequence, writing + 1, __ATOMIC_RELEASE);
+}
+
+// Append a plain orchestrator message
+static inline void logRingAppend(LogRing *ring, const char *message) {
+    logRingAppendEvent(ring, LOG_COMPONENT_ORCHESTRATOR, LOG_SEVERITY_INFO, 0, 0, message);
+}
+
+// printf-style event logging for component processes. shared may be
+// MAP_FAILED (no orchestrator), in which case the event is dropped.
+__attribute__((format(printf, 6, 7)))
+static inline void eventLogf(SharedState *shared, LogComponent component, LogSeverity severity,
+                             int trainId, int zoneId, const char *format, ...) {
+    if (shared == MAP_FAILED || shared == NULL) return;
+
+    char message[MAX_LOG_LENGTH];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    logRingAppendEvent(&shared->log, component, severity, trainId, zoneId, message);
+}
+
+// Map the orchestrator's state segment named by CBTC_SHM_NAME, for components
+// that only log through it. Returns MAP_FAILED if it is not available.
+static inline SharedState *sharedStateAttach(void) {
+    const char *name = getenv("CBTC_SHM_NAME");
+    if (!name) return MAP_FAILED;
+
+    int fd = shm_open(name, O_RDWR, 0666);
+    if (fd == -1) return MAP_FAILED;
+
+    SharedState *shared = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return shared;
+}
+
+// Copy the message for a ticket. Returns 0 if the ticket is still being
+// written or has already been overwritten.
+static inline int logRingRead(LogRing *ring, unsigned long long ticket, LogEntry *out) {
+    LogEntry *entry = &ring->entries[ticket & (LOG_RING_SIZE - 1)];
+    unsigned long long expected = 2 * ticket + 2;
+
+    if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != expected) return 0;
+    memcpy(out, entry, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&entry->sequence, __ATOMIC_RELAXED) == expected;
+}
+
+// Copy up to maxCount of the newest messages, oldest first. Returns the
+// number copied.
+static inline int logRingTail(LogRing *ring, LogEntry *out, int maxCount) {
+    unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long long first = head > (unsigned long long)maxCount ? head - maxCount : 0;
+    int count = 0;
+
+    for (unsigned long long ticket = first; ticket < head; ticket++) {
+        if (logRingRead(ring, ticket, &out[count])) count++;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Train table
+//
+// Trains live in their own segment so the fleet size is not baked into the
+// binaries. The segment starts with a header carrying the layout version and
+// capacity, followed by an open-addressed id -> slot index and the slots.
+// Every process maps enough address space for maxCapacity slots up front, so
+// the table grows with ftruncate() and never has to be remapped.
+//
+// Slots are appended and never removed. Each slot has its own sequence
+// counter: a slot has a single writer at a time, and readers copy it with the
+// same retry protocol as SharedState.
+// ---------------------------------------------------------------------------
+
+#define TRAIN_TABLE_MAGIC 0x43425454u // "CBTT"
+#define TRAIN_TABLE_LAYOUT_VERSION 3
+#define TRAIN_TABLE_INITIAL_CAPACITY 64
+#define TRAIN_TABLE_DEFAULT_MAX_CAPACITY 65536
+#define TRAIN_INDEX_EMPTY 0 // Train id 0 is reserved to mark free index entries
+
+typedef struct {
+    unsigned int sequence;
+    int id;
+    int zoneId;
+    int section;
+    float x;
+    float y;
+    int speed;
+    int targetSpeed;
+    int stationStopTime;
+    int stationTimer;
+    int atStation;
+    int direction;  // 1 for forward, -1 for backward
+    char color[20]; // Color name as string
+    unsigned long long lastUpdateNs; // CLOCK_MONOTONIC time of the last position update
+    char padding[48];                // Keeps each slot on lines of its own
+} TrainSlot;
+
+// Padded rather than aligned because slots are also copied into plain heap
+// buffers; the segment layout puts the first slot on a line boundary
+_Static_assert(sizeof(TrainSlot) % CBTC_CACHE_LINE == 0, "TrainSlot must fill whole cache lines");
+
+typedef struct {
+    int id;
+    int slot;
+} TrainIndexEntry;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int layoutVersion;
+    unsigned int capacity;    // Slots backed by the segment
+    unsigned int maxCapacity; // Slots covered by every mapping
+    unsigned int count;       // Slots in use
+    unsigned int indexSize;   // Power of two, at least twice maxCapacity
+    pthread_mutex_t mutex;    // Serialises registration and growth; robust
+} CBTC_CACHE_ALIGNED TrainTableHeader;
+
+// Per-process handle on the train table segment
+typedef struct {
+    int fd;
+    TrainTableHeader *header;
+    size_t mappedBytes;
+} TrainTable;
+
+static inline TrainIndexEntry *trainTableIndex(TrainTableHeader *header) {
+    return (TrainIndexEntry *)(header + 1);
+}
+
+static inline TrainSlot *trainTableSlots(TrainTableHeader *header) {
+    return (TrainSlot *)(trainTableIndex(header) + header->indexSize);
+}
+
+static inline size_t trainTableBytes(unsigned int indexSize, unsigned int capacity) {
+    return sizeof(TrainTableHeader) + indexSize * sizeof(TrainIndexEntry) +
+           capacity * sizeof(TrainSlot);
+}
+
+static inline unsigned int trainTableHash(int id, unsigned int indexSize) {
+    return ((unsigned int)id * 2654435761u) & (indexSize - 1);
+}
+
+// Create the train table segment (orchestrator only). Returns 0 on success.
+static inline int trainTableCreate(TrainTable *table, const char *name, unsigned int maxCapacity) {
+    unsigned int capacity = TRAIN_TABLE_INITIAL_CAPACITY;
+    unsigned int indexSize = 1;
+
+    if (maxCapacity < capacity) maxCapacity = capacity;
+    while (indexSize < 2 * maxCapacity) indexSize <<= 1;
+
+    shm_unlink(name);
+    table->fd = shm_open(name, O_CREAT | O_RDWR, 0666);
+    if (table->fd == -1) {
+        perror("Train table shm_open failed");
+        return -1;
+    }
+    if (ftruncate(table->fd, trainTableBytes(indexSize, capacity)) == -1) {
+        perror("Train table ftruncate failed");
+        close(table->fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    table->mappedBytes = trainTableBytes(indexSize, maxCapacity);
+    table->header = mmap(NULL, table->mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0);
+    if (table->header == MAP_FAILED) {
+        perror("Train table mmap failed");
+        close(table->fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    TrainTableHeader *header = table->header;
+    header->layoutVersion = TRAIN_TABLE_LAYOUT_VERSION;
+    header->capacity = capacity;
+    header->maxCapacity = maxCapacity;
+    header->count = 0;
+    header->indexSize = indexSize;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST); // Trains holding it can be killed
+    pthread_mutex_init(&header->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    __atomic_store_n(&header->magic, TRAIN_TABLE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Map an existing train table segment. Returns 0 on success.
+static inline int trainTableOpen(TrainTable *table, const char *name) {
+    table->fd = shm_open(name, O_RDWR, 0666);
+    if (table->fd == -1) {
+        return -1;
+    }
+
+    TrainTableHeader *probe = mmap(NULL, sizeof(TrainTableHeader), PROT_READ, MAP_SHARED, table->fd, 0);
+    if (probe == MAP_FAILED) {
+        close(table->fd);
+        return -1;
+    }
+    if (__atomic_load_n(&probe->magic, __ATOMIC_ACQUIRE) != TRAIN_TABLE_MAGIC ||
+        probe->layoutVersion != TRAIN_TABLE_LAYOUT_VERSION) {
+        fprintf(stderr, "Train table layout mismatch (version %u, expected %u)\n",
+                probe->layoutVersion, TRAIN_TABLE_LAYOUT_VERSION);
+        munmap(probe, sizeof(TrainTableHeader));
+        close(table->fd);
+        return -1;
+    }
+    table->mappedBytes = trainTableBytes(probe->indexSize, probe->maxCapacity);
+    munmap(probe, sizeof(TrainTableHeader));
+
+    table->header = mmap(NULL, table->mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0);
+    if (table->header == MAP_FAILED) {
+        close(table->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static inline void trainTableClose(TrainTable *table) {
+    if (table->header != MAP_FAILED && table->header != NULL) {
+        munmap(table->header, table->mappedBytes);
+    }
+    if (table->fd >= 0) {
+        close(table->fd);
+    }
+    table->header = MAP_FAILED;
+    table->fd = -1;
+}
+
+// Look up the slot of a train. Lock-free; returns -1 if the id is unknown.
+static inline int trainTableFind(TrainTable *table, int id) {
+    TrainTableHeader *header = table->header;
+    TrainIndexEntry *index = trainTableIndex(header);
+    unsigned int mask = header->indexSize - 1;
+
+    for (unsigned int i = trainTableHash(id, header->indexSize);; i = (i + 1) & mask) {
+        int entryId = __atomic_load_n(&index[i].id, __ATOMIC_ACQUIRE);
+        if (entryId == id) return index[i].slot;
+        if (entryId == TRAIN_INDEX_EMPTY) return -1;
+    }
+}
+
+// Take the registration lock. If its holder died mid-registration, a slot
+// whose index entry was published before the count was raised is counted
+// (it was fully built first); anything less was never visible and is
+// simply overwritten by the next registration.
+static inline void trainTableLock(TrainTableHeader *header) {
+    if (pthread_mutex_lock(&header->mutex) != EOWNERDEAD) return;
+    TrainIndexEntry *index = trainTableIndex(header);
+    unsigned int count = header->count;
+    for (unsigned int i = 0; i < header->indexSize; i++) {
+        if (__atomic_load_n(&index[i].id, __ATOMIC_ACQUIRE) != TRAIN_INDEX_EMPTY &&
+            index[i].slot >= (int)count) {
+            count = index[i].slot + 1;
+        }
+    }
+    __atomic_store_n(&header->count, count, __ATOMIC_RELEASE);
+    pthread_mutex_consistent(&header->mutex);
+}
+
+// Find or add the slot for a train. A new slot is fully initialised before
+// its index entry is published, so lock-free readers never see it half-built.
+// Returns -1 if the table is at maxCapacity or cannot grow.
+static inline int trainTableRegister(TrainTable *table, int id, const char *color) {
+    TrainTableHeader *header = table->header;
+    int slot;
+
+    if (id == TRAIN_INDEX_EMPTY) return -1;
+
+    trainTableLock(header);
+    slot = trainTableFind(table, id);
+    if (slot >= 0) {
+        pthread_mutex_unlock(&header->mutex);
+        return slot;
+    }
+
+    if (header->count == header->capacity) {
+        unsigned int newCapacity = header->capacity * 2;
+        if (newCapacity > header->maxCapacity) newCapacity = header->maxCapacity;
+        if (newCapacity == header->capacity ||
+            ftruncate(table->fd, trainTableBytes(header->indexSize, newCapacity)) == -1) {
+            pthread_mutex_unlock(&header->mutex);
+            return -1;
+        }
+        __atomic_store_n(&header->capacity, newCapacity, __ATOMIC_RELEASE);
+    }
+
+    slot = header->count;
+    TrainSlot *train = &trainTableSlots(header)[slot];
+    memset(train, 0, sizeof(*train));
+    train->id = id;
+    train->direction = 1;
+    strncpy(train->color, color, sizeof(train->color) - 1);
+
+    TrainIndexEntry *index = trainTableIndex(header);
+    unsigned int mask = header->indexSize - 1;
+    unsigned int i = trainTableHash(id, header->indexSize);
+    while (index[i].id != TRAIN_INDEX_EMPTY) i = (i + 1) & mask;
+    index[i].slot = slot;
+    __atomic_store_n(&index[i].id, id, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->count, slot + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&header->mutex);
+    return slot;
+}
+
+// Colour for a train registering on first sight, cycling through a palette
+// in registration order
+static inline const char *trainTableNextColor(TrainTable *table) {
+    static const char *const palette[] = {"RED", "BLUE", "GREEN", "ORANGE", "PURPLE", "YELLOW"};
+    unsigned int count = __atomic_load_n(&table->header->count, __ATOMIC_RELAXED);
+    return palette[count % (sizeof(palette) / sizeof(palette[0]))];
+}
+
+static inline void trainSlotWriteBegin(TrainSlot *train) {
+    seqWriteBegin(&train->sequence);
+}
+
+static inline void trainSlotWriteEnd(TrainSlot *train) {
+    seqWriteEnd(&train->sequence);
+}
+
+// Copy a consistent view of one train slot without blocking its writer
+static inline void trainSlotRead(TrainSlot *train, TrainSlot *out) {
+    seqRead(&train->sequence, out, train, sizeof(*out));
+}
+
+// Copy up to maxCount trains into out. Returns the number copied.
+static inline int trainTableSnapshot(TrainTable *table, TrainSlot *out, int maxCount) {
+    int count = (int)__atomic_load_n(&table->header->count, __ATOMIC_ACQUIRE);
+    TrainSlot *slots = trainTableSlots(table->header);
+
+    if (count > maxCount) count = maxCount;
+    for (int i = 0; i < count; i++) {
+        trainSlotRead(&slots[i], &out[i]);
+    }
+    return count;
+}
+
+#endif
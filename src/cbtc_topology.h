@@ -0,0 +1,331 @@
+#ifndef CBTC_TOPOLOGY_H
+#define CBTC_TOPOLOGY_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Compiled track topology. topology_compiler turns track_config.json into
+// this image once, and every component maps it read-only instead of parsing
+// JSON, so all processes share one page-cache copy of the network.
+//
+// The image holds no pointers: each table sits at an offset from the start
+// of the file, aligned to TOPOLOGY_ALIGNMENT, so it maps at any address.
+// Bump TOPOLOGY_VERSION whenever a structure below changes.
+//
+// topology_compiler replaces the image by renaming a new file over it, so a
+// mapping never changes underneath its reader. Running components watch for
+// the rename (topologyWatchOpen) and map the new image beside the old one.
+#define TOPOLOGY_MAGIC 0x4F504F54u // "TOPO"
+#define TOPOLOGY_VERSION 3
+#define TOPOLOGY_IMAGE_ENV "CBTC_TOPOLOGY"
+#define TOPOLOGY_DEFAULT_IMAGE "track_config.topo"
+#define TOPOLOGY_ALIGNMENT 64
+#define TOPOLOGY_NAME_LENGTH 32
+#define TOPOLOGY_NONE -1
+
+typedef struct {
+    int id;
+    int zone;
+    float x0, y0, x1, y1;
+    int nextStart; // Successors are adjacency[nextStart] .. adjacency[nextStart + nextCount - 1]
+    int nextCount;
+    int station;   // Index into the station table, TOPOLOGY_NONE if none
+    int switchId;  // 0 if none
+    int reverse;   // Trains turn back at the end of this section
+    int speedLimit; // km/h, 0 for the zone controller's default
+} TopologySection;
+
+typedef struct {
+    int id;        // 1-based, in config order
+    int section;
+    int stopTime;  // Seconds
+    int isTerminus;
+    char name[TOPOLOGY_NAME_LENGTH];
+} TopologyStation;
+
+typedef struct {
+    int id;
+    int section;
+    int normalNext;
+    int reverseNext;
+} TopologySwitch;
+
+typedef struct {
+    int id;
+    int section;
+    int zone;      // The section's zone
+    float x, y;    // Where the window draws it
+} TopologySignal;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long size; // Bytes in the whole image
+    int sectionCount;
+    int adjacencyCount;
+    int stationCount;
+    int switchCount;
+    int signalCount;
+    int maxSectionId;
+    unsigned long long sectionOffset;
+    unsigned long long adjacencyOffset;    // int section indices, in section order
+    unsigned long long sectionIndexOffset; // int[maxSectionId + 1]: id -> index, TOPOLOGY_NONE if unused
+    unsigned long long stationOffset;
+    unsigned long long switchOffset;
+    unsigned long long signalOffset;
+} TopologyHeader;
+
+// A mapped image. The table pointers point into the mapping.
+typedef struct {
+    const TopologyHeader *header; // NULL when nothing is mapped
+    size_t size;
+    const TopologySection *sections;
+    const int *adjacency;
+    const int *sectionIndex;
+    const TopologyStation *stations;
+    const TopologySwitch *switches;
+    const TopologySignal *signals;
+} Topology;
+
+static inline const char *topologyImagePath(void) {
+    const char *path = getenv(TOPOLOGY_IMAGE_ENV);
+    return path ? path : TOPOLOGY_DEFAULT_IMAGE;
+}
+
+static inline unsigned long long topologyAlign(unsigned long long offset) {
+    return (offset + TOPOLOGY_ALIGNMENT - 1) & ~(unsigned long long)(TOPOLOGY_ALIGNMENT - 1);
+}
+
+static inline int topologyTableFits(size_t size, unsigned long long offset, int count, size_t entrySize) {
+    return count >= 0 && offset % TOPOLOGY_ALIGNMENT == 0 && offset <= size &&
+           (size - offset) / entrySize >= (unsigned long long)count;
+}
+
+// Map an image read-only and check that every table lies inside it
+static inline int topologyOpen(Topology *topology, const char *path) {
+    memset(topology, 0, sizeof(*topology));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(TopologyHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)info.st_size;
+    const TopologyHeader *header = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        return -1;
+    }
+
+    if (header->magic != TOPOLOGY_MAGIC || header->version != TOPOLOGY_VERSION ||
+        header->size != size || header->maxSectionId < 0 ||
+        !topologyTableFits(size, header->sectionOffset, header->sectionCount, sizeof(TopologySection)) ||
+        !topologyTableFits(size, header->adjacencyOffset, header->adjacencyCount, sizeof(int)) ||
+        !topologyTableFits(size, header->sectionIndexOffset, header->maxSectionId + 1, sizeof(int)) ||
+        !topologyTableFits(size, header->stationOffset, header->stationCount, sizeof(TopologyStation)) ||
+        !topologyTableFits(size, header->switchOffset, header->switchCount, sizeof(TopologySwitch)) ||
+        !topologyTableFits(size, header->signalOffset, header->signalCount, sizeof(TopologySignal))) {
+        fprintf(stderr, "%s is not a topology image of version %u, recompile it with topology_compiler\n",
+                path, TOPOLOGY_VERSION);
+        munmap((void *)header, size);
+        return -1;
+    }
+
+    const char *base = (const char *)header;
+    topology->header = header;
+    topology->size = size;
+    topology->sections = (const TopologySection *)(base + header->sectionOffset);
+    topology->adjacency = (const int *)(base + header->adjacencyOffset);
+    topology->sectionIndex = (const int *)(base + header->sectionIndexOffset);
+    topology->stations = (const TopologyStation *)(base + header->stationOffset);
+    topology->switches = (const TopologySwitch *)(base + header->switchOffset);
+    topology->signals = (const TopologySignal *)(base + header->signalOffset);
+    return 0;
+}
+
+static inline void topologyClose(Topology *topology) {
+    if (topology->header) {
+        munmap((void *)topology->header, topology->size);
+    }
+    memset(topology, 0, sizeof(*topology));
+}
+
+// Index of a section in the section table, or TOPOLOGY_NONE
+static inline int topologySectionIndex(const Topology *topology, int sectionId) {
+    if (!topology->header || sectionId < 0 || sectionId > topology->header->maxSectionId) {
+        return TOPOLOGY_NONE;
+    }
+    return topology->sectionIndex[sectionId];
+}
+
+// What changed between two images, matched by id
+typedef struct {
+    int sectionsAdded;
+    int sectionsRemoved;
+    int sectionsChanged;
+    int linksChanged;      // Sections whose successors differ
+    int stationsAdded;
+    int stationsRemoved;
+    int stationsChanged;
+    int switchesChanged;   // Added, removed or rewired
+} TopologyDiff;
+
+static inline const TopologySection *topologySection(const Topology *topology, int sectionId) {
+    int index = topologySectionIndex(topology, sectionId);
+    return index == TOPOLOGY_NONE ? NULL : &topology->sections[index];
+}
+
+static inline const TopologyStation *topologyStation(const Topology *topology, int stationId) {
+    // Station ids are 1-based config positions, so the table is nearly an identity map
+    int count = topology->header ? topology->header->stationCount : 0;
+    int guess = stationId - 1 < count ? stationId - 1 : count - 1;
+    for (int i = guess; i >= 0; i--) {
+        if (topology->stations[i].id == stationId) return &topology->stations[i];
+    }
+    return NULL;
+}
+
+static inline const TopologySwitch *topologySwitch(const Topology *topology, int switchId) {
+    int count = topology->header ? topology->header->switchCount : 0;
+    for (int i = 0; i < count; i++) {
+        if (topology->switches[i].id == switchId) return &topology->switches[i];
+    }
+    return NULL;
+}
+
+static inline int topologyStationsEqual(const TopologyStation *a, const TopologyStation *b) {
+    return a->section == b->section && a->stopTime == b->stopTime && a->isTerminus == b->isTerminus &&
+           strncmp(a->name, b->name, TOPOLOGY_NAME_LENGTH) == 0;
+}
+
+// Successors compared by section id, since indices shift when sections are added
+static inline int topologyLinksEqual(const Topology *a, const TopologySection *sa,
+                                     const Topology *b, const TopologySection *sb) {
+    if (sa->nextCount != sb->nextCount) return 0;
+    for (int i = 0; i < sa->nextCount; i++) {
+        if (a->sections[a->adjacency[sa->nextStart + i]].id != b->sections[b->adjacency[sb->nextStart + i]].id) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline int topologySectionsEqual(const TopologySection *a, const TopologySection *b) {
+    return a->zone == b->zone && a->x0 == b->x0 && a->y0 == b->y0 && a->x1 == b->x1 && a->y1 == b->y1 &&
+           a->switchId == b->switchId && a->reverse == b->reverse && a->speedLimit == b->speedLimit;
+}
+
+static inline void topologyDiff(const Topology *old, const Topology *next, TopologyDiff *diff) {
+    memset(diff, 0, sizeof(*diff));
+    int oldSections = old->header ? old->header->sectionCount : 0;
+    int oldStations = old->header ? old->header->stationCount : 0;
+    int oldSwitches = old->header ? old->header->switchCount : 0;
+
+    for (int i = 0; i < next->header->sectionCount; i++) {
+        const TopologySection *section = &next->sections[i];
+        const TopologySection *before = topologySection(old, section->id);
+        if (!before) {
+            diff->sectionsAdded++;
+            diff->linksChanged++;
+            continue;
+        }
+        if (!topologySectionsEqual(before, section)) diff->sectionsChanged++;
+        if (!topologyLinksEqual(old, before, next, section)) diff->linksChanged++;
+    }
+    for (int i = 0; i < oldSections; i++) {
+        if (!topologySection(next, old->sections[i].id)) {
+            diff->sectionsRemoved++;
+            diff->linksChanged++;
+        }
+    }
+
+    for (int i = 0; i < next->header->stationCount; i++) {
+        const TopologyStation *before = topologyStation(old, next->stations[i].id);
+        if (!before) diff->stationsAdded++;
+        else if (!topologyStationsEqual(before, &next->stations[i])) diff->stationsChanged++;
+    }
+    for (int i = 0; i < oldStations; i++) {
+        if (!topologyStation(next, old->stations[i].id)) diff->stationsRemoved++;
+    }
+
+    for (int i = 0; i < next->header->switchCount; i++) {
+        const TopologySwitch *before = topologySwitch(old, next->switches[i].id);
+        const TopologySwitch *now = &next->switches[i];
+        if (!before || before->section != now->section || before->normalNext != now->normalNext ||
+            before->reverseNext != now->reverseNext) {
+            diff->switchesChanged++;
+        }
+    }
+    for (int i = 0; i < oldSwitches; i++) {
+        if (!topologySwitch(next, old->switches[i].id)) diff->switchesChanged++;
+    }
+}
+
+static inline int topologyDiffEmpty(const TopologyDiff *diff) {
+    return diff->sectionsAdded + diff->sectionsRemoved + diff->sectionsChanged + diff->linksChanged +
+           diff->stationsAdded + diff->stationsRemoved + diff->stationsChanged + diff->switchesChanged == 0;
+}
+
+static inline int topologyDiffFormat(const TopologyDiff *diff, char *buffer, size_t size) {
+    return snprintf(buffer, size, "sections +%d -%d ~%d (%d relinked), stations +%d -%d ~%d, switches ~%d",
+                    diff->sectionsAdded, diff->sectionsRemoved, diff->sectionsChanged, diff->linksChanged,
+                    diff->stationsAdded, diff->stationsRemoved, diff->stationsChanged, diff->switchesChanged);
+}
+
+static inline const char *topologyBaseName(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+// Watch a file for being rewritten or renamed into place. The directory is
+// watched, since a rename replaces the file's inode. Returns a non-blocking
+// inotify fd, or -1.
+static inline int topologyWatchOpen(const char *path) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+
+    char directory[4096];
+    const char *name = topologyBaseName(path);
+    if (name == path) {
+        strcpy(directory, ".");
+    } else if ((size_t)(name - path) < sizeof(directory)) {
+        memcpy(directory, path, name - path);
+        directory[name - path] = '\0';
+    } else {
+        close(fd);
+        return -1;
+    }
+    if (inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Drain a watch. Returns 1 if the watched file was replaced.
+static inline int topologyWatchChanged(int fd, const char *path) {
+    const char *name = topologyBaseName(path);
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length;
+    while ((length = read(fd, events, sizeof(events))) > 0) {
+        for (char *cursor = events; cursor < events + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)cursor;
+            if (event->len > 0 && strcmp(event->name, name) == 0) changed = 1;
+            cursor += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+#endif // CBTC_TOPOLOGY_H
@@ -0,0 +1,24 @@
+#ifndef CBTC_ZYGOTE_H
+#define CBTC_ZYGOTE_H
+
+#include <sys/types.h>
+
+// Train zygote protocol. The orchestrator starts `train --zygote <fd>` once;
+// the zygote loads everything trains share and then forks a train for each
+// request on the SOCK_SEQPACKET socket <fd>, so mass launches skip exec,
+// dynamic linking and environment setup per train.
+//
+// The zygote first sends its own pid to say it is ready. After that each
+// ZygoteRequest is answered with a pid_t: the new train's pid, or -errno.
+// Trains are created with CLONE_PARENT, so they are the orchestrator's
+// children and are reaped and restarted like any other component.
+#define ZYGOTE_FLAG "--zygote"
+#define ZYGOTE_MAX_ARGS 8
+#define ZYGOTE_MAX_ARG_LENGTH 32
+
+typedef struct {
+    int argc;
+    char argv[ZYGOTE_MAX_ARGS][ZYGOTE_MAX_ARG_LENGTH]; // Same command line as an exec'd train
+} ZygoteRequest;
+
+#endif // CBTC_ZYGOTE_H
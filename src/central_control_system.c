@@ -1,207 +1,1149 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
-#include <json-c/json.h>
+
+#include "cbtc_event_loop.h"
+#include "cbtc_latency.h"
+#include "cbtc_ready.h"
+#include "cbtc_send_queue.h"
+#include "cbtc_shm.h"
+#include "cbtc_topology.h"
 
 #define MAX_ZONES 10
 #define BUFFER_SIZE 1024
 #define CCS_PORT 8000
-#define CONFIG_FILE "track_config.json"
+#define ROUTE_TABLE_MAX_NODES 4096 // Above this, routes are searched per query
+#define NO_ROUTE 0xFFFF
+#define INITIAL_TRAIN_LOCATIONS 256 // Power of two
+#define JOURNAL_MAGIC 0x4C4A4343u // "CCJL"
+#define JOURNAL_VERSION 1
+#define JOURNAL_DEFAULT_PATH "ccs_journal.bin"
+#define JOURNAL_RING_SIZE 65536 // Records buffered ahead of the disk; power of two
+#define JOURNAL_REPLAY_BATCH 4096
+#define JOURNAL_COMMIT_INTERVAL_US 1000 // Writer poll while records are flowing
+#define JOURNAL_IDLE_POLLS 200          // Empty polls before the writer sleeps until woken
+#define JOURNAL_WRITE_ATTEMPTS 3        // Tries per group before journaling is turned off
+#define JOURNAL_RETRY_US 10000
+#define TIMETABLE_DEFAULT_PATH "timetable.txt"
+#define TIMER_TICK_MS 10
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // 64^4 ticks, about 46 hours; later timers are cascaded again
 
 typedef struct {
   int id;
   int connected;
   struct sockaddr_in address;
   int socket;
+  char pending[BUFFER_SIZE]; // Partial line from the last read
+  int pendingLength;
+  SendQueue queue;           // Commands not yet written, by priority
 } ZoneController;
 
-// Track configuration
+// Route tables over the topology image's section graph. Node i is
+// trackSections[i]; its successors are the image's compressed sparse rows,
+// adjacency[nextStart] .. adjacency[nextStart + nextCount - 1]. For networks
+// up to ROUTE_TABLE_MAX_NODES, nextHop and distance hold every route:
+// nextHop[from * nodeCount + to] is the node after `from` on a shortest path
+// to `to`, so a route is read off without searching.
 typedef struct {
-  int id;
-  int zone;
-  int nextSections[5];
-  int nextCount;
-  int hasStation;
-  char stationName[32];
-  int hasSwitch;
-  int switchId;
-} TrackSection;
+  int nodeCount;
+  unsigned short *nextHop;  // NO_ROUTE when unreachable
+  unsigned short *distance; // In sections
+  int *queue;               // BFS scratch for the per-query fallback
+  int *parent;
+  int *path;                // nodeCount entries, room for any shortest route
+} TrackGraph;
 
+// What the CCS knows about each train, keyed by train id (0 = empty slot)
 typedef struct {
-  int id;
+  int trainId;
+  int section;     // Last section reported by a zone, -1 if none
+  int destination; // Last route sent for it, -1 if none
+} TrainLocation;
+
+// Journal records. Every command the CCS issues and every zone event it
+// acts on is journaled, and the CCS state they change (train positions,
+// routes, movement authorities) is only ever updated by applying a record,
+// so replaying the journal rebuilds that state exactly.
+typedef enum {
+  JOURNAL_ZONE_REGISTERED = 1, // zoneId
+  JOURNAL_ZONE_DISCONNECTED,   // zoneId
+  JOURNAL_TRAIN_SECTION,       // zoneId reported trainId in section
+  JOURNAL_MOVEMENT_AUTHORITY,  // zoneId, section, value = speed
+  JOURNAL_ROUTE_TRAIN,         // zoneId, trainId, section = destination
+  JOURNAL_EMERGENCY_STOP,      // zoneId; authority on its sections drops to 0
+  JOURNAL_RECORD_TYPES
+} JournalRecordType;
+
+// Journal file layout: a header followed by fixed-size records in append
+// order. A crash can leave a torn last record; its checksum or sequence
+// gives it away and it is cut off when the journal is next opened.
+typedef struct {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int recordSize;
+  unsigned int reserved;
+} JournalHeader;
+
+typedef struct {
+  unsigned long long sequence;   // Record number, from 0
+  unsigned long long realtimeNs; // Wall clock, for audit; replay ignores it
+  unsigned short type;
+  unsigned short delivered;      // Commands: a connected zone controller was sent it
+  int zoneId;
+  int trainId;
   int section;
-  int stopTime;
-  int isTerminus;
-  char name[32];
-} Station;
+  int value;
+  unsigned int checksum;         // FNV-1a over everything above
+} JournalRecord;
 
+// Group commit: the event loop appends records to a ring and returns; the
+// writer thread writes everything appended since its last pass in one go
+// and fdatasyncs once per group, so records that arrive during a sync share
+// the next one. While records are flowing the writer polls every commit
+// interval, so appending costs no system call; only a writer that has gone
+// idle sleeps on wakeFd and has to be woken.
 typedef struct {
-  int id;
+  int fd;                       // -1 when not journaling
+  JournalRecord *ring;
+  unsigned long long head;      // Records appended (event loop thread)
+  unsigned long long tail;      // Records written and synced (writer thread)
+  off_t committed;              // File size up to the last synced record
+  unsigned long long nextSequence;
+  int wakeFd;                   // eventfd the idle writer sleeps on
+  int writerIdle;               // Sleeping on wakeFd
+  int running;
+  int disabled;                 // A group could not be stored; nothing more is queued
+  pthread_t writer;
+  unsigned long long groups;    // fdatasync calls
+  unsigned long long stalls;    // Appends that waited for ring space
+  unsigned long long failed;    // Records the writer could not store
+} Journal;
+
+// A pending timer, linked into one slot of the timer wheel. Timetable
+// stops embed theirs, so scheduling allocates nothing.
+typedef struct TimerEntry {
+  struct TimerEntry *next;
+  struct TimerEntry *prev;    // NULL when not pending
+  unsigned long long expires; // Tick
+  unsigned long long dueNs;   // CLOCK_MONOTONIC
+  int kind;                   // TIMER_*
+  int stop;
+} TimerEntry;
+
+// Hierarchical timing wheel. Level L has 64 slots of 64^L ticks each; a
+// timer goes into the lowest level whose span covers its delay, so adding
+// and cancelling are O(1). When the ticks reach a higher-level slot its
+// timers are cascaded into the levels below, at most WHEEL_LEVELS - 1
+// times per timer, and level 0 slots fire whole.
+typedef struct {
+  TimerEntry slots[WHEEL_LEVELS][WHEEL_SLOTS]; // Circular list heads
+  unsigned long long now;                      // Next tick to run
+  unsigned long long startNs;                  // Time of tick 0
+  int pending;
+  int timerFd;                                 // One shot, armed for armedTick
+  unsigned long long armedTick;                // ~0 when disarmed
+} TimerWheel;
+
+typedef enum {
+  TIMER_ROUTE = 1, // Route a train to its first stop and hold it there
+  TIMER_DEPART     // Release a train from its stop and route it to the next
+} TimerKind;
+
+typedef enum {
+  STOP_SCHEDULED,
+  STOP_ROUTED,   // Routed and held; waiting for the train
+  STOP_ARRIVED,
+  STOP_DEPARTED
+} StopState;
+
+// One line of the timetable. The dwell target is depart - arrive: a train
+// that arrives late is held for the full dwell, past its departure time.
+typedef struct {
+  int trainId;
   int section;
-  int normalNext;
-  int reverseNext;
-} Switch;
+  int zone;
+  double arrive; // Seconds after the timetable starts
+  double depart;
+  int speed;     // Movement authority the train leaves with
+  StopState state;
+  TimerEntry routeTimer;  // Used by each train's first stop
+  TimerEntry departTimer;
+} TimetableStop;
+
+// A train's stops are consecutive in the stop table, in arrival order
+typedef struct {
+  int trainId;
+  int firstStop;
+  int stopCount;
+  int current; // Stop the train is routed to, -1 before its first
+} TimetableTrain;
 
 // Global variables
 ZoneController zoneControllers[MAX_ZONES];
 int zoneCount = 0;
-TrackSection trackSections[100];
+Topology topology;                          // Mapped read-only, shared with the other components
+const TopologySection *trackSections = NULL;
 int sectionCount = 0;
-Station stations[20];
+const TopologyStation *stations = NULL;
 int stationCount = 0;
-Switch switches[10];
 int switchCount = 0;
+SharedState *sharedState = MAP_FAILED; // Orchestrator event log, if running under one
+EventLoop eventLoop;
+TrackGraph trackGraph;
+TrainLocation *trainLocations = NULL;
+int trainLocationCapacity = 0;
+int trainLocationCount = 0;
+int *sectionAuthority = NULL;               // Speed of the last movement authority per section node, -1 if none
+Journal journal = {.fd = -1, .wakeFd = -1};
+unsigned long long journalTypeCounts[JOURNAL_RECORD_TYPES];
+TimerWheel timerWheel = {.timerFd = -1};
+TimetableStop *timetableStops = NULL;
+int timetableStopCount = 0;
+TimetableTrain *timetableTrains = NULL;          // Sorted by train id
+int timetableTrainCount = 0;
+int timetableStarted = 0;
+unsigned long long timersFired = 0;
+LatencyStats timerLateness;                      // Fire time against due time
+LatencyStats arrivalDelay;                       // Train arrivals against the timetable
+LatencyStats sendLatency[SEND_PRIORITIES];       // Command queueing to written, all zone links
 
-// Function to load track configuration
+// Map the compiled track topology
 void loadTrackConfig() {
-  struct json_object *parsed_json;
-  struct json_object *sections;
-  struct json_object *section;
-  struct json_object *stations_arr;
-  struct json_object *station;
-  struct json_object *switches_arr;
-  struct json_object *switch_obj;
-  
-  parsed_json = json_object_from_file(CONFIG_FILE);
-  if (!parsed_json) {
-    printf("Error loading config file: %s\n", CONFIG_FILE);
+  const char *path = topologyImagePath();
+  if (topologyOpen(&topology, path) < 0) {
+    printf("Error loading topology image: %s\n", path);
     printf("Using default configuration\n");
     return;
   }
   
-  // Parse track sections
-  json_object_object_get_ex(parsed_json, "track_sections", &sections);
-  sectionCount = json_object_array_length(sections);
+  trackSections = topology.sections;
+  sectionCount = topology.header->sectionCount;
+  stations = topology.stations;
+  stationCount = topology.header->stationCount;
+  switchCount = topology.header->switchCount;
   
-  for (int i = 0; i < sectionCount; i++) {
-    section = json_object_array_get_idx(sections, i);
-    
-    struct json_object *id, *zone, *next_sections, *station, *switch_id;
-    
-    json_object_object_get_ex(section, "id", &id);
-    json_object_object_get_ex(section, "zone", &zone);
-    json_object_object_get_ex(section, "next_sections", &next_sections);
-    
-    trackSections[i].id = json_object_get_int(id);
-    trackSections[i].zone = json_object_get_int(zone);
-    
-    // Get next sections
-    int nextCount = json_object_array_length(next_sections);
-    trackSections[i].nextCount = nextCount;
-    for (int j = 0; j < nextCount; j++) {
-      struct json_object *next = json_object_array_get_idx(next_sections, j);
-      trackSections[i].nextSections[j] = json_object_get_int(next);
-    }
-    
-    // Check if section has a station
-    if (json_object_object_get_ex(section, "station", &station)) {
-      trackSections[i].hasStation = 1;
-      strncpy(trackSections[i].stationName, 
-              json_object_get_string(station), 
-              sizeof(trackSections[i].stationName) - 1);
-    } else {
-      trackSections[i].hasStation = 0;
-    }
-    
-    // Check if section has a switch
-    if (json_object_object_get_ex(section, "switch", &switch_id)) {
-      trackSections[i].hasSwitch = 1;
-      trackSections[i].switchId = json_object_get_int(switch_id);
-    } else {
-      trackSections[i].hasSwitch = 0;
+  printf("Loaded track configuration: %d sections, %d stations, %d switches\n",
+         sectionCount, stationCount, switchCount);
+}
+
+int graphNode(int section) {
+  return topologySectionIndex(&topology, section);
+}
+
+// Breadth-first search from one node. Fills parent[] for every reached node
+// and returns the number of nodes reached (in visiting order in queue[]).
+int searchFrom(int source) {
+  TrackGraph *graph = &trackGraph;
+  for (int i = 0; i < graph->nodeCount; i++) graph->parent[i] = -1;
+  graph->parent[source] = source;
+  graph->queue[0] = source;
+  int head = 0, tail = 1;
+  while (head < tail) {
+    int node = graph->queue[head++];
+    const int *successors = &topology.adjacency[trackSections[node].nextStart];
+    for (int e = 0; e < trackSections[node].nextCount; e++) {
+      int next = successors[e];
+      if (graph->parent[next] < 0) {
+        graph->parent[next] = node;
+        graph->queue[tail++] = next;
+      }
     }
   }
-  
-  // Parse stations
-  json_object_object_get_ex(parsed_json, "stations", &stations_arr);
-  stationCount = json_object_array_length(stations_arr);
-  
-  for (int i = 0; i < stationCount; i++) {
-    station = json_object_array_get_idx(stations_arr, i);
-    
-    struct json_object *name, *section, *stop_time, *terminus;
-    
-    json_object_object_get_ex(station, "name", &name);
-    json_object_object_get_ex(station, "section", &section);
-    json_object_object_get_ex(station, "stop_time", &stop_time);
-    json_object_object_get_ex(station, "terminus", &terminus);
-    
-    stations[i].id = i + 1;
-    stations[i].section = json_object_get_int(section);
-    stations[i].stopTime = json_object_get_int(stop_time);
-    stations[i].isTerminus = json_object_get_boolean(terminus);
-    strncpy(stations[i].name, json_object_get_string(name), sizeof(stations[i].name) - 1);
+  return tail;
+}
+
+// Precompute the route tables over the topology's section graph
+void buildTrackGraph() {
+  TrackGraph *graph = &trackGraph;
+  memset(graph, 0, sizeof(*graph));
+  graph->nodeCount = sectionCount;
+  if (sectionCount == 0) return;
+
+  graph->queue = malloc(sectionCount * sizeof(int));
+  graph->parent = malloc(sectionCount * sizeof(int));
+  graph->path = malloc(sectionCount * sizeof(int));
+  if (!graph->queue || !graph->parent || !graph->path) {
+    perror("Track graph allocation failed");
+    exit(EXIT_FAILURE);
   }
-  
-  // Parse switches
-  json_object_object_get_ex(parsed_json, "switches", &switches_arr);
-  switchCount = json_object_array_length(switches_arr);
-  
-  for (int i = 0; i < switchCount; i++) {
-    switch_obj = json_object_array_get_idx(switches_arr, i);
-    
-    struct json_object *id, *section, *normal_next, *reverse_next;
-    
-    json_object_object_get_ex(switch_obj, "id", &id);
-    json_object_object_get_ex(switch_obj, "section", &section);
-    json_object_object_get_ex(switch_obj, "normal_next", &normal_next);
-    json_object_object_get_ex(switch_obj, "reverse_next", &reverse_next);
-    
-    switches[i].id = json_object_get_int(id);
-    switches[i].section = json_object_get_int(section);
-    switches[i].normalNext = json_object_get_int(normal_next);
-    switches[i].reverseNext = json_object_get_int(reverse_next);
+  int edgeCount = topology.header->adjacencyCount;
+
+  if (sectionCount > ROUTE_TABLE_MAX_NODES) {
+    printf("Track graph: %d sections, %d links (routes searched per query)\n", sectionCount, edgeCount);
+    return;
+  }
+
+  // All-pairs next hop: one search per source; every node reached through
+  // the same first step inherits it from its parent.
+  size_t cells = (size_t)sectionCount * sectionCount;
+  graph->nextHop = malloc(cells * sizeof(unsigned short));
+  graph->distance = malloc(cells * sizeof(unsigned short));
+  if (!graph->nextHop || !graph->distance) {
+    perror("Route table allocation failed");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < cells; i++) {
+    graph->nextHop[i] = NO_ROUTE;
+    graph->distance[i] = NO_ROUTE;
+  }
+  for (int source = 0; source < sectionCount; source++) {
+    unsigned short *hops = &graph->nextHop[(size_t)source * sectionCount];
+    unsigned short *distances = &graph->distance[(size_t)source * sectionCount];
+    int reached = searchFrom(source);
+    hops[source] = source;
+    distances[source] = 0;
+    for (int i = 1; i < reached; i++) {
+      int node = graph->queue[i];
+      int parent = graph->parent[node];
+      hops[node] = parent == source ? node : hops[parent];
+      distances[node] = distances[parent] + 1;
+    }
+  }
+  printf("Track graph: %d sections, %d links, route tables %zu KB\n", sectionCount, edgeCount,
+         cells * 2 * sizeof(unsigned short) / 1024);
+}
+
+void freeTrackGraph() {
+  free(trackGraph.nextHop);
+  free(trackGraph.distance);
+  free(trackGraph.queue);
+  free(trackGraph.parent);
+  free(trackGraph.path);
+  memset(&trackGraph, 0, sizeof(trackGraph));
+}
+
+// Shortest route between two nodes, both ends included. Returns the number
+// of nodes written to path, or 0 if `to` cannot be reached or the route
+// does not fit in maxLength nodes.
+int findRoute(int from, int to, int *path, int maxLength) {
+  TrackGraph *graph = &trackGraph;
+  int length = 0;
+  if (graph->nextHop) {
+    size_t row = (size_t)graph->nodeCount;
+    if (graph->nextHop[from * row + to] == NO_ROUTE) return 0;
+    int node = from;
+    path[length++] = node;
+    while (node != to && length < maxLength) {
+      node = graph->nextHop[node * row + to];
+      path[length++] = node;
+    }
+    return node == to ? length : 0;
+  }
+
+  // Large network: search, then walk the parents back from the destination
+  searchFrom(from);
+  if (graph->parent[to] < 0) return 0;
+  for (int node = to; length < maxLength; node = graph->parent[node]) {
+    path[length++] = node;
+    if (node == from) break;
+  }
+  if (path[length - 1] != from) return 0;
+  for (int i = 0; i < length / 2; i++) {
+    int swap = path[i];
+    path[i] = path[length - 1 - i];
+    path[length - 1 - i] = swap;
+  }
+  return length;
+}
+
+unsigned int trainLocationHash(int trainId) {
+  return ((unsigned int)trainId * 2654435761u) & (trainLocationCapacity - 1);
+}
+
+TrainLocation *findTrainLocation(int trainId) {
+  if (trainLocationCapacity == 0) return NULL;
+  for (unsigned int i = trainLocationHash(trainId);; i = (i + 1) & (trainLocationCapacity - 1)) {
+    if (trainLocations[i].trainId == trainId) return &trainLocations[i];
+    if (trainLocations[i].trainId == 0) return NULL;
+  }
+}
+
+// Find a train, adding it if it is new. Returns NULL for train 0 or when
+// the table cannot grow.
+TrainLocation *trainEntry(int trainId) {
+  if (trainId == 0) return NULL;
+  TrainLocation *location = findTrainLocation(trainId);
+  if (location) return location;
+
+  // Keep the table at most half full
+  if ((trainLocationCount + 1) * 2 > trainLocationCapacity) {
+    TrainLocation *old = trainLocations;
+    int oldCapacity = trainLocationCapacity;
+    int capacity = oldCapacity ? oldCapacity * 2 : INITIAL_TRAIN_LOCATIONS;
+    TrainLocation *grown = calloc(capacity, sizeof(TrainLocation));
+    if (!grown) return NULL;
+    trainLocations = grown;
+    trainLocationCapacity = capacity;
+    for (int i = 0; i < oldCapacity; i++) {
+      if (old[i].trainId == 0) continue;
+      unsigned int slot = trainLocationHash(old[i].trainId);
+      while (trainLocations[slot].trainId != 0) slot = (slot + 1) & (capacity - 1);
+      trainLocations[slot] = old[i];
+    }
+    free(old);
+  }
+
+  unsigned int slot = trainLocationHash(trainId);
+  while (trainLocations[slot].trainId != 0) slot = (slot + 1) & (trainLocationCapacity - 1);
+  trainLocations[slot].trainId = trainId;
+  trainLocations[slot].section = -1;
+  trainLocations[slot].destination = -1;
+  trainLocationCount++;
+  return &trainLocations[slot];
+}
+
+unsigned int journalChecksum(const JournalRecord *record) {
+  const unsigned char *bytes = (const unsigned char *)record;
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(JournalRecord, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// The only place journaled state changes, live or on replay
+void applyJournalRecord(const JournalRecord *record) {
+  journalTypeCounts[record->type]++;
+  switch (record->type) {
+    case JOURNAL_TRAIN_SECTION: {
+      TrainLocation *train = trainEntry(record->trainId);
+      if (train) train->section = record->section;
+      break;
+    }
+    case JOURNAL_MOVEMENT_AUTHORITY: {
+      int node = graphNode(record->section);
+      if (record->delivered && node >= 0 && sectionAuthority) sectionAuthority[node] = record->value;
+      break;
+    }
+    case JOURNAL_ROUTE_TRAIN: {
+      TrainLocation *train = record->delivered ? trainEntry(record->trainId) : NULL;
+      if (train) train->destination = record->section;
+      break;
+    }
+    case JOURNAL_EMERGENCY_STOP:
+      for (int i = 0; i < sectionCount && record->delivered && sectionAuthority; i++) {
+        if (trackSections[i].zone == record->zoneId) sectionAuthority[i] = 0;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void journalWake() {
+  uint64_t one = 1;
+  if (write(journal.wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    perror("Waking journal writer failed");
+  }
+}
+
+void journalMakeRecord(JournalRecord *record, int type, int zoneId, int trainId, int section, int value,
+                       int delivered) {
+  memset(record, 0, sizeof(*record));
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  record->sequence = journal.nextSequence++;
+  record->realtimeNs = (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+  record->type = type;
+  record->delivered = delivered;
+  record->zoneId = zoneId;
+  record->trainId = trainId;
+  record->section = section;
+  record->value = value;
+  record->checksum = journalChecksum(record);
+}
+
+// Apply a record and queue it for the disk. Runs on the event loop thread
+// and only waits if the writer has fallen a whole ring behind.
+void journalRecord(int type, int zoneId, int trainId, int section, int value, int delivered) {
+  JournalRecord record;
+  journalMakeRecord(&record, type, zoneId, trainId, section, value, delivered);
+  applyJournalRecord(&record);
+  if (!journal.ring || __atomic_load_n(&journal.disabled, __ATOMIC_ACQUIRE)) return;
+
+  unsigned long long head = journal.head;
+  while (head - __atomic_load_n(&journal.tail, __ATOMIC_ACQUIRE) >= JOURNAL_RING_SIZE) {
+    if (__atomic_load_n(&journal.disabled, __ATOMIC_ACQUIRE)) return;
+    journal.stalls++;
+    journalWake();
+    usleep(100);
+  }
+  journal.ring[head & (JOURNAL_RING_SIZE - 1)] = record;
+  // Publish, then check whether the writer went to sleep before seeing it
+  __atomic_store_n(&journal.head, head + 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&journal.writerIdle, __ATOMIC_SEQ_CST)) journalWake();
+}
+
+int journalWrite(int fd, const JournalRecord *records, unsigned long long count) {
+  const char *data = (const char *)records;
+  size_t remaining = count * sizeof(JournalRecord);
+  while (remaining > 0) {
+    ssize_t written = write(fd, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    data += written;
+    remaining -= written;
+  }
+  return 0;
+}
+
+void *journalWriterThread(void *arg) {
+  (void)arg;
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+  int emptyPolls = 0;
+  for (;;) {
+    unsigned long long tail = journal.tail;
+    unsigned long long head = __atomic_load_n(&journal.head, __ATOMIC_SEQ_CST);
+    if (head == tail) {
+      if (!__atomic_load_n(&journal.running, __ATOMIC_ACQUIRE)) break;
+      if (++emptyPolls < JOURNAL_IDLE_POLLS) {
+        usleep(JOURNAL_COMMIT_INTERVAL_US);
+        continue;
+      }
+      __atomic_store_n(&journal.writerIdle, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&journal.head, __ATOMIC_SEQ_CST) == tail) {
+        uint64_t wakeups;
+        if (read(journal.wakeFd, &wakeups, sizeof(wakeups)) < 0 && errno != EINTR) {
+          perror("Journal writer wait failed");
+          usleep(1000);
+        }
+      }
+      __atomic_store_n(&journal.writerIdle, 0, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    emptyPolls = 0;
+
+    // One group: everything appended so far, in at most two pieces around the ring's end.
+    // A failed attempt is cut back to the last synced record and tried again,
+    // so a partial write never leaves later groups behind a damaged record.
+    unsigned long long start = tail & (JOURNAL_RING_SIZE - 1);
+    unsigned long long count = head - tail;
+    unsigned long long first = count < JOURNAL_RING_SIZE - start ? count : JOURNAL_RING_SIZE - start;
+    int stored = 0;
+    for (int attempt = 1; attempt <= JOURNAL_WRITE_ATTEMPTS; attempt++) {
+      if (journalWrite(journal.fd, &journal.ring[start], first) == 0 &&
+          (count == first || journalWrite(journal.fd, journal.ring, count - first) == 0) &&
+          fdatasync(journal.fd) == 0) {
+        stored = 1;
+        break;
+      }
+      perror("Journal write failed");
+      if (ftruncate(journal.fd, journal.committed) < 0 || lseek(journal.fd, journal.committed, SEEK_SET) < 0) {
+        perror("Rolling back journal failed");
+        break;
+      }
+      usleep(JOURNAL_RETRY_US * attempt);
+    }
+    __atomic_add_fetch(&journal.groups, 1, __ATOMIC_RELAXED);
+    if (!stored) {
+      // The file ends at the last record that made it to disk. Stop here
+      // rather than append after a gap the next replay would cut off.
+      __atomic_add_fetch(&journal.failed, count, __ATOMIC_RELAXED);
+      __atomic_store_n(&journal.disabled, 1, __ATOMIC_RELEASE);
+      fprintf(stderr, "JOURNAL DISABLED: records from %llu on could not be stored; the journal ends at record %llu\n",
+              tail, tail);
+      eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_ERROR, 0, 0,
+                "Journal disabled after a failed write at record %llu", tail);
+      break;
+    }
+    journal.committed += count * sizeof(JournalRecord);
+    __atomic_store_n(&journal.tail, head, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+// Replay a journal into the CCS state. When writable, a missing journal is
+// created, a torn tail is cut off and the file is left positioned for
+// appending. Returns the number of records replayed, or -1.
+long long journalReplay(const char *path, int writable) {
+  int fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror("Opening journal failed");
+    return -1;
+  }
+
+  JournalHeader header;
+  ssize_t bytesRead = read(fd, &header, sizeof(header));
+  if (bytesRead == 0 && writable) {
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.version = JOURNAL_VERSION;
+    header.recordSize = sizeof(JournalRecord);
+    if (write(fd, &header, sizeof(header)) != sizeof(header) || fdatasync(fd) < 0) {
+      perror("Writing journal header failed");
+      close(fd);
+      return -1;
+    }
+    journal.fd = fd;
+    journal.committed = sizeof(header);
+    return 0;
+  }
+  if (bytesRead != sizeof(header) || header.magic != JOURNAL_MAGIC ||
+      header.version != JOURNAL_VERSION || header.recordSize != sizeof(JournalRecord)) {
+    fprintf(stderr, "%s is not a version %d CCS journal\n", path, JOURNAL_VERSION);
+    close(fd);
+    return -1;
+  }
+
+  JournalRecord *batch = malloc(JOURNAL_REPLAY_BATCH * sizeof(JournalRecord));
+  if (!batch) {
+    perror("Journal replay allocation failed");
+    close(fd);
+    return -1;
+  }
+  unsigned long long replayed = 0;
+  int torn = 0;
+  while (!torn && (bytesRead = read(fd, batch, JOURNAL_REPLAY_BATCH * sizeof(JournalRecord))) > 0) {
+    int count = bytesRead / sizeof(JournalRecord);
+    if (bytesRead % sizeof(JournalRecord) != 0) torn = 1;
+    for (int i = 0; i < count; i++) {
+      if (batch[i].sequence != replayed || batch[i].type == 0 || batch[i].type >= JOURNAL_RECORD_TYPES ||
+          batch[i].checksum != journalChecksum(&batch[i])) {
+        torn = 1;
+        break;
+      }
+      applyJournalRecord(&batch[i]);
+      replayed++;
+    }
+  }
+  free(batch);
+  journal.nextSequence = replayed;
+
+  if (torn) {
+    printf("Journal %s: dropping damaged records after record %llu\n", path, replayed);
+  }
+  if (!writable) {
+    close(fd);
+    return replayed;
+  }
+  off_t end = sizeof(JournalHeader) + replayed * sizeof(JournalRecord);
+  if ((torn && ftruncate(fd, end) < 0) || lseek(fd, end, SEEK_SET) < 0) {
+    perror("Truncating journal failed");
+    close(fd);
+    return -1;
+  }
+  journal.fd = fd;
+  journal.committed = end;
+  return replayed;
+}
+
+// Rewrite the journal as the state it rebuilds: one record per known train
+// position and route and per section under authority. Without this the
+// file would grow by every command ever issued and be replayed in full on
+// each start. The snapshot is synced beside the journal and renamed over
+// it; on failure the journal is left as it was.
+void journalCompact(const char *path) {
+  char tempPath[4096];
+  if (journal.nextSequence == 0 ||
+      snprintf(tempPath, sizeof(tempPath), "%s.tmp", path) >= (int)sizeof(tempPath)) {
+    return;
+  }
+  int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    perror("Opening journal snapshot failed");
+    return;
+  }
+  unsigned long long replayed = journal.nextSequence;
+  JournalHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = JOURNAL_MAGIC;
+  header.version = JOURNAL_VERSION;
+  header.recordSize = sizeof(JournalRecord);
+  int failed = write(fd, &header, sizeof(header)) != sizeof(header);
+
+  journal.nextSequence = 0;
+  JournalRecord record;
+  for (int i = 0; i < trainLocationCapacity && !failed; i++) {
+    const TrainLocation *train = &trainLocations[i];
+    if (train->trainId == 0) continue;
+    if (train->section >= 0) {
+      journalMakeRecord(&record, JOURNAL_TRAIN_SECTION, 0, train->trainId, train->section, 0, 1);
+      failed = journalWrite(fd, &record, 1) < 0;
+    }
+    if (!failed && train->destination >= 0) {
+      journalMakeRecord(&record, JOURNAL_ROUTE_TRAIN, 0, train->trainId, train->destination, 0, 1);
+      failed = journalWrite(fd, &record, 1) < 0;
+    }
+  }
+  for (int i = 0; i < sectionCount && sectionAuthority && !failed; i++) {
+    if (sectionAuthority[i] < 0) continue;
+    journalMakeRecord(&record, JOURNAL_MOVEMENT_AUTHORITY, trackSections[i].zone, 0, trackSections[i].id,
+                      sectionAuthority[i], 1);
+    failed = journalWrite(fd, &record, 1) < 0;
+  }
+
+  if (failed || fdatasync(fd) < 0 || rename(tempPath, path) < 0) {
+    perror("Compacting journal failed");
+    close(fd);
+    unlink(tempPath);
+    journal.nextSequence = replayed;
+    return;
+  }
+  close(journal.fd);
+  journal.fd = fd;
+  journal.committed = sizeof(header) + journal.nextSequence * sizeof(JournalRecord);
+  printf("Journal %s: compacted %llu records to %llu\n", path, replayed, journal.nextSequence);
+}
+
+// Open the journal (CCS_JOURNAL, default ccs_journal.bin; empty turns it
+// off), rebuild state from it and start the writer
+void startJournal() {
+  const char *path = getenv("CCS_JOURNAL");
+  if (!path) path = JOURNAL_DEFAULT_PATH;
+  if (!*path) return;
+
+  long long replayed = journalReplay(path, 1);
+  if (replayed < 0) {
+    printf("Journaling disabled\n");
+    return;
+  }
+  printf("Journal %s: replayed %lld records, %d trains known\n", path, replayed, trainLocationCount);
+  journalCompact(path);
+
+  journal.ring = malloc(JOURNAL_RING_SIZE * sizeof(JournalRecord));
+  journal.wakeFd = eventfd(0, EFD_CLOEXEC);
+  if (!journal.ring || journal.wakeFd < 0) {
+    perror("Journal setup failed");
+    exit(EXIT_FAILURE);
+  }
+  memset(journal.ring, 0, JOURNAL_RING_SIZE * sizeof(JournalRecord)); // Fault it in now, not on the command path
+  __atomic_store_n(&journal.running, 1, __ATOMIC_RELEASE);
+  if (pthread_create(&journal.writer, NULL, journalWriterThread, NULL) != 0) {
+    perror("Failed to start journal writer");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Stop the writer once everything journaled so far is on disk
+void stopJournal() {
+  if (__atomic_load_n(&journal.running, __ATOMIC_ACQUIRE)) {
+    __atomic_store_n(&journal.running, 0, __ATOMIC_RELEASE);
+    journalWake();
+    pthread_join(journal.writer, NULL);
+  }
+  if (journal.fd >= 0) close(journal.fd);
+  if (journal.wakeFd >= 0) close(journal.wakeFd);
+  free(journal.ring);
+  journal.ring = NULL;
+  journal.fd = -1;
+  journal.wakeFd = -1;
+}
+
+void printJournalState() {
+  static const char *typeNames[JOURNAL_RECORD_TYPES] = {
+    "", "zone registrations", "zone disconnects", "train section reports", "movement authorities", "route commands",
+    "emergency stops"
+  };
+  for (int type = 1; type < JOURNAL_RECORD_TYPES; type++) {
+    printf("  %llu %s\n", journalTypeCounts[type], typeNames[type]);
+  }
+  int routed = 0, located = 0, authorized = 0;
+  for (int i = 0; i < trainLocationCapacity; i++) {
+    if (trainLocations[i].trainId == 0) continue;
+    if (trainLocations[i].section >= 0) located++;
+    if (trainLocations[i].destination >= 0) routed++;
+  }
+  for (int i = 0; i < sectionCount && sectionAuthority; i++) {
+    if (sectionAuthority[i] >= 0) authorized++;
+  }
+  printf("  %d trains located, %d routed, %d sections under movement authority\n", located, routed, authorized);
+}
+
+void wheelInit(TimerWheel *wheel, unsigned long long startNs) {
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+      wheel->slots[level][slot].next = wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+    }
+  }
+  wheel->now = 0;
+  wheel->startNs = startNs;
+  wheel->pending = 0;
+  wheel->armedTick = ~0ull;
+}
+
+// Set the timer fd to go off once, at the start of the given tick
+void wheelArmAt(TimerWheel *wheel, unsigned long long tick) {
+  if (wheel->timerFd < 0) return;
+  unsigned long long wakeNs = wheel->startNs + tick * TIMER_TICK_MS * 1000000ull;
+  unsigned long long nowNs = monotonicNs();
+  long delayMs = wakeNs > nowNs ? (long)((wakeNs - nowNs + 999999) / 1000000) : 1;
+  wheel->armedTick = tick;
+  eventLoopArmTimer(wheel->timerFd, delayMs, 0);
+}
+
+// Link a timer into the slot for its expiry tick
+void wheelLink(TimerWheel *wheel, TimerEntry *timer) {
+  unsigned long long expires = timer->expires < wheel->now ? wheel->now : timer->expires;
+  unsigned long long delay = expires - wheel->now;
+  if (delay >= 1ull << (WHEEL_BITS * WHEEL_LEVELS)) {
+    expires = wheel->now + (1ull << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    delay = expires - wheel->now;
+  }
+  int level = 0;
+  while (level < WHEEL_LEVELS - 1 && delay >= 1ull << (WHEEL_BITS * (level + 1))) level++;
+  TimerEntry *head = &wheel->slots[level][(expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)];
+  timer->next = head;
+  timer->prev = head->prev;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+void wheelAdd(TimerWheel *wheel, TimerEntry *timer, unsigned long long dueNs) {
+  unsigned long long tickNs = TIMER_TICK_MS * 1000000ull;
+  timer->dueNs = dueNs;
+  timer->expires = dueNs > wheel->startNs ? (dueNs - wheel->startNs + tickNs - 1) / tickNs : 0;
+  wheelLink(wheel, timer);
+  wheel->pending++;
+  unsigned long long tick = timer->expires < wheel->now ? wheel->now : timer->expires;
+  if (tick < wheel->armedTick) wheelArmAt(wheel, tick);
+}
+
+void wheelCancel(TimerWheel *wheel, TimerEntry *timer) {
+  if (!timer->prev) return;
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->next = timer->prev = NULL;
+  wheel->pending--;
+}
+
+// Move a higher-level slot's timers down to the levels that now cover them
+int wheelCascade(TimerWheel *wheel, int level) {
+  int index = (wheel->now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+  TimerEntry *head = &wheel->slots[level][index];
+  TimerEntry *timer = head->next;
+  head->next = head->prev = head;
+  while (timer != head) {
+    TimerEntry *next = timer->next;
+    wheelLink(wheel, timer);
+    timer = next;
+  }
+  return index;
+}
+
+// Run every tick up to nowNs, calling fire for each expired timer. Timers
+// added by fire that are already due run on the next tick.
+void wheelAdvance(TimerWheel *wheel, unsigned long long nowNs, void (*fire)(TimerEntry *timer, unsigned long long nowNs)) {
+  unsigned long long target = nowNs > wheel->startNs ? (nowNs - wheel->startNs) / (TIMER_TICK_MS * 1000000ull) : 0;
+  if (wheel->pending == 0) {
+    if (wheel->now <= target) wheel->now = target + 1;
+    return;
+  }
+  while (wheel->now <= target) {
+    int index = wheel->now & (WHEEL_SLOTS - 1);
+    for (int level = 1; index == 0 && level < WHEEL_LEVELS; level++) {
+      index = wheelCascade(wheel, level);
+    }
+
+    // Detach the slot first, so fire can add timers freely
+    TimerEntry *head = &wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)];
+    TimerEntry *timer = head->next;
+    head->prev->next = NULL;
+    head->next = head->prev = head;
+    wheel->now++;
+    while (timer && timer != head) {
+      TimerEntry *next = timer->next;
+      timer->next = timer->prev = NULL;
+      wheel->pending--;
+      fire(timer, nowNs);
+      timer = next;
+    }
+  }
+}
+
+// Earliest tick with work to do: a level 0 slot to fire or a higher slot to
+// cascade. A level L slot cascades on the next tick that is a multiple of
+// 64^L and has the slot's index at level L.
+unsigned long long wheelNextTick(const TimerWheel *wheel) {
+  unsigned long long next = ~0ull;
+  for (int offset = 0; offset < WHEEL_SLOTS; offset++) {
+    const TimerEntry *head = &wheel->slots[0][(wheel->now + offset) & (WHEEL_SLOTS - 1)];
+    if (head->next != head) {
+      next = wheel->now + offset;
+      break;
+    }
+  }
+  for (int level = 1; level < WHEEL_LEVELS; level++) {
+    unsigned long long span = 1ull << (WHEEL_BITS * level);
+    unsigned long long base = (wheel->now + span - 1) & ~(span - 1);
+    if (base >= next) break;
+    unsigned long long baseIndex = (base >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+      const TimerEntry *head = &wheel->slots[level][slot];
+      if (head->next == head) continue;
+      unsigned long long tick = base + ((slot - baseIndex) & (WHEEL_SLOTS - 1)) * span;
+      if (tick < next) next = tick;
+    }
+  }
+  return next;
+}
+
+// Arm the timer fd for the next tick with work, or disarm it when nothing is
+// pending, so an idle or sparse timetable does not wake the CCS every tick
+void wheelRearm(TimerWheel *wheel) {
+  if (wheel->pending > 0) {
+    wheelArmAt(wheel, wheelNextTick(wheel));
+  } else if (wheel->timerFd >= 0) {
+    wheel->armedTick = ~0ull;
+    eventLoopArmTimer(wheel->timerFd, 0, 0);
   }
-  
-  printf("Loaded track configuration: %d sections, %d stations, %d switches\n",
-         sectionCount, stationCount, switchCount);
-  
-  json_object_put(parsed_json); // Free memory
+}
+
+int compareStops(const void *a, const void *b) {
+  const TimetableStop *left = a, *right = b;
+  if (left->trainId != right->trainId) return left->trainId < right->trainId ? -1 : 1;
+  if (left->arrive != right->arrive) return left->arrive < right->arrive ? -1 : 1;
+  return 0;
+}
+
+// Load the timetable (CCS_TIMETABLE, default timetable.txt). Each line is
+// "train section arrive depart speed", times in seconds after the
+// timetable starts; '#' starts a comment. A missing file means no timetable.
+void loadTimetable() {
+  const char *path = getenv("CCS_TIMETABLE");
+  if (!path || !*path) path = TIMETABLE_DEFAULT_PATH;
+  FILE *file = fopen(path, "r");
+  if (!file) return;
+
+  int capacity = 0;
+  char line[BUFFER_SIZE];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    TimetableStop stop;
+    memset(&stop, 0, sizeof(stop));
+    int fields = sscanf(line, "%d %d %lf %lf %d", &stop.trainId, &stop.section, &stop.arrive, &stop.depart, &stop.speed);
+    if (fields <= 0) continue;
+    int node = graphNode(stop.section);
+    if (fields != 5 || stop.trainId <= 0 || node < 0 || stop.arrive < 0 || stop.depart < stop.arrive || stop.speed <= 0) {
+      printf("%s:%d: ignoring stop, expected \"train section arrive depart speed\"\n", path, lineNumber);
+      continue;
+    }
+    stop.zone = trackSections[node].zone;
+    if (timetableStopCount == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      TimetableStop *grown = realloc(timetableStops, capacity * sizeof(TimetableStop));
+      if (!grown) {
+        perror("Timetable allocation failed");
+        exit(EXIT_FAILURE);
+      }
+      timetableStops = grown;
+    }
+    timetableStops[timetableStopCount++] = stop;
+  }
+  fclose(file);
+  if (timetableStopCount == 0) return;
+
+  qsort(timetableStops, timetableStopCount, sizeof(TimetableStop), compareStops);
+  timetableTrains = malloc(timetableStopCount * sizeof(TimetableTrain));
+  if (!timetableTrains) {
+    perror("Timetable allocation failed");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < timetableStopCount; i++) {
+    if (i == 0 || timetableStops[i].trainId != timetableStops[i - 1].trainId) {
+      TimetableTrain *train = &timetableTrains[timetableTrainCount++];
+      train->trainId = timetableStops[i].trainId;
+      train->firstStop = i;
+      train->stopCount = 0;
+      train->current = -1;
+    }
+    timetableTrains[timetableTrainCount - 1].stopCount++;
+  }
+  printf("Loaded timetable %s: %d stops for %d trains\n", path, timetableStopCount, timetableTrainCount);
 }
 
 void initializeSystem() {
   printf("Central Control System initializing...\n");
   loadTrackConfig();
+  buildTrackGraph();
+
+  if (sectionCount > 0) {
+    sectionAuthority = malloc(sectionCount * sizeof(int));
+    if (!sectionAuthority) {
+      perror("Authority table allocation failed");
+      exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < sectionCount; i++) sectionAuthority[i] = -1;
+  }
+  loadTimetable();
+}
+
+void handleZoneMessage(EventLoop *loop, int fd, uint32_t events, void *context);
+void startTimetable();
+void timetableTrainReport(int trainId, int section);
+
+// Queue a command for a zone controller and write it at once, after any
+// higher-priority commands still queued for it. Returns 0 if the link has
+// failed or fallen too far behind; it is then shut down, and
+// handleZoneMessage disconnects the zone when it sees the hangup.
+int sendToZone(int index, SendPriority priority, const char *command) {
+  ZoneController *zone = &zoneControllers[index];
+  if (sendQueuePush(&zone->queue, priority, command, strlen(command), monotonicNs()) < 0 ||
+      sendQueueFlush(&zone->queue, zone->socket, priority) < 0) {
+    printf("Zone controller %d is not taking commands, dropping its link\n", zone->id);
+    shutdown(zone->socket, SHUT_RDWR);
+    return 0;
+  }
+  return 1;
 }
 
-void handleZoneConnection(int serverSocket) {
+// Register a zone controller from the first message on its connection.
+// Returns 0 if the connection was refused.
+int registerZone(int clientSocket, const char *buffer) {
+  int zoneId;
+  if (sscanf(buffer, "REGISTER_ZONE %d", &zoneId) != 1) {
+    printf("Unknown registration: %s\n", buffer);
+    return 0;
+  }
+
+  // Reuse the slot of a zone controller that has gone, e.g. before a restart
+  int index = -1;
+  for (int i = 0; i < zoneCount; i++) {
+    if (!zoneControllers[i].connected) {
+      index = i;
+      break;
+    }
+  }
+  if (index < 0) {
+    if (zoneCount == MAX_ZONES) {
+      printf("Zone controller %d refused, %d zones connected\n", zoneId, MAX_ZONES);
+      return 0;
+    }
+    index = zoneCount++;
+  }
+
   struct sockaddr_in clientAddr;
   socklen_t addrLen = sizeof(clientAddr);
-  int clientSocket =
-      accept(serverSocket, (struct sockaddr *)&clientAddr, &addrLen);
+  memset(&clientAddr, 0, sizeof(clientAddr));
+  getpeername(clientSocket, (struct sockaddr *)&clientAddr, &addrLen);
 
-  if (clientSocket < 0) {
-    perror("Accept failed");
-    return;
+  zoneControllers[index].id = zoneId;
+  zoneControllers[index].connected = 1;
+  zoneControllers[index].address = clientAddr;
+  zoneControllers[index].socket = clientSocket;
+  zoneControllers[index].pendingLength = 0;
+  sendQueueInit(&zoneControllers[index].queue, sendLatency);
+  sendQueueConfigureSocket(clientSocket);
+  eventLoopSetHandler(&eventLoop, clientSocket, handleZoneMessage, (void *)(intptr_t)index);
+
+  char response[BUFFER_SIZE];
+  sprintf(response, "ZONE_REGISTERED %d\n", zoneId);
+  sendToZone(index, SEND_PRIORITY_CONTROL, response);
+
+  printf("Zone Controller %d registered\n", zoneId);
+  journalRecord(JOURNAL_ZONE_REGISTERED, zoneId, 0, 0, 0, 1);
+  startTimetable();
+  eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_INFO, 0, zoneId,
+            "Zone controller %d registered", zoneId);
+  return 1;
+}
+
+void processZoneMessage(ZoneController *zone, const char *message) {
+  int trainId, section;
+  if (sscanf(message, "TRAIN_SECTION %d %d", &trainId, &section) == 2) {
+    journalRecord(JOURNAL_TRAIN_SECTION, zone->id, trainId, section, 0, 1);
+    timetableTrainReport(trainId, section);
+  } else if (message[0] != '\0') {
+    printf("Message from Zone %d: %s\n", zone->id, message);
   }
+}
 
+void handleZoneMessage(EventLoop *loop, int fd, uint32_t events, void *context) {
+  int index = (int)(intptr_t)context;
+  ZoneController *zone = &zoneControllers[index];
+  // Room again on a link that filled up: write the commands still queued
+  if ((events & EPOLLOUT) && zone->queue.queuedBytes > 0 &&
+      sendQueueFlush(&zone->queue, fd, SEND_PRIORITY_BULK) < 0) {
+    shutdown(fd, SHUT_RDWR);
+  }
   char buffer[BUFFER_SIZE];
-  int bytesRead = recv(clientSocket, buffer, BUFFER_SIZE, 0);
-  if (bytesRead <= 0) {
-    close(clientSocket);
-    return;
+  int bytesRead;
+  while ((bytesRead = eventLoopReceive(fd, buffer, BUFFER_SIZE)) > 0) {
+    // Zone reports are newline-terminated; keep a partial line for the next read
+    char *line = buffer;
+    char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+      *newline = '\0';
+      if (zone->pendingLength > 0) {
+        snprintf(zone->pending + zone->pendingLength, BUFFER_SIZE - zone->pendingLength, "%s", line);
+        processZoneMessage(zone, zone->pending);
+        zone->pendingLength = 0;
+      } else {
+        processZoneMessage(zone, line);
+      }
+      line = newline + 1;
+    }
+    int rest = strlen(line);
+    if (rest > 0) {
+      if (zone->pendingLength + rest >= BUFFER_SIZE) zone->pendingLength = 0; // Not a report; drop it
+      memcpy(zone->pending + zone->pendingLength, line, rest + 1);
+      zone->pendingLength += rest;
+    }
   }
+  if (bytesRead < 0) {
+    eventLoopRemove(loop, fd);
+    close(fd);
+    zoneControllers[index].connected = 0;
+    sendQueueFree(&zoneControllers[index].queue);
+    printf("Zone Controller %d disconnected\n", zoneControllers[index].id);
+    journalRecord(JOURNAL_ZONE_DISCONNECTED, zoneControllers[index].id, 0, 0, 0, 1);
+    eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_WARNING, 0, zoneControllers[index].id,
+              "Zone controller %d disconnected", zoneControllers[index].id);
+  }
+}
 
-  // Parse zone controller registration
-  int zoneId;
-  if (sscanf(buffer, "REGISTER_ZONE %d", &zoneId) == 1) {
-    if (zoneCount < MAX_ZONES) {
-      zoneControllers[zoneCount].id = zoneId;
-      zoneControllers[zoneCount].connected = 1;
-      zoneControllers[zoneCount].address = clientAddr;
-      zoneControllers[zoneCount].socket = clientSocket;
-      zoneCount++;
-
-      char response[BUFFER_SIZE];
-      sprintf(response, "ZONE_REGISTERED %d", zoneId);
-      send(clientSocket, response, strlen(response), 0);
+// First data on an accepted connection
+void handleNewConnection(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)context;
+  char buffer[BUFFER_SIZE];
+  int bytesRead = eventLoopReceive(fd, buffer, BUFFER_SIZE);
+  if (bytesRead == 0) return;
+  if (bytesRead < 0 || !registerZone(fd, buffer)) {
+    eventLoopRemove(loop, fd);
+    close(fd);
+    return;
+  }
+  // Edge-triggered: drain whatever followed the registration
+  handleZoneMessage(loop, fd, events, loop->watches[fd].context);
+}
 
-      printf("Zone Controller %d registered\n", zoneId);
+void handleListener(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  while (1) {
+    int clientSocket = accept(fd, NULL, NULL);
+    if (clientSocket < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Accept failed");
+      return;
+    }
+    if (eventLoopAdd(loop, clientSocket, EVENT_READ_WRITE_EDGE, handleNewConnection, NULL) < 0) {
+      perror("Watching connection failed");
+      close(clientSocket);
     }
   }
 }
@@ -211,46 +1153,404 @@ void issueMovementAuthority(int zoneId, int trackSection, int speed) {
   for (int i = 0; i < zoneCount; i++) {
     if (zoneControllers[i].id == zoneId && zoneControllers[i].connected) {
       char command[BUFFER_SIZE];
-      sprintf(command, "MOVEMENT_AUTHORITY %d %d", trackSection, speed);
-      send(zoneControllers[i].socket, command, strlen(command), 0);
+      sprintf(command, "MOVEMENT_AUTHORITY %d %d\n", trackSection, speed);
+      int delivered = sendToZone(i, SEND_PRIORITY_SAFETY, command);
+      journalRecord(JOURNAL_MOVEMENT_AUTHORITY, zoneId, 0, trackSection, speed, delivered);
       printf("Issued movement authority to zone %d, track %d, speed %d\n",
              zoneId, trackSection, speed);
+      eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_INFO, 0, zoneId,
+                "Movement authority S%d at %d km/h", trackSection, speed);
       return;
     }
   }
+  journalRecord(JOURNAL_MOVEMENT_AUTHORITY, zoneId, 0, trackSection, speed, 0);
   printf("Zone controller %d not found or not connected\n", zoneId);
+  eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_WARNING, 0, zoneId,
+            "Movement authority S%d dropped, zone %d not connected", trackSection, zoneId);
+}
+
+void sendRouteToZone(int zoneId, int trainId, int destinationSection) {
+  for (int i = 0; i < zoneCount; i++) {
+    if (zoneControllers[i].connected && zoneControllers[i].id == zoneId) {
+      char command[BUFFER_SIZE];
+      sprintf(command, "ROUTE_TRAIN %d %d\n", trainId, destinationSection);
+      int delivered = sendToZone(i, SEND_PRIORITY_CONTROL, command);
+      journalRecord(JOURNAL_ROUTE_TRAIN, zoneId, trainId, destinationSection, 0, delivered);
+      printf("Sent route command to Zone %d\n", zoneId);
+      return;
+    }
+  }
+  journalRecord(JOURNAL_ROUTE_TRAIN, zoneId, trainId, destinationSection, 0, 0);
+  printf("Zone controller %d not connected, route command not sent\n", zoneId);
+}
+
+// Stop every train in a zone, or in every zone for zone 0. The command
+// goes ahead of anything else queued for the zone controllers.
+void emergencyStop(int zoneId) {
+  int zones = 0;
+  for (int i = 0; i < zoneCount; i++) {
+    if (!zoneControllers[i].connected || (zoneId != 0 && zoneControllers[i].id != zoneId)) continue;
+    int delivered = sendToZone(i, SEND_PRIORITY_SAFETY, "EMERGENCY_STOP\n");
+    journalRecord(JOURNAL_EMERGENCY_STOP, zoneControllers[i].id, 0, 0, 0, delivered);
+    zones += delivered;
+  }
+  printf("Emergency stop sent to %d zone controllers\n", zones);
+  eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_ERROR, 0, zoneId,
+            zoneId ? "Emergency stop, zone %d" : "Emergency stop, all zones", zoneId);
 }
 
 void setRoute(int trainId, int destinationSection) {
   printf("Setting route for Train %d to destination section %d\n", trainId, destinationSection);
   
-  // Find the destination section in our track configuration
-  int destinationZone = 0;
-  for (int i = 0; i < sectionCount; i++) {
-    if (trackSections[i].id == destinationSection) {
-      destinationZone = trackSections[i].zone;
-      break;
+  int destination = graphNode(destinationSection);
+  if (destination < 0) {
+    printf("Destination section %d not found\n", destinationSection);
+    eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_WARNING, trainId, 0,
+              "Route rejected: no section %d", destinationSection);
+    return;
+  }
+  int destinationZone = trackSections[destination].zone;
+
+  // Without a reported position only the destination zone can act on it
+  TrainLocation *location = findTrainLocation(trainId);
+  int origin = location ? graphNode(location->section) : -1;
+  if (origin < 0) {
+    eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_INFO, trainId, destinationZone,
+              "Route to S%d (zone %d), position unknown", destinationSection, destinationZone);
+    sendRouteToZone(destinationZone, trainId, destinationSection);
+    return;
+  }
+
+  int *path = trackGraph.path;
+  int length = findRoute(origin, destination, path, trackGraph.nodeCount);
+  if (length == 0) {
+    printf("No route from section %d to %d\n", location->section, destinationSection);
+    eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_WARNING, trainId, destinationZone,
+              "Route rejected: S%d unreachable from S%d", destinationSection, location->section);
+    return;
+  }
+
+  eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_INFO, trainId, destinationZone,
+            "Route S%d to S%d, %d sections", location->section, destinationSection, length);
+
+  // Configure route through each zone on the path, in the order the train meets them
+  int pathZones[MAX_ZONES];
+  int pathZoneCount = 0;
+  for (int i = 0; i < length; i++) {
+    int zoneId = trackSections[path[i]].zone;
+    int seen = 0;
+    for (int j = 0; j < pathZoneCount; j++) {
+      if (pathZones[j] == zoneId) {
+        seen = 1;
+        break;
+      }
     }
+    if (seen) continue;
+    if (pathZoneCount == MAX_ZONES) break;
+    pathZones[pathZoneCount++] = zoneId;
+    sendRouteToZone(zoneId, trainId, destinationSection);
   }
-  
-  if (destinationZone == 0) {
-    printf("Destination section %d not found\n", destinationSection);
+}
+
+TimetableTrain *findTimetableTrain(int trainId) {
+  int low = 0, high = timetableTrainCount - 1;
+  while (low <= high) {
+    int middle = (low + high) / 2;
+    if (timetableTrains[middle].trainId == trainId) return &timetableTrains[middle];
+    if (timetableTrains[middle].trainId < trainId) low = middle + 1;
+    else high = middle - 1;
+  }
+  return NULL;
+}
+
+unsigned long long timetableTime(double seconds) {
+  return timerWheel.startNs + (unsigned long long)(seconds * 1e9);
+}
+
+void stopArrived(int index, unsigned long long nowNs) {
+  TimetableStop *stop = &timetableStops[index];
+  stop->state = STOP_ARRIVED;
+  unsigned long long due = timetableTime(stop->arrive);
+  latencyRecord(&arrivalDelay, nowNs > due ? nowNs - due : 0);
+
+  // Hold the train for its full dwell, even if that makes it leave late
+  unsigned long long earliest = nowNs + (unsigned long long)((stop->depart - stop->arrive) * 1e9);
+  if (!stop->departTimer.prev) {
+    wheelAdd(&timerWheel, &stop->departTimer, earliest); // Its departure time has passed already
+  } else if (earliest > stop->departTimer.dueNs) {
+    wheelCancel(&timerWheel, &stop->departTimer);
+    wheelAdd(&timerWheel, &stop->departTimer, earliest);
+  }
+  if (nowNs > due + 1000000000ull) {
+    eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_WARNING, stop->trainId, stop->zone,
+              "Train %d reached S%d %.1f s late", stop->trainId, stop->section, (nowNs - due) / 1e9);
+  }
+}
+
+// Send a train to a stop and hold it there until its departure
+void routeToStop(int index, unsigned long long nowNs) {
+  TimetableStop *stop = &timetableStops[index];
+  TimetableTrain *train = findTimetableTrain(stop->trainId);
+  train->current = index;
+  stop->state = STOP_ROUTED;
+  issueMovementAuthority(stop->zone, stop->section, 0);
+  setRoute(stop->trainId, stop->section);
+
+  TrainLocation *location = findTrainLocation(stop->trainId);
+  if (location && location->section == stop->section) stopArrived(index, nowNs);
+}
+
+void fireTimetableTimer(TimerEntry *timer, unsigned long long nowNs) {
+  timersFired++;
+  latencyRecord(&timerLateness, nowNs > timer->dueNs ? nowNs - timer->dueNs : 0);
+  TimetableStop *stop = &timetableStops[timer->stop];
+  if (timer->kind == TIMER_ROUTE) {
+    routeToStop(timer->stop, nowNs);
+    return;
+  }
+
+  // Departure time, but the train has not arrived: it leaves a dwell after it does
+  if (stop->state != STOP_ARRIVED) return;
+  stop->state = STOP_DEPARTED;
+  issueMovementAuthority(stop->zone, stop->section, stop->speed);
+  TimetableTrain *train = findTimetableTrain(stop->trainId);
+  if (timer->stop + 1 < train->firstStop + train->stopCount) routeToStop(timer->stop + 1, nowNs);
+}
+
+void handleTimetableTick(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)loop;
+  (void)fd;
+  (void)events;
+  (void)context;
+  wheelAdvance(&timerWheel, monotonicNs(), fireTimetableTimer);
+  wheelRearm(&timerWheel);
+}
+
+// Timetable times count from the first zone controller registration, when
+// there is someone to send the commands to
+void startTimetable() {
+  if (timetableStarted || timetableStopCount == 0) return;
+  timetableStarted = 1;
+
+  timerWheel.timerFd = eventLoopAddTimer(&eventLoop, handleTimetableTick, NULL);
+  if (timerWheel.timerFd < 0) {
+    perror("Timetable timer creation failed");
+    return;
+  }
+  wheelInit(&timerWheel, monotonicNs());
+  for (int i = 0; i < timetableTrainCount; i++) {
+    TimetableStop *first = &timetableStops[timetableTrains[i].firstStop];
+    first->routeTimer.kind = TIMER_ROUTE;
+    first->routeTimer.stop = timetableTrains[i].firstStop;
+    wheelAdd(&timerWheel, &first->routeTimer, timerWheel.startNs);
+  }
+  for (int i = 0; i < timetableStopCount; i++) {
+    timetableStops[i].departTimer.kind = TIMER_DEPART;
+    timetableStops[i].departTimer.stop = i;
+    wheelAdd(&timerWheel, &timetableStops[i].departTimer, timetableTime(timetableStops[i].depart));
+  }
+  printf("Timetable started: %d timers pending\n", timerWheel.pending);
+  eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_INFO, 0, 0,
+            "Timetable started, %d stops for %d trains", timetableStopCount, timetableTrainCount);
+}
+
+void timetableTrainReport(int trainId, int section) {
+  if (!timetableStarted) return;
+  TimetableTrain *train = findTimetableTrain(trainId);
+  if (!train || train->current < 0) return;
+  TimetableStop *stop = &timetableStops[train->current];
+  if (stop->state == STOP_ROUTED && stop->section == section) stopArrived(train->current, monotonicNs());
+}
+
+void printTimetableState() {
+  int departed = 0;
+  for (int i = 0; i < timetableStopCount; i++) {
+    if (timetableStops[i].state == STOP_DEPARTED) departed++;
+  }
+  printf("Timetable: %d stops for %d trains, %d departed, %d timers pending, %llu fired\n",
+         timetableStopCount, timetableTrainCount, departed, timerWheel.pending, timersFired);
+  printLatency("Timer lateness", &timerLateness);
+  printLatency("Arrival delay", &arrivalDelay);
+}
+
+// Apply a rewritten topology image. Everything is rebuilt beside the live
+// tables and swapped in between two events, so the handlers never see a
+// half-applied layout and nothing waits on a lock. The route tables are only
+// rebuilt when the graph changed.
+void reloadTopology() {
+  unsigned long long started = monotonicNs();
+  Topology next;
+  if (topologyOpen(&next, topologyImagePath()) < 0) {
+    printf("Keeping the loaded topology, %s could not be loaded\n", topologyImagePath());
+    return;
+  }
+  TopologyDiff diff;
+  topologyDiff(&topology, &next, &diff);
+  if (topologyDiffEmpty(&diff)) {
+    topologyClose(&next);
+    return;
+  }
+
+  // Graph nodes are section indices: keep the tables only if no section moved
+  int sameNodes = diff.linksChanged == 0 && topology.header && next.header->sectionCount == sectionCount;
+  for (int i = 0; sameNodes && i < sectionCount; i++) {
+    sameNodes = trackSections[i].id == next.sections[i].id;
+  }
+
+  // Movement authorities are kept per node; carry them over by section id
+  int *authority = NULL;
+  if (next.header->sectionCount > 0) {
+    authority = malloc(next.header->sectionCount * sizeof(int));
+    if (!authority) {
+      printf("Keeping the loaded topology, out of memory\n");
+      topologyClose(&next);
+      return;
+    }
+    for (int i = 0; i < next.header->sectionCount; i++) {
+      int old = graphNode(next.sections[i].id);
+      authority[i] = old >= 0 && sectionAuthority ? sectionAuthority[old] : -1;
+    }
+  }
+
+  Topology old = topology;
+  topology = next;
+  trackSections = topology.sections;
+  sectionCount = topology.header->sectionCount;
+  stations = topology.stations;
+  stationCount = topology.header->stationCount;
+  switchCount = topology.header->switchCount;
+  free(sectionAuthority);
+  sectionAuthority = authority;
+  if (!sameNodes) {
+    freeTrackGraph();
+    buildTrackGraph();
+  }
+  for (int i = 0; i < timetableStopCount; i++) {
+    int node = graphNode(timetableStops[i].section);
+    if (node >= 0) timetableStops[i].zone = trackSections[node].zone;
+  }
+  topologyClose(&old);
+
+  double elapsedMs = (monotonicNs() - started) / 1e6;
+  char summary[160];
+  topologyDiffFormat(&diff, summary, sizeof(summary));
+  printf("Applied topology change in %.2f ms: %s%s\n", elapsedMs, summary,
+         sameNodes ? "" : ", route tables rebuilt");
+  eventLogf(sharedState, LOG_COMPONENT_CCS, LOG_SEVERITY_INFO, 0, 0,
+            "Topology reloaded in %.1f ms, %d sections", elapsedMs, sectionCount);
+}
+
+void handleTopologyChange(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)loop;
+  (void)events;
+  (void)context;
+  if (topologyWatchChanged(fd, topologyImagePath())) reloadTopology();
+}
+
+// User commands, one line per wakeup; stdin is level-triggered
+void handleUserCommand(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  char command[BUFFER_SIZE];
+  if (fgets(command, BUFFER_SIZE, stdin) == NULL) {
+    eventLoopRemove(loop, fd); // End of input; stop polling it
     return;
   }
+
+  int zoneId, trackSection, speed, trainId, destination;
   
-  // Configure route through each zone
-  for (int i = 0; i < zoneCount; i++) {
-    if (zoneControllers[i].connected) {
-      char command[BUFFER_SIZE];
-      sprintf(command, "ROUTE_TRAIN %d %d", trainId, destinationSection);
-      send(zoneControllers[i].socket, command, strlen(command), 0);
-      printf("Sent route command to Zone %d\n", zoneControllers[i].id);
+  if (sscanf(command, "auth %d %d %d", &zoneId, &trackSection, &speed) == 3) {
+    issueMovementAuthority(zoneId, trackSection, speed);
+  } 
+  else if (sscanf(command, "route %d %d", &trainId, &destination) == 2) {
+    setRoute(trainId, destination);
+  }
+  else if (strncmp(command, "estop", 5) == 0) {
+    emergencyStop(sscanf(command, "estop %d", &zoneId) == 1 ? zoneId : 0);
+  }
+  else if (strncmp(command, "queues", 6) == 0) {
+    for (int i = 0; i < zoneCount; i++) {
+      if (zoneControllers[i].connected && zoneControllers[i].queue.queuedBytes > 0) {
+        printf("Zone %d: %zu bytes queued\n", zoneControllers[i].id, zoneControllers[i].queue.queuedBytes);
+      }
+    }
+    printf("Zone links:\n");
+    for (int priority = 0; priority < SEND_PRIORITIES; priority++) {
+      printLatency(sendPriorityNames[priority], &sendLatency[priority]);
     }
   }
+  else if (strncmp(command, "list", 4) == 0) {
+    printf("Connected Zone Controllers:\n");
+    for (int i = 0; i < zoneCount; i++) {
+      if (zoneControllers[i].connected) {
+        printf("Zone %d\n", zoneControllers[i].id);
+      }
+    }
+  } 
+  else if (strncmp(command, "stations", 8) == 0) {
+    printf("Stations:\n");
+    for (int i = 0; i < stationCount; i++) {
+      printf("%d: %s (Section %d, %s)\n", 
+             stations[i].id, stations[i].name, stations[i].section,
+             stations[i].isTerminus ? "Terminus" : "Regular");
+    }
+  }
+  else if (strncmp(command, "journal", 7) == 0) {
+    unsigned long long head = journal.head;
+    unsigned long long tail = __atomic_load_n(&journal.tail, __ATOMIC_ACQUIRE);
+    unsigned long long groups = __atomic_load_n(&journal.groups, __ATOMIC_RELAXED);
+    printf("Journal: %llu records, %llu pending, %llu syncs (%.1f records each), %llu stalls, %llu failed%s\n",
+           journal.nextSequence, head - tail, groups, groups ? (double)tail / groups : 0.0,
+           journal.stalls, __atomic_load_n(&journal.failed, __ATOMIC_RELAXED),
+           __atomic_load_n(&journal.disabled, __ATOMIC_ACQUIRE) ? ", DISABLED" : "");
+    printJournalState();
+  }
+  else if (strncmp(command, "timetable", 9) == 0) {
+    printTimetableState();
+  }
+  else if (strncmp(command, "quit", 4) == 0) {
+    eventLoopStop(loop);
+  }
+}
+
+// SIGINT and SIGTERM stop the loop so the journal is flushed before exit
+void handleSignal(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  struct signalfd_siginfo info;
+  if (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    printf("Central Control System stopping on signal %u\n", info.ssi_signo);
+    eventLoopStop(loop);
+  }
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+  // central_control_system --replay-journal [journal]: print the state a journal rebuilds
+  if (argc > 1 && strcmp(argv[1], "--replay-journal") == 0) {
+    const char *path = argc > 2 ? argv[2] : getenv("CCS_JOURNAL");
+    if (!path || !*path) path = JOURNAL_DEFAULT_PATH;
+    initializeSystem();
+    long long replayed = journalReplay(path, 0);
+    if (replayed < 0) exit(EXIT_FAILURE);
+    printf("Journal %s: %lld records\n", path, replayed);
+    printJournalState();
+    return 0;
+  }
+
   initializeSystem();
+  sharedState = sharedStateAttach();
+
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  int signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (signalFd < 0) {
+    perror("signalfd failed");
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+  }
+  startJournal();
 
   // Create TCP server socket for zone controller connections
   int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
@@ -284,99 +1584,49 @@ int main() {
 
   printf("Central Control System online. Listening on port %d\n", CCS_PORT);
 
-  fd_set readfds;
-  struct timeval tv;
-  int maxfd;
-
-  while (1) {
-    FD_ZERO(&readfds);
-    FD_SET(serverSocket, &readfds);
-    FD_SET(STDIN_FILENO, &readfds); // Add stdin for user commands
-    maxfd = serverSocket;
-
-    // Add all zone controller sockets
-    for (int i = 0; i < zoneCount; i++) {
-      if (zoneControllers[i].connected) {
-        FD_SET(zoneControllers[i].socket, &readfds);
-        if (zoneControllers[i].socket > maxfd)
-          maxfd = zoneControllers[i].socket;
-      }
-    }
-
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-
-    int activity = select(maxfd + 1, &readfds, NULL, NULL, &tv);
-
-    if (activity < 0) {
-      perror("Select error");
-      continue;
-    }
-
-    // New zone controller connection
-    if (FD_ISSET(serverSocket, &readfds)) {
-      handleZoneConnection(serverSocket);
-    }
-
-    // Check for user commands
-    if (FD_ISSET(STDIN_FILENO, &readfds)) {
-      char command[BUFFER_SIZE];
-      if (fgets(command, BUFFER_SIZE, stdin) != NULL) {
-        int zoneId, trackSection, speed, trainId, destination;
-        
-        if (sscanf(command, "auth %d %d %d", &zoneId, &trackSection, &speed) == 3) {
-          issueMovementAuthority(zoneId, trackSection, speed);
-        } 
-        else if (sscanf(command, "route %d %d", &trainId, &destination) == 2) {
-          setRoute(trainId, destination);
-        }
-        else if (strncmp(command, "list", 4) == 0) {
-          printf("Connected Zone Controllers:\n");
-          for (int i = 0; i < zoneCount; i++) {
-            if (zoneControllers[i].connected) {
-              printf("Zone %d\n", zoneControllers[i].id);
-            }
-          }
-        } 
-        else if (strncmp(command, "stations", 8) == 0) {
-          printf("Stations:\n");
-          for (int i = 0; i < stationCount; i++) {
-            printf("%d: %s (Section %d, %s)\n", 
-                   stations[i].id, stations[i].name, stations[i].section,
-                   stations[i].isTerminus ? "Terminus" : "Regular");
-          }
-        }
-        else if (strncmp(command, "quit", 4) == 0) {
-          break;
-        }
-      }
-    }
-
-    // Check for messages from zone controllers
-    for (int i = 0; i < zoneCount; i++) {
-      if (zoneControllers[i].connected &&
-          FD_ISSET(zoneControllers[i].socket, &readfds)) {
-        char buffer[BUFFER_SIZE];
-        int bytesRead =
-            recv(zoneControllers[i].socket, buffer, BUFFER_SIZE, 0);
-        if (bytesRead <= 0) {
-          close(zoneControllers[i].socket);
-          zoneControllers[i].connected = 0;
-          printf("Zone Controller %d disconnected\n", zoneControllers[i].id);
-        } else {
-          buffer[bytesRead] = '\0';
-          printf("Message from Zone %d: %s\n", zoneControllers[i].id, buffer);
-        }
-      }
-    }
+  if (eventLoopInit(&eventLoop) < 0) {
+    perror("Event loop creation failed");
+    exit(EXIT_FAILURE);
+  }
+  if (setNonBlocking(serverSocket) < 0 ||
+      eventLoopAdd(&eventLoop, serverSocket, EVENT_READ_EDGE, handleListener, NULL) < 0) {
+    perror("Event loop registration failed");
+    exit(EXIT_FAILURE);
   }
+  // stdin may be a file or /dev/null, which epoll cannot watch. Unbuffered,
+  // a line not yet read stays in the kernel and keeps the fd readable.
+  setvbuf(stdin, NULL, _IONBF, 0);
+  eventLoopAdd(&eventLoop, STDIN_FILENO, EVENT_READ, handleUserCommand, NULL);
+  if (signalFd >= 0 && eventLoopAdd(&eventLoop, signalFd, EVENT_READ, handleSignal, NULL) < 0) {
+    perror("Watching signals failed");
+  }
+  int topologyWatch = topologyWatchOpen(topologyImagePath());
+  if (topologyWatch < 0 || eventLoopAdd(&eventLoop, topologyWatch, EVENT_READ, handleTopologyChange, NULL) < 0) {
+    perror("Watching the topology image failed, changes need a restart");
+  }
+  notifyReady();
+
+  eventLoopRun(&eventLoop);
 
   // Clean up
   for (int i = 0; i < zoneCount; i++) {
     if (zoneControllers[i].connected) {
       close(zoneControllers[i].socket);
+      sendQueueFree(&zoneControllers[i].queue);
     }
   }
+  if (timetableStarted) printTimetableState();
+  eventLoopClose(&eventLoop);
+  stopJournal();
+  if (signalFd >= 0) close(signalFd);
+  if (topologyWatch >= 0) close(topologyWatch);
+  freeTrackGraph();
+  topologyClose(&topology);
+  free(trainLocations);
+  free(sectionAuthority);
+  free(timetableStops);
+  free(timetableTrains);
   close(serverSocket);
+  if (sharedState != MAP_FAILED) munmap(sharedState, sizeof(SharedState));
   return 0;
 }
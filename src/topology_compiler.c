@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <json-c/json.h>
+
+#include "cbtc_topology.h"
+
+// Compile track_config.json into the binary topology image that the CCS,
+// zone controllers and orchestrator map at startup:
+//
+//     topology_compiler [config.json [image]]
+//
+// The image is written next to its final name and renamed into place, so
+// processes that already map the old image keep a consistent copy.
+
+#define DEFAULT_CONFIG_FILE "track_config.json"
+
+static int getInt(struct json_object *object, const char *key, int fallback) {
+    struct json_object *value;
+    if (!json_object_object_get_ex(object, key, &value)) return fallback;
+    return json_object_get_int(value);
+}
+
+static float getFloat(struct json_object *object, const char *key) {
+    struct json_object *value;
+    if (!json_object_object_get_ex(object, key, &value)) return 0.0f;
+    return (float)json_object_get_double(value);
+}
+
+static struct json_object *getArray(struct json_object *object, const char *key) {
+    struct json_object *value;
+    if (!json_object_object_get_ex(object, key, &value) || !json_object_is_type(value, json_type_array)) {
+        return NULL;
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        fprintf(stderr, "Usage: %s [config.json [image]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *configPath = argc > 1 ? argv[1] : DEFAULT_CONFIG_FILE;
+    const char *imagePath = argc > 2 ? argv[2] : topologyImagePath();
+
+    struct json_object *config = json_object_from_file(configPath);
+    if (!config) {
+        fprintf(stderr, "Error loading config file: %s\n", configPath);
+        exit(EXIT_FAILURE);
+    }
+    struct json_object *sections = getArray(config, "track_sections");
+    struct json_object *stations = getArray(config, "stations");
+    struct json_object *switches = getArray(config, "switches");
+    struct json_object *signals = getArray(config, "signals");
+    if (!sections) {
+        fprintf(stderr, "%s has no track_sections\n", configPath);
+        exit(EXIT_FAILURE);
+    }
+
+    int sectionCount = json_object_array_length(sections);
+    int stationTotal = stations ? (int)json_object_array_length(stations) : 0;
+    int switchTotal = switches ? (int)json_object_array_length(switches) : 0;
+    int signalTotal = signals ? (int)json_object_array_length(signals) : 0;
+
+    // Section ids index a lookup table, so they must be small and unique
+    int maxSectionId = 0;
+    int adjacencyCount = 0;
+    for (int i = 0; i < sectionCount; i++) {
+        struct json_object *section = json_object_array_get_idx(sections, i);
+        int id = getInt(section, "id", -1);
+        if (id < 0) {
+            fprintf(stderr, "Section %d has no valid id\n", i);
+            exit(EXIT_FAILURE);
+        }
+        if (id > maxSectionId) maxSectionId = id;
+        struct json_object *next = getArray(section, "next_sections");
+        if (next) adjacencyCount += json_object_array_length(next);
+    }
+
+    TopologyHeader layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.magic = TOPOLOGY_MAGIC;
+    layout.version = TOPOLOGY_VERSION;
+    layout.maxSectionId = maxSectionId;
+    layout.sectionOffset = topologyAlign(sizeof(TopologyHeader));
+    layout.adjacencyOffset = topologyAlign(layout.sectionOffset + (unsigned long long)sectionCount * sizeof(TopologySection));
+    layout.sectionIndexOffset = topologyAlign(layout.adjacencyOffset + (unsigned long long)adjacencyCount * sizeof(int));
+    layout.stationOffset = topologyAlign(layout.sectionIndexOffset + (unsigned long long)(maxSectionId + 1) * sizeof(int));
+    layout.switchOffset = topologyAlign(layout.stationOffset + (unsigned long long)stationTotal * sizeof(TopologyStation));
+    layout.signalOffset = topologyAlign(layout.switchOffset + (unsigned long long)switchTotal * sizeof(TopologySwitch));
+    layout.size = topologyAlign(layout.signalOffset + (unsigned long long)signalTotal * sizeof(TopologySignal));
+
+    char *image = calloc(1, layout.size);
+    if (!image) {
+        perror("Image allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    TopologyHeader *header = (TopologyHeader *)image;
+    *header = layout;
+    TopologySection *outSections = (TopologySection *)(image + layout.sectionOffset);
+    int *adjacency = (int *)(image + layout.adjacencyOffset);
+    int *sectionIndex = (int *)(image + layout.sectionIndexOffset);
+    TopologyStation *outStations = (TopologyStation *)(image + layout.stationOffset);
+    TopologySwitch *outSwitches = (TopologySwitch *)(image + layout.switchOffset);
+    TopologySignal *outSignals = (TopologySignal *)(image + layout.signalOffset);
+
+    for (int id = 0; id <= maxSectionId; id++) {
+        sectionIndex[id] = TOPOLOGY_NONE;
+    }
+    for (int i = 0; i < sectionCount; i++) {
+        struct json_object *section = json_object_array_get_idx(sections, i);
+        TopologySection *out = &outSections[i];
+        out->id = getInt(section, "id", -1);
+        if (sectionIndex[out->id] != TOPOLOGY_NONE) {
+            fprintf(stderr, "Section %d is defined twice\n", out->id);
+            exit(EXIT_FAILURE);
+        }
+        sectionIndex[out->id] = i;
+        out->zone = getInt(section, "zone", 0);
+        out->x0 = getFloat(section, "x_start");
+        out->y0 = getFloat(section, "y_start");
+        out->x1 = getFloat(section, "x_end");
+        out->y1 = getFloat(section, "y_end");
+        out->station = TOPOLOGY_NONE;
+        out->speedLimit = getInt(section, "speed_limit", 0);
+
+        struct json_object *reverse;
+        out->reverse = json_object_object_get_ex(section, "reverse", &reverse) && json_object_get_boolean(reverse);
+    }
+
+    // Successors as section indices, in section order (compressed sparse rows)
+    header->adjacencyCount = 0;
+    for (int i = 0; i < sectionCount; i++) {
+        struct json_object *section = json_object_array_get_idx(sections, i);
+        struct json_object *next = getArray(section, "next_sections");
+        int nextTotal = next ? (int)json_object_array_length(next) : 0;
+        outSections[i].nextStart = header->adjacencyCount;
+        for (int j = 0; j < nextTotal; j++) {
+            int nextId = json_object_get_int(json_object_array_get_idx(next, j));
+            int index = nextId >= 0 && nextId <= maxSectionId ? sectionIndex[nextId] : TOPOLOGY_NONE;
+            if (index == TOPOLOGY_NONE) {
+                fprintf(stderr, "Section %d leads to unknown section %d, link dropped\n", outSections[i].id, nextId);
+                continue;
+            }
+            adjacency[header->adjacencyCount++] = index;
+        }
+        outSections[i].nextCount = header->adjacencyCount - outSections[i].nextStart;
+    }
+
+    // Station ids follow config order, as the components have always numbered them
+    for (int i = 0; i < stationTotal; i++) {
+        struct json_object *station = json_object_array_get_idx(stations, i);
+        struct json_object *name, *terminus;
+        int section = getInt(station, "section", -1);
+        int index = section >= 0 && section <= maxSectionId ? sectionIndex[section] : TOPOLOGY_NONE;
+        const char *stationName = json_object_object_get_ex(station, "name", &name) ? json_object_get_string(name) : "";
+        if (index == TOPOLOGY_NONE) {
+            fprintf(stderr, "Station %s is on unknown section %d, skipped\n", stationName, section);
+            continue;
+        }
+        TopologyStation *out = &outStations[header->stationCount];
+        out->id = i + 1;
+        out->section = section;
+        out->stopTime = getInt(station, "stop_time", 0);
+        out->isTerminus = json_object_object_get_ex(station, "terminus", &terminus) && json_object_get_boolean(terminus);
+        strncpy(out->name, stationName, sizeof(out->name) - 1);
+        outSections[index].station = header->stationCount++;
+    }
+
+    for (int i = 0; i < switchTotal; i++) {
+        struct json_object *switchObject = json_object_array_get_idx(switches, i);
+        int section = getInt(switchObject, "section", -1);
+        int index = section >= 0 && section <= maxSectionId ? sectionIndex[section] : TOPOLOGY_NONE;
+        if (index == TOPOLOGY_NONE) {
+            fprintf(stderr, "Switch %d is on unknown section %d, skipped\n", getInt(switchObject, "id", 0), section);
+            continue;
+        }
+        TopologySwitch *out = &outSwitches[header->switchCount++];
+        out->id = getInt(switchObject, "id", 0);
+        out->section = section;
+        out->normalNext = getInt(switchObject, "normal_next", 0);
+        out->reverseNext = getInt(switchObject, "reverse_next", 0);
+        outSections[index].switchId = out->id;
+    }
+
+    // Signals sit on a known section and belong to its zone. Without a
+    // position they are drawn just above the end of the section.
+    for (int i = 0; i < signalTotal; i++) {
+        struct json_object *signal = json_object_array_get_idx(signals, i);
+        struct json_object *value;
+        int id = getInt(signal, "id", 0);
+        int section = getInt(signal, "section", -1);
+        int index = section >= 0 && section <= maxSectionId ? sectionIndex[section] : TOPOLOGY_NONE;
+        if (index == TOPOLOGY_NONE) {
+            fprintf(stderr, "Signal %d is on unknown section %d, skipped\n", id, section);
+            continue;
+        }
+        int zone = getInt(signal, "zone", outSections[index].zone);
+        if (zone != outSections[index].zone) {
+            fprintf(stderr, "Signal %d is in zone %d but section %d is in zone %d, skipped\n",
+                    id, zone, section, outSections[index].zone);
+            continue;
+        }
+        TopologySignal *out = &outSignals[header->signalCount++];
+        out->id = id;
+        out->section = section;
+        out->zone = zone;
+        out->x = json_object_object_get_ex(signal, "x", &value) ? getFloat(signal, "x") : outSections[index].x1;
+        out->y = json_object_object_get_ex(signal, "y", &value) ? getFloat(signal, "y") : outSections[index].y1 - 20;
+    }
+    header->sectionCount = sectionCount;
+    json_object_put(config);
+
+    // Write beside the target and rename over it
+    char tempPath[4096];
+    if (snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", imagePath, (int)getpid()) >= (int)sizeof(tempPath)) {
+        fprintf(stderr, "Image path too long: %s\n", imagePath);
+        exit(EXIT_FAILURE);
+    }
+    FILE *file = fopen(tempPath, "wb");
+    if (!file) {
+        perror("Opening image for writing failed");
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(image, 1, layout.size, file) != layout.size || fclose(file) != 0) {
+        perror("Writing image failed");
+        unlink(tempPath);
+        exit(EXIT_FAILURE);
+    }
+    if (rename(tempPath, imagePath) != 0) {
+        perror("Installing image failed");
+        unlink(tempPath);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Compiled %s into %s: %d sections, %d links, %d stations, %d switches, %d signals, %llu bytes\n",
+           configPath, imagePath, header->sectionCount, header->adjacencyCount, header->stationCount,
+           header->switchCount, header->signalCount, layout.size);
+    free(image);
+    return 0;
+}
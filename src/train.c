@@ -11,6 +11,13 @@
 #include <unistd.h>
 #include <math.h> // For fabs
 #include <errno.h> // For errno and EINTR
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/sched.h> // For struct clone_args
+
+#include "cbtc_ready.h"
+#include "cbtc_shm.h"
+#include "cbtc_zygote.h"
 
 #define BUFFER_SIZE 1024
 #define ZC_PORT_ENV "ZC_BASE_PORT"
@@ -18,6 +25,9 @@
 #define POSITION_MULTICAST_PORT_ENV "POSITION_MULTICAST_PORT"
 #define POSITION_MULTICAST_GROUP_ENV "POSITION_MULTICAST_GROUP"
 #define POSITION_UPDATE_INTERVAL_MS 100 // Update 10 times per second
+#define POSITION_BROADCAST_INTERVAL_ENV "POSITION_BROADCAST_INTERVAL_MS" // Defaults to the update interval
+#define POSITION_TRANSPORT_ENV "POSITION_TRANSPORT" // "shm" writes positions to the train table instead
+#define TRAIN_SHM_NAME_ENV "CBTC_TRAIN_SHM_NAME"
 
 #define MAX_STATIONS_PER_TRAIN 10
 
@@ -46,19 +56,30 @@ typedef struct {
     TrainStationInfo stations[MAX_STATIONS_PER_TRAIN]; // Info about stations relevant to this train
     int stationCount;
     int takingNorthRoute;   // Flag for train 102 special route, set by ZC
+    int emergencyStopped;   // Held by a ZC emergency stop until new authority arrives
     char lastZcIP[16];      // Store ZC IP for potential reconnects/handoffs
 } TrainState;
 
 TrainState state;
 int zoneControllerSocket = -1;
+char zcPending[BUFFER_SIZE]; // Partial zone controller message from the last read
+int zcPendingLength = 0;
 int movementAuthoritySocket = -1;
 int positionBroadcastSocket = -1;
+SharedState *sharedState = MAP_FAILED; // Orchestrator event log, if running under one
 
 // Ports and group from environment
 int zcPortBase;
 int multicastPort;
 int positionMulticastPort;
 char positionMulticastGroup[20];
+int positionBroadcastIntervalMs = POSITION_UPDATE_INTERVAL_MS;
+
+// Shared-memory position transport: the train writes its own train table
+// slot under the slot's sequence counter instead of multicasting text
+int positionTransportShm = 0;
+TrainTable trainTable = {-1, MAP_FAILED, 0};
+int trainSlot = -1;
 
 
 void initializeTrain(int trainId, int zoneId, int initialSection,
@@ -77,17 +98,23 @@ void initializeTrain(int trainId, int zoneId, int initialSection,
     state.stationTimer = 0;
     state.stationCount = 0;
     state.takingNorthRoute = 0;
+    state.emergencyStopped = 0;
     strncpy(state.lastZcIP, zc_ip_arg, sizeof(state.lastZcIP) - 1);
     state.lastZcIP[sizeof(state.lastZcIP) - 1] = '\0';
 
+    printf("Train %d initialized: Zone %d, Section %d, Pos (%.1f, %.1f), Dir %d, ZC IP %s\n",
+           state.id, state.zoneId, state.currentSection, state.x, state.y, state.direction, state.lastZcIP);
+}
 
+// Settings shared by every train, read once per process (or once per zygote)
+void loadTrainEnvironment() {
     char *zcPortBaseStr = getenv(ZC_PORT_ENV);
     char *multicastPortStr = getenv(MULTICAST_PORT_ENV);
     char *posMcPortStr = getenv(POSITION_MULTICAST_PORT_ENV);
     char *posMcGroupStr = getenv(POSITION_MULTICAST_GROUP_ENV);
 
     if (!zcPortBaseStr || !multicastPortStr || !posMcPortStr || !posMcGroupStr) {
-        fprintf(stderr, "Train %d: Error: Missing env vars for ports/group.\n", state.id);
+        fprintf(stderr, "Train: Error: Missing env vars for ports/group.\n");
         exit(EXIT_FAILURE);
     }
     zcPortBase = atoi(zcPortBaseStr);
@@ -96,8 +123,27 @@ void initializeTrain(int trainId, int zoneId, int initialSection,
     strncpy(positionMulticastGroup, posMcGroupStr, sizeof(positionMulticastGroup) - 1);
     positionMulticastGroup[sizeof(positionMulticastGroup)-1] = '\0';
 
-    printf("Train %d initialized: Zone %d, Section %d, Pos (%.1f, %.1f), Dir %d, ZC IP %s\n",
-           state.id, state.zoneId, state.currentSection, state.x, state.y, state.direction, state.lastZcIP);
+    // The orchestrator extrapolates between broadcasts, so big fleets can run
+    // at a lower rate than the simulation step
+    char *broadcastIntervalStr = getenv(POSITION_BROADCAST_INTERVAL_ENV);
+    if (broadcastIntervalStr && atoi(broadcastIntervalStr) > 0) {
+        positionBroadcastIntervalMs = atoi(broadcastIntervalStr);
+    }
+
+    char *transportStr = getenv(POSITION_TRANSPORT_ENV);
+    positionTransportShm = transportStr && strcmp(transportStr, "shm") == 0;
+}
+
+// Map the train table for the shared-memory transport. Falls back to
+// multicast if it is not available.
+void attachTrainTable() {
+    if (!positionTransportShm) return;
+
+    char *name = getenv(TRAIN_SHM_NAME_ENV);
+    if (!name || trainTableOpen(&trainTable, name) != 0) {
+        fprintf(stderr, "Train: Train table not available, using multicast positions.\n");
+        positionTransportShm = 0;
+    }
 }
 
 int connectToZoneController() {
@@ -130,10 +176,18 @@ int connectToZoneController() {
         perror("Train: Failed to send registration to ZC"); close(sock); return -1;
     }
 
+    // Take only the confirmation line; station info follows straight after it
     char buffer[BUFFER_SIZE];
-    int bytesRead = recv(sock, buffer, BUFFER_SIZE - 1, 0);
+    int bytesRead = recv(sock, buffer, BUFFER_SIZE - 1, MSG_PEEK);
     if (bytesRead > 0) {
         buffer[bytesRead] = '\0';
+        char *newline = strchr(buffer, '\n');
+        bytesRead = recv(sock, buffer, newline ? newline - buffer + 1 : bytesRead, 0);
+    }
+    zcPendingLength = 0;
+    if (bytesRead > 0) {
+        buffer[bytesRead] = '\0';
+        buffer[strcspn(buffer, "\n")] = '\0';
         printf("Train %d: ZC Response: %s\n", state.id, buffer);
     } else {
         printf("Train %d: No ZC response on registration or conn closed.\n", state.id);
@@ -176,6 +230,23 @@ void setupPositionBroadcastSocket() {
 }
 
 void broadcastPosition() {
+    if (trainSlot >= 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        TrainSlot *slot = &trainTableSlots(trainTable.header)[trainSlot];
+        trainSlotWriteBegin(slot);
+        slot->zoneId = state.zoneId;
+        slot->x = state.x;
+        slot->y = state.y;
+        slot->direction = state.direction;
+        slot->speed = state.currentSpeed;
+        slot->section = state.currentSection;
+        slot->atStation = state.atStation;
+        slot->lastUpdateNs = (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+        trainSlotWriteEnd(slot);
+        return;
+    }
+
     char message[BUFFER_SIZE];
     sprintf(message, "TRAIN_POSITION %d %.1f %.1f %d %d %d %d", state.id,
             state.x, state.y, state.direction, state.currentSpeed,
@@ -188,20 +259,99 @@ void broadcastPosition() {
     sendto(positionBroadcastSocket, message, strlen(message), 0, (struct sockaddr *)&groupAddr, sizeof(groupAddr));
 }
 
+// Broadcast when the broadcast interval has passed, or straight away when
+// speed, direction or station state change so receivers never extrapolate
+// with stale motion
+void broadcastPositionIfDue(const struct timespec *now) {
+    static struct timespec lastBroadcastTime = {0, 0};
+    static int lastSpeed = -1, lastDirection = 0, lastAtStation = -1;
+
+    double sinceLastMs = (now->tv_sec - lastBroadcastTime.tv_sec) * 1000.0 +
+                         (now->tv_nsec - lastBroadcastTime.tv_nsec) / 1e6;
+    int motionChanged = state.currentSpeed != lastSpeed || state.direction != lastDirection ||
+                        state.atStation != lastAtStation;
+    if (!motionChanged && sinceLastMs < positionBroadcastIntervalMs) {
+        return;
+    }
+
+    broadcastPosition();
+    lastBroadcastTime = *now;
+    lastSpeed = state.currentSpeed;
+    lastDirection = state.direction;
+    lastAtStation = state.atStation;
+}
+
+// Add a station, or update it if the zone controller sent it before (on
+// reconnect, or when the track configuration changes)
 void processStationInfo(const char *message) {
     int id, section, stopTime, isTerminus;
     char name[32];
     if (sscanf(message, "STATION_INFO %d %d %d %d %31s", &id, &section, &stopTime, &isTerminus, name) == 5) {
-        if (state.stationCount < MAX_STATIONS_PER_TRAIN) {
-            state.stations[state.stationCount].id = id;
-            state.stations[state.stationCount].section = section;
-            state.stations[state.stationCount].stopTime = stopTime;
-            state.stations[state.stationCount].isTerminus = isTerminus;
-            strncpy(state.stations[state.stationCount].name, name, sizeof(state.stations[state.stationCount].name) - 1);
-            state.stations[state.stationCount].name[sizeof(state.stations[state.stationCount].name) - 1] = '\0';
-            state.stationCount++;
-            printf("Train %d: Received info for station %s (Section %d, Stop %ds, Terminus: %d)\n",
-                   state.id, name, section, stopTime, isTerminus);
+        int index = 0;
+        while (index < state.stationCount && state.stations[index].id != id) index++;
+        if (index == MAX_STATIONS_PER_TRAIN) return;
+        if (index == state.stationCount) state.stationCount++;
+        state.stations[index].id = id;
+        state.stations[index].section = section;
+        state.stations[index].stopTime = stopTime;
+        state.stations[index].isTerminus = isTerminus;
+        snprintf(state.stations[index].name, sizeof(state.stations[index].name), "%s", name);
+        printf("Train %d: Received info for station %s (Section %d, Stop %ds, Terminus: %d)\n",
+               state.id, name, section, stopTime, isTerminus);
+    }
+}
+
+void processStationRemoved(const char *message) {
+    int id;
+    if (sscanf(message, "STATION_REMOVED %d", &id) != 1) return;
+    for (int i = 0; i < state.stationCount; i++) {
+        if (state.stations[i].id != id) continue;
+        memmove(&state.stations[i], &state.stations[i + 1], (state.stationCount - i - 1) * sizeof(state.stations[0]));
+        state.stationCount--;
+        printf("Train %d: Station %d removed\n", state.id, id);
+        return;
+    }
+}
+
+// One newline-terminated message from the zone controller
+void processZoneControllerMessage(const char *buffer) {
+    if (strncmp(buffer, "STATION_INFO", 12) == 0) processStationInfo(buffer);
+    else if (strncmp(buffer, "STATION_REMOVED", 15) == 0) processStationRemoved(buffer);
+    else if (strncmp(buffer, "SPEED_LIMIT", 11) == 0) {
+        int speed, section_for_limit; // ZC might specify section for speed limit
+        if (sscanf(buffer, "SPEED_LIMIT %d %d", &section_for_limit, &speed) == 2) {
+            if (section_for_limit == state.currentSection) { // Apply if for current section
+               if(state.targetSpeed != speed) printf("Train %d: ZC SPEED_LIMIT %d for S%d (was %d).\n", state.id, speed, section_for_limit, state.targetSpeed);
+               state.targetSpeed = speed;
+               if (speed > 0) state.emergencyStopped = 0;
+            }
+        } else if (sscanf(buffer, "SPEED_LIMIT %d", &speed) == 1) { // Generic speed limit
+            if(state.targetSpeed != speed) printf("Train %d: ZC SPEED_LIMIT %d (was %d).\n", state.id, speed, state.targetSpeed);
+            state.targetSpeed = speed;
+            if (speed > 0) state.emergencyStopped = 0;
+        }
+    } else if (strncmp(buffer, "EMERGENCY_STOP", 14) == 0) {
+        state.targetSpeed = 0;
+        state.currentSpeed = 0; // Emergency brake, no gradual slowdown
+        state.emergencyStopped = 1;
+        printf("Train %d: ZC EMERGENCY_STOP in S%d.\n", state.id, state.currentSection);
+        eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_ERROR, state.id, state.zoneId,
+                  "Emergency stop in S%d", state.currentSection);
+    } else if (strncmp(buffer, "REVERSE_DIRECTION", 17) == 0) {
+        state.direction *= -1;
+        printf("Train %d: ZC REVERSE_DIRECTION. New dir: %d\n", state.id, state.direction);
+        eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_INFO, state.id, state.zoneId,
+                  "Reversed by zone controller");
+    } else if (strncmp(buffer, "ROUTE_TO_NORTH", 14) == 0 && state.id == 102) {
+        printf("Train 102: ZC Commanded North route.\n");
+        state.takingNorthRoute = 1;
+    } else if (strncmp(buffer, "UPDATE_SECTION", 14) == 0) {
+        int new_sec;
+        if (sscanf(buffer, "UPDATE_SECTION %d", &new_sec) == 1) {
+            if (state.currentSection != new_sec) {
+                printf("Train %d: ZC updated section to %d (was %d)\n", state.id, new_sec, state.currentSection);
+                state.currentSection = new_sec;
+            }
         }
     }
 }
@@ -223,19 +373,23 @@ void updatePositionAndState() {
         if (state.stationTimer == 0) {
             printf("Train %d: Departing station %s (Section %d)\n", state.id,
                    state.stations[state.currentStationId -1].name, state.currentSection);
+            eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_INFO, state.id, state.zoneId,
+                      "Departed %s (S%d)", state.stations[state.currentStationId -1].name, state.currentSection);
             state.atStation = 0;
             for (int i = 0; i < state.stationCount; ++i) {
                 if (state.stations[i].id == state.currentStationId && state.stations[i].isTerminus) {
                     state.direction *= -1;
                     printf("Train %d: Reversed direction at terminus %s. New dir: %d\n",
                            state.id, state.stations[i].name, state.direction);
+                    eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_INFO, state.id, state.zoneId,
+                              "Reversed at terminus %s", state.stations[i].name);
                     break;
                 }
             }
             state.currentStationId = 0; // Clear current station
-            state.targetSpeed = 20; // Default departure speed, ZC can override
+            state.targetSpeed = state.emergencyStopped ? 0 : 20; // Default departure speed, ZC can override
         }
-        broadcastPosition(); // Keep broadcasting even when stopped
+        broadcastPositionIfDue(&currentTime); // Keep broadcasting even when stopped
         return; 
     }
 
@@ -292,13 +446,16 @@ void updatePositionAndState() {
                     state.stationTimer = state.stations[i].stopTime * (int)(1000.0 / POSITION_UPDATE_INTERVAL_MS);
                     printf("Train %d: Arrived and stopping at station %s (Sec %d) for %d cycles.\n",
                            state.id, state.stations[i].name, state.currentSection, state.stationTimer);
+                    eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_INFO, state.id, state.zoneId,
+                              "Arrived at %s (S%d), dwell %ds", state.stations[i].name, state.currentSection,
+                              state.stations[i].stopTime);
                     state.currentSpeed = 0; // Ensure fully stopped
                     break;
                 }
             }
         }
     }
-    broadcastPosition();
+    broadcastPositionIfDue(&currentTime);
 
     // Periodically send TCP update to ZC with current section (as train perceives it)
     static struct timespec lastTcpReportTime = {0, 0};
@@ -344,14 +501,17 @@ void processMovementAuthority(const char *message) {
             if (state.targetSpeed != maSpeed) {
                  printf("Train %d: Received MA for Z%d S%d. New target speed: %d km/h (was %d). My section: S%d\n",
                    state.id, maZoneId, maSection, maSpeed, state.targetSpeed, state.currentSection);
+                 eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_INFO, state.id, state.zoneId,
+                           "Movement authority S%d: %d -> %d km/h", maSection, state.targetSpeed, maSpeed);
             }
             state.targetSpeed = maSpeed;
+            if (maSpeed > 0) state.emergencyStopped = 0;
             state.currentSection = maSection; // Assume MA implies current section
         }
     }
 }
 
-int main(int argc, char *argv[]) {
+int runTrain(int argc, char *argv[]) {
     if (argc != 7) { // id, zone, section, zc_ip, x, y
         fprintf(stderr, "Usage: %s <train_id> <zone_id> <initial_section> <zc_ip> <initial_x> <initial_y>\n", argv[0]);
         exit(EXIT_FAILURE);
@@ -361,11 +521,22 @@ int main(int argc, char *argv[]) {
     zoneControllerSocket = connectToZoneController();
     if (zoneControllerSocket == -1) {
         fprintf(stderr, "Train %d: Failed to connect to ZC. Exiting.\n", state.id);
+        eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_ERROR, state.id, state.zoneId,
+                  "Could not connect to zone controller %d", state.zoneId);
         exit(EXIT_FAILURE);
     }
     setupMovementAuthorityListener();
     setupPositionBroadcastSocket();
+    if (positionTransportShm) {
+        trainSlot = trainTableRegister(&trainTable, state.id, trainTableNextColor(&trainTable));
+        if (trainSlot < 0) {
+            fprintf(stderr, "Train %d: Train table full, using multicast positions.\n", state.id);
+        }
+    }
     broadcastPosition(); // Initial broadcast
+    notifyReady();
+    eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_INFO, state.id, state.zoneId,
+              "Registered in zone %d at S%d", state.zoneId, state.currentSection);
 
     fd_set readfds;
     struct timeval tv;
@@ -394,39 +565,38 @@ int main(int argc, char *argv[]) {
             int bytesRead = recv(zoneControllerSocket, buffer, BUFFER_SIZE - 1, 0);
             if (bytesRead <= 0) {
                 printf("Train %d: ZC disconnected. Stopping. Attempting reconnect...\n", state.id);
+                eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_WARNING, state.id, state.zoneId,
+                          "Lost zone controller %d, stopping", state.zoneId);
                 state.targetSpeed = 0; close(zoneControllerSocket); zoneControllerSocket = -1;
                 sleep(2); // Wait before reconnect attempt
                 zoneControllerSocket = connectToZoneController();
-                if(zoneControllerSocket == -1) {printf("Train %d: Reconnect failed. Exiting loop.\n", state.id); break;}
+                if(zoneControllerSocket == -1) {
+                    printf("Train %d: Reconnect failed. Exiting loop.\n", state.id);
+                    eventLogf(sharedState, LOG_COMPONENT_TRAIN, LOG_SEVERITY_ERROR, state.id, state.zoneId,
+                              "Reconnect to zone controller %d failed", state.zoneId);
+                    break;
+                }
             } else {
                 buffer[bytesRead] = '\0';
-                // printf("Train %d: TCP Msg from ZC: %s\n", state.id, buffer);
-                if (strncmp(buffer, "STATION_INFO", 12) == 0) processStationInfo(buffer);
-                else if (strncmp(buffer, "SPEED_LIMIT", 11) == 0) {
-                    int speed, section_for_limit; // ZC might specify section for speed limit
-                    if (sscanf(buffer, "SPEED_LIMIT %d %d", &section_for_limit, &speed) == 2) {
-                        if (section_for_limit == state.currentSection) { // Apply if for current section
-                           if(state.targetSpeed != speed) printf("Train %d: ZC SPEED_LIMIT %d for S%d (was %d).\n", state.id, speed, section_for_limit, state.targetSpeed);
-                           state.targetSpeed = speed;
-                        }
-                    } else if (sscanf(buffer, "SPEED_LIMIT %d", &speed) == 1) { // Generic speed limit
-                        if(state.targetSpeed != speed) printf("Train %d: ZC SPEED_LIMIT %d (was %d).\n", state.id, speed, state.targetSpeed);
-                        state.targetSpeed = speed;
-                    }
-                } else if (strncmp(buffer, "REVERSE_DIRECTION", 17) == 0) {
-                    state.direction *= -1;
-                    printf("Train %d: ZC REVERSE_DIRECTION. New dir: %d\n", state.id, state.direction);
-                } else if (strncmp(buffer, "ROUTE_TO_NORTH", 14) == 0 && state.id == 102) {
-                    printf("Train 102: ZC Commanded North route.\n");
-                    state.takingNorthRoute = 1;
-                } else if (strncmp(buffer, "UPDATE_SECTION", 14) == 0) {
-                    int new_sec;
-                    if (sscanf(buffer, "UPDATE_SECTION %d", &new_sec) == 1) {
-                        if (state.currentSection != new_sec) {
-                            printf("Train %d: ZC updated section to %d (was %d)\n", state.id, new_sec, state.currentSection);
-                            state.currentSection = new_sec;
-                        }
+                // Messages are newline-terminated; keep a partial one for the next read
+                char *line = buffer;
+                char *newline;
+                while ((newline = strchr(line, '\n')) != NULL) {
+                    *newline = '\0';
+                    if (zcPendingLength > 0) {
+                        snprintf(zcPending + zcPendingLength, BUFFER_SIZE - zcPendingLength, "%s", line);
+                        processZoneControllerMessage(zcPending);
+                        zcPendingLength = 0;
+                    } else {
+                        processZoneControllerMessage(line);
                     }
+                    line = newline + 1;
+                }
+                int rest = strlen(line);
+                if (rest > 0) {
+                    if (zcPendingLength + rest >= BUFFER_SIZE) zcPendingLength = 0; // Not a message; drop it
+                    memcpy(zcPending + zcPendingLength, line, rest + 1);
+                    zcPendingLength += rest;
                 }
             }
         }
@@ -448,5 +618,86 @@ int main(int argc, char *argv[]) {
     if (zoneControllerSocket != -1) close(zoneControllerSocket);
     if (movementAuthoritySocket != -1) close(movementAuthoritySocket);
     if (positionBroadcastSocket != -1) close(positionBroadcastSocket);
+    if (sharedState != MAP_FAILED) munmap(sharedState, sizeof(SharedState));
+    trainTableClose(&trainTable);
     return 0;
 }
+
+// fork() whose child becomes our parent's child instead of ours, so trains
+// forked by the zygote are reaped and restarted by the orchestrator. glibc
+// has no clone3 wrapper; calling it raw is fine because the zygote never
+// starts a thread.
+static pid_t forkSibling() {
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_PARENT; // The child inherits our exit signal, SIGCHLD
+    return (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+}
+
+// Zygote mode: load what trains share once, then fork a train per request
+// on controlFd until the orchestrator closes it (see cbtc_zygote.h)
+void runZygote(int controlFd) {
+    loadTrainEnvironment();
+    sharedState = sharedStateAttach();
+    attachTrainTable(); // Mapped once here and inherited by every train
+
+    pid_t self = getpid();
+    if (send(controlFd, &self, sizeof(self), MSG_NOSIGNAL) != sizeof(self)) {
+        perror("Train zygote: Failed to report ready");
+        exit(EXIT_FAILURE);
+    }
+    printf("Train zygote %d: Waiting for spawn requests.\n", self);
+
+    for (;;) {
+        ZygoteRequest request;
+        ssize_t bytesRead = recv(controlFd, &request, sizeof(request), 0);
+        if (bytesRead == 0) break; // Orchestrator is shutting down
+        if (bytesRead < 0) {
+            if (errno == EINTR) continue;
+            perror("Train zygote: recv failed");
+            break;
+        }
+
+        pid_t reply;
+        if (bytesRead != sizeof(request) || request.argc < 1 || request.argc > ZYGOTE_MAX_ARGS) {
+            reply = -EINVAL;
+        } else {
+            // Anything still buffered would be written again by the child
+            fflush(stdout);
+            fflush(stderr);
+            pid_t pid = forkSibling();
+            if (pid == 0) {
+                close(controlFd);
+                char *argv[ZYGOTE_MAX_ARGS + 1];
+                for (int i = 0; i < request.argc; i++) {
+                    request.argv[i][ZYGOTE_MAX_ARG_LENGTH - 1] = '\0';
+                    argv[i] = request.argv[i];
+                }
+                argv[request.argc] = NULL;
+
+                char name[16];
+                snprintf(name, sizeof(name), "train %s", request.argc > 1 ? argv[1] : "");
+                prctl(PR_SET_NAME, name);
+                exit(runTrain(request.argc, argv));
+            }
+            reply = pid < 0 ? -errno : pid;
+        }
+        if (send(controlFd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+            perror("Train zygote: send failed");
+            break;
+        }
+    }
+
+    printf("Train zygote %d: Exiting.\n", self);
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], ZYGOTE_FLAG) == 0) {
+        runZygote(atoi(argv[2]));
+    }
+    loadTrainEnvironment();
+    sharedState = sharedStateAttach();
+    attachTrainTable();
+    return runTrain(argc, argv);
+}
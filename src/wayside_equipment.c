@@ -3,45 +3,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h> // For errno
-#include <pthread.h> // For pthread_mutex_t if used directly (though orchestrator owns it)
+
+#include "cbtc_event_loop.h"
+#include "cbtc_ready.h"
+#include "cbtc_shm.h"
 
 #define BUFFER_SIZE 1024
 #define ZC_PORT_ENV "ZC_BASE_PORT"
 #define SHM_NAME_ENV "CBTC_SHM_NAME"
-
-// --- Copied from orchestrator for SharedState access ---
-#define MAX_TRAINS_SHM 5
-#define MAX_SIGNALS_SHM 10
-#define MAX_SWITCHES_SHM 5
-#define MAX_LOGS_SHM 20
-#define MAX_LOG_LENGTH_SHM 100
-
-typedef struct {
-    struct {
-        int id; int zoneId; int section; float x; float y; int speed;
-        int targetSpeed; int stationStopTime; int stationTimer;
-        int atStation; int direction; char color[20];
-    } trains[MAX_TRAINS_SHM];
-    int trainCount;
-    struct {
-        int id; int zoneId; int section; float x; float y; int state;
-    } signals[MAX_SIGNALS_SHM];
-    int signalCount;
-    struct {
-        int id; int zoneId; int section; float x; float y; int state;
-    } switches[MAX_SWITCHES_SHM];
-    int switchCount;
-    char logs[MAX_LOGS_SHM][MAX_LOG_LENGTH_SHM];
-    int logCount;
-    pthread_mutex_t mutex;
-} SharedState;
-// --- End of copied SharedState ---
+#define RECONNECT_INTERVAL_MS 5000
 
 typedef enum { SIGNAL_TYPE, SWITCH_TYPE } EquipmentType; // Renamed to avoid conflict
 
@@ -61,6 +36,9 @@ int zcPortBase;
 SharedState *sharedState_ptr = MAP_FAILED;
 int shmFd = -1;
 
+EventLoop eventLoop;
+int reconnectTimer = -1;
+
 void initSharedMemoryAccess() {
     const char *shmName = getenv(SHM_NAME_ENV);
     if (!shmName) {
@@ -100,26 +78,16 @@ void updateSharedMemoryState() {
         if (sharedState_ptr == MAP_FAILED) return;
     }
 
-    // It's generally safer for only one process (orchestrator) to *write* to shared memory
-    // after initialization, or to use the mutex strictly.
-    // Here, wayside updates its own state in shared memory.
-    pthread_mutex_lock(&sharedState_ptr->mutex);
+    // Wayside updates its own device slot in shared memory. Each device has a
+    // slot and sequence counter of its own, so no other writer is involved and
+    // the orchestrator's renderer never has to block us.
     if (equipment.type == SIGNAL_TYPE) {
-        for (int i = 0; i < sharedState_ptr->signalCount; ++i) {
-            if (sharedState_ptr->signals[i].id == equipment.id) {
-                sharedState_ptr->signals[i].state = equipment.currentState;
-                break;
-            }
-        }
+        int index = sharedStateFindSignal(sharedState_ptr, equipment.id);
+        if (index >= 0) sharedStateSetSignal(sharedState_ptr, index, equipment.currentState);
     } else if (equipment.type == SWITCH_TYPE) {
-        for (int i = 0; i < sharedState_ptr->switchCount; ++i) {
-            if (sharedState_ptr->switches[i].id == equipment.id) {
-                sharedState_ptr->switches[i].state = equipment.currentState;
-                break;
-            }
-        }
+        int index = sharedStateFindSwitch(sharedState_ptr, equipment.id);
+        if (index >= 0) sharedStateSetSwitch(sharedState_ptr, index, equipment.currentState);
     }
-    pthread_mutex_unlock(&sharedState_ptr->mutex);
 }
 
 void initializeEquipmentState(int id, EquipmentType type, int zoneId, int section) {
@@ -199,6 +167,9 @@ void processCommandFromZC(const char *command) {
                         printf("Wayside Signal %d: State changed to %s by ZC.\n", equipment.id,
                                new_state_val == 0 ? "RED" : (new_state_val == 1 ? "YELLOW" : "GREEN"));
                         updateSharedMemoryState();
+                        eventLogf(sharedState_ptr, LOG_COMPONENT_WAYSIDE, LOG_SEVERITY_INFO, 0, equipment.zoneId,
+                                  "Signal %d set to %s", equipment.id,
+                                  new_state_val == 0 ? "RED" : (new_state_val == 1 ? "YELLOW" : "GREEN"));
                         sprintf(statusMsg, "SIGNAL_STATUS %d %d", equipment.id, equipment.currentState);
                         if(zoneControllerSocket != -1) send(zoneControllerSocket, statusMsg, strlen(statusMsg), 0);
                     }
@@ -216,6 +187,9 @@ void processCommandFromZC(const char *command) {
                         printf("Wayside Switch %d: State changed to %s by ZC.\n", equipment.id,
                                new_state_val == 0 ? "NORMAL" : "REVERSE");
                         updateSharedMemoryState();
+                        eventLogf(sharedState_ptr, LOG_COMPONENT_WAYSIDE, LOG_SEVERITY_INFO, 0, equipment.zoneId,
+                                  "Switch %d set to %s", equipment.id,
+                                  new_state_val == 0 ? "NORMAL" : "REVERSE");
                         sprintf(statusMsg, "SWITCH_STATUS %d %d", equipment.id, equipment.currentState);
                         if(zoneControllerSocket != -1) send(zoneControllerSocket, statusMsg, strlen(statusMsg), 0);
                      }
@@ -227,6 +201,40 @@ void processCommandFromZC(const char *command) {
     }
 }
 
+void handleZoneControllerMessage(EventLoop *loop, int fd, uint32_t events, void *context) {
+    (void)events;
+    (void)context;
+    char buffer[BUFFER_SIZE];
+    int bytesRead;
+    while ((bytesRead = eventLoopReceive(fd, buffer, BUFFER_SIZE)) > 0) {
+        processCommandFromZC(buffer);
+    }
+    if (bytesRead < 0) {
+        printf("Wayside %d: ZC disconnected or error. Closing socket.\n", equipment.id);
+        eventLogf(sharedState_ptr, LOG_COMPONENT_WAYSIDE, LOG_SEVERITY_WARNING, 0, equipment.zoneId,
+                  "Equipment %d lost its zone controller", equipment.id);
+        eventLoopRemove(loop, fd);
+        close(fd); zoneControllerSocket = -1;
+        eventLoopArmTimer(reconnectTimer, RECONNECT_INTERVAL_MS, 0);
+    }
+}
+
+// Retry the zone controller until it accepts us again
+void handleReconnectTimer(EventLoop *loop, int fd, uint32_t events, void *context) {
+    (void)fd;
+    (void)events;
+    (void)context;
+    zoneControllerSocket = connectToZoneController();
+    if (zoneControllerSocket == -1 ||
+        eventLoopAdd(loop, zoneControllerSocket, EVENT_READ_EDGE, handleZoneControllerMessage, NULL) < 0) {
+        if (zoneControllerSocket != -1) { close(zoneControllerSocket); zoneControllerSocket = -1; }
+        printf("Wayside %d: Reconnect failed. Will retry...\n", equipment.id);
+        eventLoopArmTimer(reconnectTimer, RECONNECT_INTERVAL_MS, 0);
+        return;
+    }
+    printf("Wayside %d: Reconnected to ZC.\n", equipment.id);
+}
+
 int main(int argc, char *argv[]) {
     if (argc != 6) {
         fprintf(stderr, "Usage: %s <id> <type:0=signal,1=switch> <zone_id> <section> <zc_ip>\n", argv[0]);
@@ -244,49 +252,23 @@ int main(int argc, char *argv[]) {
         cleanupSharedMemoryAccess();
         exit(EXIT_FAILURE);
     }
-    
-    fd_set readfds;
-    struct timeval tv;
-    printf("Wayside %d: Entering main loop.\n", equipment.id);
-
-    while (1) {
-        FD_ZERO(&readfds);
-        if (zoneControllerSocket != -1) FD_SET(zoneControllerSocket, &readfds);
-        
-        int maxfd = zoneControllerSocket;
-        if (maxfd < 0) { // Socket closed, try to reconnect
-            sleep(5);
-            zoneControllerSocket = connectToZoneController();
-            if (zoneControllerSocket == -1) {
-                printf("Wayside %d: Reconnect failed. Will retry...\n", equipment.id);
-                continue; // Skip select if no valid socket
-            } else {
-                 printf("Wayside %d: Reconnected to ZC.\n", equipment.id);
-            }
-        }
-
-
-        tv.tv_sec = 5; tv.tv_usec = 0;
 
-        int activity = select(maxfd + 1, &readfds, NULL, NULL, &tv);
-
-        if (activity < 0 && errno != EINTR) { perror("Wayside: select error"); break; }
-
-        if (zoneControllerSocket != -1 && FD_ISSET(zoneControllerSocket, &readfds)) {
-            char buffer[BUFFER_SIZE];
-            int bytesRead = recv(zoneControllerSocket, buffer, BUFFER_SIZE - 1, 0);
-            if (bytesRead <= 0) {
-                printf("Wayside %d: ZC disconnected or error. Closing socket.\n", equipment.id);
-                close(zoneControllerSocket); zoneControllerSocket = -1;
-            } else {
-                buffer[bytesRead] = '\0';
-                processCommandFromZC(buffer);
-            }
-        }
+    if (eventLoopInit(&eventLoop) < 0 ||
+        (reconnectTimer = eventLoopAddTimer(&eventLoop, handleReconnectTimer, NULL)) < 0 ||
+        eventLoopAdd(&eventLoop, zoneControllerSocket, EVENT_READ_EDGE, handleZoneControllerMessage, NULL) < 0) {
+        perror("Wayside: event loop setup failed");
+        close(zoneControllerSocket);
+        cleanupSharedMemoryAccess();
+        exit(EXIT_FAILURE);
     }
+    notifyReady();
+    
+    printf("Wayside %d: Entering main loop.\n", equipment.id);
+    eventLoopRun(&eventLoop);
 
     printf("Wayside %d: Exiting.\n", equipment.id);
     if (zoneControllerSocket != -1) close(zoneControllerSocket);
+    eventLoopClose(&eventLoop);
     cleanupSharedMemoryAccess();
     return 0;
 }
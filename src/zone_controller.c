@@ -1,20 +1,28 @@
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
-#include <json-c/json.h>
+
+#include "cbtc_event_loop.h"
+#include "cbtc_ready.h"
+#include "cbtc_send_queue.h"
+#include "cbtc_shm.h"
+#include "cbtc_topology.h"
 
 #define BUFFER_SIZE 1024
 #define CCS_PORT 8000
 #define ZC_PORT 8100
 #define MULTICAST_PORT 8200
-#define MAX_TRAINS 20
-#define MAX_TRACK_SECTIONS 30
-#define CONFIG_FILE "track_config.json"
+#define INITIAL_TRAIN_CAPACITY 32
+#define DEFAULT_SECTION_SPEED 50
+#define FLUSH_BATCH 16 // Trains whose bulk messages are written per wakeup
 
 typedef struct {
   int id;
@@ -22,146 +30,86 @@ typedef struct {
   struct sockaddr_in address;
   int socket;
   int currentSection;
+  SendQueue queue;
+  int flushQueued; // On the bulk flush list
+  int dropping;    // Link shut down, waiting for its handler to disconnect it
 } Train;
 
+// Live state of a section in this zone; the layout itself is in the topology image
 typedef struct {
   int id;
   int speed;
+  int limit; // Configured speed limit; a reload cuts speed down to it
   int occupied;
+  char multicastGroup[20];
 } TrackSection;
 
-typedef struct {
-  int id;
-  int section;
-  int stopTime;
-  int isTerminus;
-  char name[32];
-} Station;
-
-typedef struct {
-  int id;
-  int section;
-  int normalNext;
-  int reverseNext;
-} Switch;
-
 // Global variables
-Train trains[MAX_TRAINS];
+Train *trains = NULL; // Grown as trains register; slots of departed trains are reused
 int trainCount = 0;
-TrackSection trackSections[MAX_TRACK_SECTIONS];
+int trainCapacity = 0;
+Topology topology; // Mapped read-only, shared with the other components
+TrackSection *trackSections = NULL;
 int trackSectionCount = 0;
-Station stations[10];
+const TopologyStation **stations = NULL; // This zone's stations, in the image
 int stationCount = 0;
-Switch switches[5];
 int switchCount = 0;
 int zoneId;
-char multicastGroups[MAX_TRACK_SECTIONS][20];
 int multicastSocket;
+int ccsSocket = -1;
+char ccsPending[BUFFER_SIZE]; // Partial CCS command from the last read
+int ccsPendingLength = 0;
+SharedState *sharedState = MAP_FAILED; // Orchestrator event log, if running under one
+EventLoop eventLoop;
+LatencyStats sendLatency[SEND_PRIORITIES]; // Queueing to written, all train links
+int *flushList = NULL;                     // Trains with bulk messages to write
+int flushCount = 0;
+int flushCapacity = 0;
+int flushEvent = -1;                       // eventfd, readable while flushList is not empty
 
+// Pick this zone's sections, stations and switches out of the topology image
 void loadTrackConfig() {
-  struct json_object *parsed_json;
-  struct json_object *sections;
-  struct json_object *section;
-  struct json_object *stations_arr;
-  struct json_object *station;
-  struct json_object *switches_arr;
-  struct json_object *switch_obj;
-  
-  parsed_json = json_object_from_file(CONFIG_FILE);
-  if (!parsed_json) {
-    printf("Error loading config file: %s\n", CONFIG_FILE);
+  const char *path = topologyImagePath();
+  if (topologyOpen(&topology, path) < 0) {
+    printf("Error loading topology image: %s\n", path);
     printf("Using default configuration\n");
     return;
   }
+  const TopologyHeader *header = topology.header;
   
-  // Parse track sections for this zone
-  json_object_object_get_ex(parsed_json, "track_sections", &sections);
-  int totalSections = json_object_array_length(sections);
-  
-  for (int i = 0; i < totalSections; i++) {
-    section = json_object_array_get_idx(sections, i);
-    
-    struct json_object *id, *zone;
-    
-    json_object_object_get_ex(section, "id", &id);
-    json_object_object_get_ex(section, "zone", &zone);
-    
-    int sectionId = json_object_get_int(id);
-    int sectionZone = json_object_get_int(zone);
-    
-    // Only add sections for this zone
-    if (sectionZone == zoneId) {
-      trackSections[trackSectionCount].id = sectionId;
-      trackSections[trackSectionCount].speed = 50; // Default speed
-      trackSections[trackSectionCount].occupied = 0;
-      trackSectionCount++;
-    }
+  int zoneSections = 0;
+  for (int i = 0; i < header->sectionCount; i++) {
+    if (topology.sections[i].zone == zoneId) zoneSections++;
+  }
+  trackSections = calloc(zoneSections ? zoneSections : 1, sizeof(TrackSection));
+  stations = calloc(header->stationCount ? header->stationCount : 1, sizeof(*stations));
+  if (!trackSections || !stations) {
+    perror("Zone allocation failed");
+    exit(EXIT_FAILURE);
   }
   
-  // Parse stations for this zone
-  json_object_object_get_ex(parsed_json, "stations", &stations_arr);
-  int totalStations = json_object_array_length(stations_arr);
-  
-  for (int i = 0; i < totalStations; i++) {
-    station = json_object_array_get_idx(stations_arr, i);
+  for (int i = 0; i < header->sectionCount; i++) {
+    const TopologySection *section = &topology.sections[i];
+    if (section->zone != zoneId) continue;
     
-    struct json_object *name, *section, *stop_time, *terminus;
-    
-    json_object_object_get_ex(station, "name", &name);
-    json_object_object_get_ex(station, "section", &section);
-    json_object_object_get_ex(station, "stop_time", &stop_time);
-    json_object_object_get_ex(station, "terminus", &terminus);
-    
-    int stationSection = json_object_get_int(section);
-    
-    // Check if station is in a section managed by this zone
-    for (int j = 0; j < trackSectionCount; j++) {
-      if (trackSections[j].id == stationSection) {
-        stations[stationCount].id = i + 1;
-        stations[stationCount].section = stationSection;
-        stations[stationCount].stopTime = json_object_get_int(stop_time);
-        stations[stationCount].isTerminus = json_object_get_boolean(terminus);
-        strncpy(stations[stationCount].name, json_object_get_string(name), 
-                sizeof(stations[stationCount].name) - 1);
-        stationCount++;
-        break;
-      }
-    }
+    trackSections[trackSectionCount].id = section->id;
+    trackSections[trackSectionCount].limit = section->speedLimit ? section->speedLimit : DEFAULT_SECTION_SPEED;
+    trackSections[trackSectionCount].speed = trackSections[trackSectionCount].limit;
+    trackSections[trackSectionCount].occupied = 0;
+    trackSectionCount++;
+    if (section->switchId != 0) switchCount++;
   }
   
-  // Parse switches for this zone
-  json_object_object_get_ex(parsed_json, "switches", &switches_arr);
-  int totalSwitches = json_object_array_length(switches_arr);
-  
-  for (int i = 0; i < totalSwitches; i++) {
-    switch_obj = json_object_array_get_idx(switches_arr, i);
-    
-    struct json_object *id, *section, *normal_next, *reverse_next;
-    
-    json_object_object_get_ex(switch_obj, "id", &id);
-    json_object_object_get_ex(switch_obj, "section", &section);
-    json_object_object_get_ex(switch_obj, "normal_next", &normal_next);
-    json_object_object_get_ex(switch_obj, "reverse_next", &reverse_next);
-    
-    int switchSection = json_object_get_int(section);
-    
-    // Check if switch is in a section managed by this zone
-    for (int j = 0; j < trackSectionCount; j++) {
-      if (trackSections[j].id == switchSection) {
-        switches[switchCount].id = json_object_get_int(id);
-        switches[switchCount].section = switchSection;
-        switches[switchCount].normalNext = json_object_get_int(normal_next);
-        switches[switchCount].reverseNext = json_object_get_int(reverse_next);
-        switchCount++;
-        break;
-      }
+  // Stations in config order, as trains have always received them
+  for (int i = 0; i < header->stationCount; i++) {
+    int section = topologySectionIndex(&topology, topology.stations[i].section);
+    if (section != TOPOLOGY_NONE && topology.sections[section].zone == zoneId) {
+      stations[stationCount++] = &topology.stations[i];
     }
   }
   
   printf("Zone %d loaded configuration: %d sections, %d stations, %d switches\n",
          zoneId, trackSectionCount, stationCount, switchCount);
-  
-  json_object_put(parsed_json); // Free memory
 }
 
 void initializeZoneController(int id) {
@@ -173,7 +121,7 @@ void initializeZoneController(int id) {
 
   // Create multicast group addresses for each track section
   for (int i = 0; i < trackSectionCount; i++) {
-    sprintf(multicastGroups[i], "239.0.%d.%d", zoneId, trackSections[i].id);
+    sprintf(trackSections[i].multicastGroup, "239.0.%d.%d", zoneId, trackSections[i].id);
   }
 }
 
@@ -216,7 +164,7 @@ void broadcastMovementAuthority(int trackSection, int speed) {
   for (int i = 0; i < trackSectionCount; i++) {
     if (trackSections[i].id == trackSection) {
       trackSections[i].speed = speed;
-      multicastGroup = multicastGroups[i];
+      multicastGroup = trackSections[i].multicastGroup;
       break;
     }
   }
@@ -244,18 +192,82 @@ void broadcastMovementAuthority(int trackSection, int speed) {
   }
 }
 
-void setSwitch(int switchId, int position) {
-  char command[BUFFER_SIZE];
-  sprintf(command, "SET_SWITCH %d %d", switchId, position);
-  
-  // Send to all connected train components (in a real system, would send to specific wayside equipment)
+// Give up on a train link that has failed or stopped reading. The socket
+// stays open until its handler sees the hangup and disconnects the train.
+void dropTrainLink(int index) {
+  if (trains[index].dropping) return;
+  trains[index].dropping = 1;
+  printf("Train %d is not taking its messages, dropping its link\n", trains[index].id);
+  eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_WARNING, trains[index].id, zoneId,
+            "Train %d link dropped, %zu bytes unsent", trains[index].id, trains[index].queue.queuedBytes);
+  shutdown(trains[index].socket, SHUT_RDWR);
+}
+
+void scheduleFlush(int index) {
+  if (trains[index].flushQueued) return;
+  if (flushCount == flushCapacity) {
+    int capacity = flushCapacity ? flushCapacity * 2 : INITIAL_TRAIN_CAPACITY;
+    int *grown = realloc(flushList, capacity * sizeof(int));
+    if (!grown) {
+      dropTrainLink(index);
+      return;
+    }
+    flushList = grown;
+    flushCapacity = capacity;
+  }
+  if (flushCount == 0) {
+    uint64_t one = 1;
+    if (write(flushEvent, &one, sizeof(one)) < 0) perror("Scheduling flush failed");
+  }
+  flushList[flushCount++] = index;
+  trains[index].flushQueued = 1;
+}
+
+// Queue a message for a train. Safety and control messages are written at
+// once, ahead of any bulk messages still queued. Bulk messages are written
+// by handleFlush a few trains at a time, so a station table push to every
+// train does not hold up a CCS command that arrives meanwhile.
+void queueToTrainAt(int index, SendPriority priority, const char *message, size_t length,
+                    unsigned long long queuedNs) {
+  Train *train = &trains[index];
+  if (!train->connected || train->dropping) return;
+  if (sendQueuePush(&train->queue, priority, message, length, queuedNs) < 0) {
+    dropTrainLink(index);
+  } else if (priority == SEND_PRIORITY_BULK) {
+    scheduleFlush(index);
+  } else if (sendQueueFlush(&train->queue, train->socket, priority) < 0) {
+    dropTrainLink(index);
+  }
+}
+
+void queueToTrain(int index, SendPriority priority, const char *message) {
+  queueToTrainAt(index, priority, message, strlen(message), monotonicNs());
+}
+
+// Send every connected train the same message
+int sendToTrains(SendPriority priority, const char *message) {
+  size_t length = strlen(message);
+  unsigned long long now = monotonicNs();
+  int sent = 0;
   for (int i = 0; i < trainCount; i++) {
     if (trains[i].connected) {
-      send(trains[i].socket, command, strlen(command), 0);
+      queueToTrainAt(i, priority, message, length, now);
+      sent++;
     }
   }
+  return sent;
+}
+
+void setSwitch(int switchId, int position) {
+  char command[BUFFER_SIZE];
+  sprintf(command, "SET_SWITCH %d %d\n", switchId, position);
+  
+  // Send to all connected train components (in a real system, would send to specific wayside equipment)
+  sendToTrains(SEND_PRIORITY_CONTROL, command);
   
   printf("Set switch %d to position %d\n", switchId, position);
+  eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_INFO, 0, zoneId,
+            "Switch %d set to %s", switchId, position ? "REVERSE" : "NORMAL");
 }
 
 // Route train to destination
@@ -271,13 +283,13 @@ void routeTrain(int trainId, int destinationSection) {
     }
   }
   
+  // Zones the route only passes through just grant authority along it
   if (!inThisZone) {
-    printf("Destination section %d not in zone %d\n", destinationSection, zoneId);
-    return;
+    printf("Train %d passes through zone %d toward section %d\n", trainId, zoneId, destinationSection);
   }
   
   // Check if destination is North station (section 23)
-  if (destinationSection == 23) {
+  if (inThisZone && destinationSection == 23) {
     // Set switch 1 to REVERSE
     setSwitch(1, 1);
     
@@ -285,13 +297,15 @@ void routeTrain(int trainId, int destinationSection) {
     for (int i = 0; i < trainCount; i++) {
       if (trains[i].id == trainId && trains[i].connected) {
         char routeMsg[BUFFER_SIZE];
-        sprintf(routeMsg, "ROUTE_TO %d", destinationSection);
-        send(trains[i].socket, routeMsg, strlen(routeMsg), 0);
+        sprintf(routeMsg, "ROUTE_TO %d\n", destinationSection);
+        queueToTrain(i, SEND_PRIORITY_CONTROL, routeMsg);
         break;
       }
     }
     
     printf("Set northbound route for train %d\n", trainId);
+    eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_INFO, trainId, zoneId,
+              "Northbound route set to S%d", destinationSection);
   }
   
   // Ensure routes have proper authority
@@ -300,113 +314,222 @@ void routeTrain(int trainId, int destinationSection) {
   }
 }
 
-void handleTrainConnection(int serverSocket) {
-  struct sockaddr_in clientAddr;
-  socklen_t addrLen = sizeof(clientAddr);
-  int clientSocket =
-      accept(serverSocket, (struct sockaddr *)&clientAddr, &addrLen);
+// Tell the CCS where a train is so it can route it
+void reportTrainSection(int trainId, int section) {
+  if (ccsSocket == -1) return;
+  char report[BUFFER_SIZE];
+  sprintf(report, "TRAIN_SECTION %d %d\n", trainId, section);
+  send(ccsSocket, report, strlen(report), 0);
+}
 
-  if (clientSocket < 0) {
-    perror("Accept failed");
-    return;
+// Find a slot for a registering train, growing the table if every slot is live
+int allocateTrainSlot() {
+  for (int i = 0; i < trainCount; i++) {
+    if (!trains[i].connected) return i;
   }
-
-  char buffer[BUFFER_SIZE];
-  int bytesRead = recv(clientSocket, buffer, BUFFER_SIZE, 0);
-  if (bytesRead <= 0) {
-    close(clientSocket);
-    return;
+  if (trainCount == trainCapacity) {
+    int capacity = trainCapacity ? trainCapacity * 2 : INITIAL_TRAIN_CAPACITY;
+    Train *grown = realloc(trains, capacity * sizeof(Train));
+    if (!grown) return -1;
+    trains = grown;
+    trainCapacity = capacity;
   }
+  return trainCount++;
+}
+
+void handleTrainMessage(EventLoop *loop, int fd, uint32_t events, void *context);
+void handleDeviceMessage(EventLoop *loop, int fd, uint32_t events, void *context);
+
+// Trains add or update a station by id
+void formatStationInfo(char *stationMsg, const TopologyStation *station) {
+  sprintf(stationMsg, "STATION_INFO %d %d %d %d %s\n",
+          station->id, station->section, station->stopTime,
+          station->isTerminus, station->name);
+}
+
+// Handle the first message on a new connection: a train or wayside device
+// registering. Returns the handler for the rest of the connection, or NULL if
+// the connection was refused.
+EventHandler registerConnection(int clientSocket, char *buffer) {
+  struct sockaddr_in clientAddr;
+  socklen_t addrLen = sizeof(clientAddr);
+  memset(&clientAddr, 0, sizeof(clientAddr));
+  getpeername(clientSocket, (struct sockaddr *)&clientAddr, &addrLen);
 
   // Parse train registration
   int trainId, section;
   if (sscanf(buffer, "REGISTER_TRAIN %d %d", &trainId, &section) == 2) {
-    if (trainCount < MAX_TRAINS) {
-      trains[trainCount].id = trainId;
-      trains[trainCount].connected = 1;
-      trains[trainCount].address = clientAddr;
-      trains[trainCount].socket = clientSocket;
-      trains[trainCount].currentSection = section;
-      trainCount++;
-
-      // Mark section as occupied
-      for (int i = 0; i < trackSectionCount; i++) {
-        if (trackSections[i].id == section) {
-          trackSections[i].occupied = 1;
-          break;
-        }
+    int index = allocateTrainSlot();
+    if (index < 0) {
+      printf("No memory to register train %d\n", trainId);
+      return NULL;
+    }
+    trains[index].id = trainId;
+    trains[index].connected = 1;
+    trains[index].address = clientAddr;
+    trains[index].socket = clientSocket;
+    trains[index].currentSection = section;
+    trains[index].flushQueued = 0;
+    trains[index].dropping = 0;
+    sendQueueInit(&trains[index].queue, sendLatency);
+    sendQueueConfigureSocket(clientSocket);
+    eventLoopSetHandler(&eventLoop, clientSocket, handleTrainMessage, (void *)(intptr_t)index);
+
+    // Mark section as occupied
+    for (int i = 0; i < trackSectionCount; i++) {
+      if (trackSections[i].id == section) {
+        trackSections[i].occupied = 1;
+        break;
       }
+    }
 
-      char response[BUFFER_SIZE];
-      sprintf(response, "TRAIN_REGISTERED %d", trainId);
-      send(clientSocket, response, strlen(response), 0);
+    char response[BUFFER_SIZE];
+    sprintf(response, "TRAIN_REGISTERED %d\n", trainId);
+    queueToTrain(index, SEND_PRIORITY_CONTROL, response);
 
-      printf("Train %d registered in section %d\n", trainId, section);
-      
-      // Send station information for this zone
-      for (int i = 0; i < stationCount; i++) {
-        char stationMsg[BUFFER_SIZE];
-        sprintf(stationMsg, "STATION_INFO %d %d %d %d %s", 
-                stations[i].id, stations[i].section, stations[i].stopTime,
-                stations[i].isTerminus, stations[i].name);
-        send(clientSocket, stationMsg, strlen(stationMsg), 0);
-      }
-      
-      // Send initial speed limit
-      int speedLimit = 50; // Default
-      for (int i = 0; i < trackSectionCount; i++) {
-        if (trackSections[i].id == section) {
-          speedLimit = trackSections[i].speed;
-          break;
-        }
+    printf("Train %d registered in section %d\n", trainId, section);
+    eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_INFO, trainId, zoneId,
+              "Train %d registered in S%d", trainId, section);
+    reportTrainSection(trainId, section);
+    
+    // Send station information for this zone
+    for (int i = 0; i < stationCount; i++) {
+      char stationMsg[BUFFER_SIZE];
+      formatStationInfo(stationMsg, stations[i]);
+      queueToTrain(index, SEND_PRIORITY_BULK, stationMsg);
+    }
+    
+    // Send initial speed limit
+    int speedLimit = 50; // Default
+    for (int i = 0; i < trackSectionCount; i++) {
+      if (trackSections[i].id == section) {
+        speedLimit = trackSections[i].speed;
+        break;
       }
-      
-      char speedMsg[BUFFER_SIZE];
-      sprintf(speedMsg, "SPEED_LIMIT %d", speedLimit);
-      send(clientSocket, speedMsg, strlen(speedMsg), 0);
-      
-      // Broadcast movement authority for this section
-      broadcastMovementAuthority(section, speedLimit);
     }
+    
+    char speedMsg[BUFFER_SIZE];
+    sprintf(speedMsg, "SPEED_LIMIT %d\n", speedLimit);
+    queueToTrain(index, SEND_PRIORITY_SAFETY, speedMsg);
+    
+    // Broadcast movement authority for this section
+    broadcastMovementAuthority(section, speedLimit);
+    return handleTrainMessage;
   } else if (sscanf(buffer, "REGISTER_SIGNAL %d %d", &trainId, &section) == 2) {
     // Handle signal registration
     char response[BUFFER_SIZE];
     sprintf(response, "SIGNAL_REGISTERED %d", trainId);
     send(clientSocket, response, strlen(response), 0);
     printf("Signal %d registered in section %d\n", trainId, section);
+    eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_INFO, 0, zoneId,
+              "Signal %d registered in S%d", trainId, section);
+    eventLoopSetHandler(&eventLoop, clientSocket, handleDeviceMessage, NULL);
+    return handleDeviceMessage;
   } else if (sscanf(buffer, "REGISTER_SWITCH %d %d", &trainId, &section) == 2) {
     // Handle switch registration
     char response[BUFFER_SIZE];
     sprintf(response, "SWITCH_REGISTERED %d", trainId);
     send(clientSocket, response, strlen(response), 0);
     printf("Switch %d registered in section %d\n", trainId, section);
+    eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_INFO, 0, zoneId,
+              "Switch %d registered in S%d", trainId, section);
+    eventLoopSetHandler(&eventLoop, clientSocket, handleDeviceMessage, NULL);
+    return handleDeviceMessage;
+  }
+
+  printf("Unknown registration: %s\n", buffer);
+  return NULL;
+}
+
+void closeConnection(EventLoop *loop, int fd) {
+  eventLoopRemove(loop, fd);
+  close(fd);
+}
+
+// First data on an accepted connection
+void handleNewConnection(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)context;
+  char buffer[BUFFER_SIZE];
+  int bytesRead = eventLoopReceive(fd, buffer, BUFFER_SIZE);
+  if (bytesRead == 0) return;
+  if (bytesRead < 0) {
+    closeConnection(loop, fd);
+    return;
   }
+
+  EventHandler handler = registerConnection(fd, buffer);
+  if (!handler) {
+    closeConnection(loop, fd);
+    return;
+  }
+  // Edge-triggered: drain whatever followed the registration
+  handler(loop, fd, events, loop->watches[fd].context);
+}
+
+// Accept every pending connection; each registers with its first message
+void handleListener(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  while (1) {
+    int clientSocket = accept(fd, NULL, NULL);
+    if (clientSocket < 0) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Accept failed");
+      return;
+    }
+    if (eventLoopAdd(loop, clientSocket, EVENT_READ_WRITE_EDGE, handleNewConnection, NULL) < 0) {
+      perror("Watching connection failed");
+      close(clientSocket);
+    }
+  }
+}
+
+void disconnectTrain(EventLoop *loop, int index) {
+  closeConnection(loop, trains[index].socket);
+  trains[index].connected = 0;
+  sendQueueFree(&trains[index].queue);
+  printf("Train %d disconnected\n", trains[index].id);
+  eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_WARNING, trains[index].id,
+            zoneId, "Train %d disconnected in S%d", trains[index].id, trains[index].currentSection);
+  
+  // Clear the track section
+  for (int i = 0; i < trackSectionCount; i++) {
+    if (trackSections[i].id == trains[index].currentSection) {
+      trackSections[i].occupied = 0;
+      break;
+    }
+  }
+}
+
+void moveTrain(int trainIndex, int newSection) {
+  int oldSection = trains[trainIndex].currentSection;
+  
+  // Update occupancy
+  for (int i = 0; i < trackSectionCount; i++) {
+    if (trackSections[i].id == oldSection) {
+      trackSections[i].occupied = 0;
+      break;
+    }
+  }
+  
+  for (int i = 0; i < trackSectionCount; i++) {
+    if (trackSections[i].id == newSection) {
+      trackSections[i].occupied = 1;
+      break;
+    }
+  }
+  
+  trains[trainIndex].currentSection = newSection;
+  printf("Train %d moved from section %d to %d\n", trains[trainIndex].id, oldSection,
+         newSection);
+  reportTrainSection(trains[trainIndex].id, newSection);
 }
 
 void processTrainUpdate(int trainIndex, char *message) {
   int trainId, newSection;
   if (sscanf(message, "POSITION_UPDATE %d %d", &trainId, &newSection) == 2) {
     if (trains[trainIndex].id == trainId) {
-      int oldSection = trains[trainIndex].currentSection;
-      
-      // Update occupancy
-      for (int i = 0; i < trackSectionCount; i++) {
-        if (trackSections[i].id == oldSection) {
-          trackSections[i].occupied = 0;
-          break;
-        }
-      }
-      
-      for (int i = 0; i < trackSectionCount; i++) {
-        if (trackSections[i].id == newSection) {
-          trackSections[i].occupied = 1;
-          break;
-        }
-      }
-      
-      trains[trainIndex].currentSection = newSection;
-      printf("Train %d moved from section %d to %d\n", trainId, oldSection,
-             newSection);
+      moveTrain(trainIndex, newSection);
       
       // Send current speed limit to the train
       int speedLimit = 50; // Default
@@ -418,9 +541,385 @@ void processTrainUpdate(int trainIndex, char *message) {
       }
       
       char response[BUFFER_SIZE];
-      sprintf(response, "SPEED_LIMIT %d", speedLimit);
-      send(trains[trainIndex].socket, response, strlen(response), 0);
+      sprintf(response, "SPEED_LIMIT %d\n", speedLimit);
+      queueToTrain(trainIndex, SEND_PRIORITY_SAFETY, response);
+    }
+  } else if (sscanf(message, "CURRENT_POS_SECTION %d %d", &trainId, &newSection) == 2) {
+    // Periodic report of the section the train believes it is in
+    if (trains[trainIndex].id == trainId && trains[trainIndex].currentSection != newSection) {
+      moveTrain(trainIndex, newSection);
+    }
+  }
+}
+
+void handleTrainMessage(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)fd;
+  int index = (int)(intptr_t)context;
+  // Room again on a link that filled up: write what is left, bulk included
+  if ((events & EPOLLOUT) && trains[index].queue.queuedBytes > 0 &&
+      sendQueueFlush(&trains[index].queue, trains[index].socket, SEND_PRIORITY_BULK) < 0) {
+    dropTrainLink(index);
+  }
+  char buffer[BUFFER_SIZE];
+  int bytesRead;
+  while ((bytesRead = eventLoopReceive(trains[index].socket, buffer, BUFFER_SIZE)) > 0) {
+    processTrainUpdate(index, buffer);
+  }
+  if (bytesRead < 0) disconnectTrain(loop, index);
+}
+
+// Status reports from wayside devices
+void handleDeviceMessage(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  char buffer[BUFFER_SIZE];
+  int bytesRead;
+  while ((bytesRead = eventLoopReceive(fd, buffer, BUFFER_SIZE)) > 0) {
+    printf("Message from wayside: %s\n", buffer);
+  }
+  if (bytesRead < 0) closeConnection(loop, fd);
+}
+
+// Write queued bulk messages for the next few trains on the flush list. The
+// eventfd stays readable until the list is empty, so the loop comes back
+// here after serving whatever else is ready.
+void handleFlush(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)loop;
+  (void)events;
+  (void)context;
+  int batch = flushCount < FLUSH_BATCH ? flushCount : FLUSH_BATCH;
+  for (int i = 0; i < batch; i++) {
+    Train *train = &trains[flushList[i]];
+    train->flushQueued = 0;
+    if (!train->connected || train->dropping) continue;
+    if (sendQueueFlush(&train->queue, train->socket, SEND_PRIORITY_BULK) < 0) dropTrainLink(flushList[i]);
+  }
+  flushCount -= batch;
+  memmove(flushList, flushList + batch, flushCount * sizeof(int));
+  if (flushCount == 0) {
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN) perror("Reading flush event failed");
+  }
+}
+
+// A new movement authority for a section: multicast it, and tell the trains
+// in the section over their own links, where it overtakes queued bulk traffic
+void applyMovementAuthority(int trackSection, int speed) {
+  broadcastMovementAuthority(trackSection, speed);
+  char message[BUFFER_SIZE];
+  int length = sprintf(message, "SPEED_LIMIT %d %d\n", trackSection, speed);
+  unsigned long long now = monotonicNs();
+  for (int i = 0; i < trainCount; i++) {
+    if (trains[i].connected && trains[i].currentSection == trackSection) {
+      queueToTrainAt(i, SEND_PRIORITY_SAFETY, message, length, now);
+    }
+  }
+}
+
+// Stop every train in the zone at once and withdraw authority on all of
+// its sections until the CCS issues new movement authority
+void emergencyStop() {
+  int stopped = sendToTrains(SEND_PRIORITY_SAFETY, "EMERGENCY_STOP\n");
+  for (int i = 0; i < trackSectionCount; i++) {
+    broadcastMovementAuthority(trackSections[i].id, 0);
+  }
+  printf("Emergency stop: %d trains stopped in zone %d\n", stopped, zoneId);
+  eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_ERROR, 0, zoneId,
+            "Emergency stop, %d trains", stopped);
+}
+
+void processCcsCommand(const char *buffer) {
+  printf("Message from CCS: %s\n", buffer);
+
+  int trackSection, speed, trainId, destinationSection;
+  if (sscanf(buffer, "MOVEMENT_AUTHORITY %d %d", &trackSection, &speed) == 2) {
+    applyMovementAuthority(trackSection, speed);
+  }
+
+  if (strncmp(buffer, "EMERGENCY_STOP", 14) == 0) {
+    emergencyStop();
+  }
+
+  if (sscanf(buffer, "ROUTE_TRAIN %d %d", &trainId, &destinationSection) == 2) {
+    routeTrain(trainId, destinationSection);
+  }
+
+  if (sscanf(buffer, "TRAIN_SPEED %d %d", &trainId, &speed) == 2) {
+    // Find the train and send speed command
+    for (int i = 0; i < trainCount; i++) {
+      if (trains[i].connected && trains[i].id == trainId) {
+        char speedCmd[BUFFER_SIZE];
+        sprintf(speedCmd, "SPEED_LIMIT %d\n", speed);
+        queueToTrain(i, SEND_PRIORITY_SAFETY, speedCmd);
+        printf("Sent speed %d to Train %d\n", speed, trainId);
+        break;
+      }
+    }
+  }
+}
+
+void handleCcsMessage(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  char buffer[BUFFER_SIZE];
+  int bytesRead;
+  while ((bytesRead = eventLoopReceive(fd, buffer, BUFFER_SIZE)) > 0) {
+    // CCS commands are newline-terminated; keep a partial line for the next read
+    char *line = buffer;
+    char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+      *newline = '\0';
+      if (ccsPendingLength > 0) {
+        snprintf(ccsPending + ccsPendingLength, BUFFER_SIZE - ccsPendingLength, "%s", line);
+        processCcsCommand(ccsPending);
+        ccsPendingLength = 0;
+      } else {
+        processCcsCommand(line);
+      }
+      line = newline + 1;
+    }
+    int rest = strlen(line);
+    if (rest > 0) {
+      if (ccsPendingLength + rest >= BUFFER_SIZE) ccsPendingLength = 0; // Not a command; drop it
+      memcpy(ccsPending + ccsPendingLength, line, rest + 1);
+      ccsPendingLength += rest;
+    }
+  }
+  if (bytesRead < 0) {
+    printf("CCS disconnected. Exiting...\n");
+    eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_ERROR, 0, zoneId,
+              "Lost central control, exiting");
+    eventLoopStop(loop);
+  }
+}
+
+// Apply a rewritten topology image to this zone. The new section and
+// station tables are built beside the live ones and swapped in between two
+// events, so handlers never see a half-applied layout and nothing waits on
+// a lock. Connected trains are sent only the stations that changed and the
+// sections whose speed a lower limit cut, over their existing connections.
+void reloadTopology() {
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  Topology next;
+  if (topologyOpen(&next, topologyImagePath()) < 0) {
+    printf("Zone %d keeps its topology, %s could not be loaded\n", zoneId, topologyImagePath());
+    return;
+  }
+  TopologyDiff diff;
+  topologyDiff(&topology, &next, &diff);
+  if (topologyDiffEmpty(&diff)) {
+    topologyClose(&next);
+    return;
+  }
+
+  int count = 0;
+  for (int i = 0; i < next.header->sectionCount; i++) {
+    if (next.sections[i].zone == zoneId) count++;
+  }
+  int oldMaxId = topology.header ? topology.header->maxSectionId : -1;
+  TrackSection *sections = calloc(count ? count : 1, sizeof(TrackSection));
+  unsigned char *speedChanged = calloc(count ? count : 1, 1);
+  int *oldIndex = malloc((oldMaxId + 1 > 0 ? oldMaxId + 1 : 1) * sizeof(int));
+  const TopologyStation **zoneStations = calloc(next.header->stationCount ? next.header->stationCount : 1,
+                                                sizeof(*zoneStations));
+  if (!sections || !speedChanged || !oldIndex || !zoneStations) {
+    printf("Zone %d keeps its topology, out of memory\n", zoneId);
+    free(sections);
+    free(speedChanged);
+    free(oldIndex);
+    free(zoneStations);
+    topologyClose(&next);
+    return;
+  }
+
+  // This zone's sections, carrying live state over by id
+  for (int id = 0; id <= oldMaxId; id++) oldIndex[id] = -1;
+  for (int i = 0; i < trackSectionCount; i++) oldIndex[trackSections[i].id] = i;
+  int newCount = 0, kept = 0, switches = 0;
+  for (int i = 0; i < next.header->sectionCount; i++) {
+    const TopologySection *section = &next.sections[i];
+    if (section->zone != zoneId) continue;
+    TrackSection *out = &sections[newCount];
+    int limit = section->speedLimit ? section->speedLimit : DEFAULT_SECTION_SPEED;
+    int old = section->id <= oldMaxId ? oldIndex[section->id] : -1;
+    if (old >= 0) {
+      *out = trackSections[old];
+      kept++;
+    } else {
+      out->id = section->id;
+      for (int t = 0; t < trainCount; t++) {
+        if (trains[t].connected && trains[t].currentSection == section->id) out->occupied = 1;
+      }
+      sprintf(out->multicastGroup, "239.0.%d.%d", zoneId, section->id);
+    }
+    // A reload only ever lowers live authority: a kept section keeps its
+    // speed under the new limit, so a stopped section stays stopped, and a
+    // raised limit waits for the next movement authority to be used
+    if (old < 0) {
+      out->limit = limit;
+      out->speed = limit;
+      speedChanged[newCount] = 1;
+    } else if (out->limit != limit) {
+      out->limit = limit;
+      if (out->speed > limit) {
+        out->speed = limit;
+        speedChanged[newCount] = 1;
+      }
+    }
+    if (section->switchId != 0) switches++;
+    newCount++;
+  }
+  int newStationCount = 0;
+  for (int i = 0; i < next.header->stationCount; i++) {
+    const TopologySection *section = topologySection(&next, next.stations[i].section);
+    if (section && section->zone == zoneId) zoneStations[newStationCount++] = &next.stations[i];
+  }
+
+  // Swap; the old tables stay readable until the trains have been told
+  TrackSection *oldSections = trackSections;
+  int oldSectionCount = trackSectionCount;
+  const TopologyStation **oldStations = stations;
+  int oldStationCount = stationCount;
+  Topology old = topology;
+  topology = next;
+  trackSections = sections;
+  trackSectionCount = newCount;
+  stations = zoneStations;
+  stationCount = newStationCount;
+  switchCount = switches;
+
+  int messages = 0;
+  for (int i = 0; i < newStationCount; i++) {
+    const TopologyStation *before = NULL;
+    for (int j = 0; j < oldStationCount && !before; j++) {
+      if (oldStations[j]->id == zoneStations[i]->id) before = oldStations[j];
+    }
+    if (before && topologyStationsEqual(before, zoneStations[i])) continue;
+    char message[BUFFER_SIZE];
+    formatStationInfo(message, zoneStations[i]);
+    messages += sendToTrains(SEND_PRIORITY_BULK, message);
+  }
+  for (int j = 0; j < oldStationCount; j++) {
+    int present = 0;
+    for (int i = 0; i < newStationCount && !present; i++) {
+      present = zoneStations[i]->id == oldStations[j]->id;
+    }
+    if (present) continue;
+    char message[BUFFER_SIZE];
+    sprintf(message, "STATION_REMOVED %d\n", oldStations[j]->id);
+    messages += sendToTrains(SEND_PRIORITY_BULK, message);
+  }
+  for (int i = 0; i < newCount; i++) {
+    if (!speedChanged[i] || sections[i].speed == 0) continue;
+    broadcastMovementAuthority(sections[i].id, sections[i].speed);
+    for (int t = 0; t < trainCount; t++) {
+      if (!trains[t].connected || trains[t].currentSection != sections[i].id) continue;
+      char message[BUFFER_SIZE];
+      sprintf(message, "SPEED_LIMIT %d %d\n", sections[i].id, sections[i].speed);
+      queueToTrain(t, SEND_PRIORITY_SAFETY, message);
+      messages++;
+    }
+  }
+
+  free(oldSections);
+  free(oldStations);
+  free(speedChanged);
+  free(oldIndex);
+  topologyClose(&old);
+
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  double elapsedMs = (finished.tv_sec - started.tv_sec) * 1e3 + (finished.tv_nsec - started.tv_nsec) / 1e6;
+  char summary[160];
+  topologyDiffFormat(&diff, summary, sizeof(summary));
+  printf("Zone %d applied topology change in %.2f ms: %s; zone has %d sections (%d kept, %d removed), "
+         "%d messages to trains\n", zoneId, elapsedMs, summary, newCount, kept, oldSectionCount - kept, messages);
+  eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_INFO, 0, zoneId,
+            "Topology reloaded in %.1f ms, %d sections", elapsedMs, newCount);
+  // Switch positions are commanded by route, not from the image, and wayside
+  // switches keep the sections they were launched with
+  if (diff.switchesChanged) {
+    printf("Zone %d: %d switch changes take effect when the system restarts\n", zoneId, diff.switchesChanged);
+    eventLogf(sharedState, LOG_COMPONENT_ZONE_CONTROLLER, LOG_SEVERITY_WARNING, 0, zoneId,
+              "%d switch changes need a restart", diff.switchesChanged);
+  }
+}
+
+void handleTopologyChange(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)loop;
+  (void)events;
+  (void)context;
+  if (topologyWatchChanged(fd, topologyImagePath())) reloadTopology();
+}
+
+// Manual commands, one line per wakeup; stdin is level-triggered
+void handleUserCommand(EventLoop *loop, int fd, uint32_t events, void *context) {
+  (void)events;
+  (void)context;
+  char command[BUFFER_SIZE];
+  if (fgets(command, BUFFER_SIZE, stdin) == NULL) {
+    eventLoopRemove(loop, fd); // End of input; stop polling it
+    return;
+  }
+
+  int trackSection, speed;
+  if (sscanf(command, "ma %d %d", &trackSection, &speed) == 2) {
+    applyMovementAuthority(trackSection, speed);
+  } else if (strncmp(command, "estop", 5) == 0) {
+    emergencyStop();
+  } else if (strncmp(command, "queues", 6) == 0) {
+    int backlogged = 0;
+    size_t queued = 0;
+    for (int i = 0; i < trainCount; i++) {
+      if (!trains[i].connected || trains[i].queue.queuedBytes == 0) continue;
+      backlogged++;
+      queued += trains[i].queue.queuedBytes;
+    }
+    printf("Train links: %d backlogged, %zu bytes queued, %d waiting for a bulk flush\n",
+           backlogged, queued, flushCount);
+    for (int priority = 0; priority < SEND_PRIORITIES; priority++) {
+      printLatency(sendPriorityNames[priority], &sendLatency[priority]);
+    }
+  } else if (strncmp(command, "status", 6) == 0) {
+    printf("Track Sections Status:\n");
+    for (int i = 0; i < trackSectionCount; i++) {
+      printf("Section %d: Speed %d, %s\n", trackSections[i].id,
+             trackSections[i].speed,
+             trackSections[i].occupied ? "Occupied" : "Clear");
+    }
+  } else if (strncmp(command, "trains", 6) == 0) {
+    printf("Connected Trains:\n");
+    for (int i = 0; i < trainCount; i++) {
+      if (trains[i].connected) {
+        printf("Train %d in section %d\n", trains[i].id,
+               trains[i].currentSection);
+      }
     }
+  } else if (strncmp(command, "route_north", 11) == 0) {
+    // Set switches for northbound route
+    setSwitch(1, 1); // Set switch 1 to REVERSE
+    printf("Setting northbound route\n");
+    
+    // Find Train 102 and direct it
+    for (int i = 0; i < trainCount; i++) {
+      if (trains[i].connected && trains[i].id == 102) {
+        char routeMsg[BUFFER_SIZE];
+        sprintf(routeMsg, "TAKE_NORTH_ROUTE\n");
+        queueToTrain(i, SEND_PRIORITY_CONTROL, routeMsg);
+        break;
+      }
+    }
+  } else if (strncmp(command, "quit", 4) == 0) {
+    eventLoopStop(loop);
+  }
+}
+
+// Let a zone with thousands of trains hold a socket for each
+void raiseFileLimit() {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
   }
 }
 
@@ -454,11 +953,17 @@ int connectToCCS(const char *ccsIP) {
   sprintf(registerMsg, "REGISTER_ZONE %d", zoneId);
   send(ccsSocket, registerMsg, strlen(registerMsg), 0);
 
-  // Wait for confirmation
+  // Wait for confirmation. Take only its line: commands may follow at once.
   char buffer[BUFFER_SIZE];
-  int bytesRead = recv(ccsSocket, buffer, BUFFER_SIZE, 0);
+  int bytesRead = recv(ccsSocket, buffer, BUFFER_SIZE - 1, MSG_PEEK);
+  if (bytesRead > 0) {
+    buffer[bytesRead] = '\0';
+    char *newline = strchr(buffer, '\n');
+    bytesRead = recv(ccsSocket, buffer, newline ? newline - buffer + 1 : bytesRead, 0);
+  }
   if (bytesRead > 0) {
     buffer[bytesRead] = '\0';
+    buffer[strcspn(buffer, "\n")] = '\0';
     printf("CCS response: %s\n", buffer);
   }
 
@@ -472,11 +977,13 @@ int main(int argc, char *argv[]) {
   }
 
   int id = atoi(argv[1]);
+  raiseFileLimit();
   initializeZoneController(id);
+  sharedState = sharedStateAttach();
   setupMulticastSocket();
 
   // Connect to Central Control System
-  int ccsSocket;
+  ccsSocket = connectToCCS(argv[2]);
 
 	// Create TCP server socket for train connections
 	int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
@@ -503,7 +1010,8 @@ int main(int argc, char *argv[]) {
 		exit(EXIT_FAILURE);
 	}
 
-	if (listen(serverSocket, 10) < 0) {
+	// Trains and wayside devices of a wave all connect at once
+	if (listen(serverSocket, SOMAXCONN) < 0) {
 		perror("Listen failed");
 		exit(EXIT_FAILURE);
 	}
@@ -511,147 +1019,52 @@ int main(int argc, char *argv[]) {
 	printf("Zone Controller %d online. Listening on port %d\n", zoneId,
 				 ZC_PORT + zoneId);
 
-	fd_set readfds;
-	struct timeval tv;
-	int maxfd;
-
-	while (1) {
-		FD_ZERO(&readfds);
-		FD_SET(serverSocket, &readfds);
-		FD_SET(ccsSocket, &readfds);
-		FD_SET(STDIN_FILENO, &readfds); // Add stdin for manual commands
-
-		maxfd = serverSocket > ccsSocket ? serverSocket : ccsSocket;
-
-		// Add all train sockets
-		for (int i = 0; i < trainCount; i++) {
-			if (trains[i].connected) {
-				FD_SET(trains[i].socket, &readfds);
-				if (trains[i].socket > maxfd)
-					maxfd = trains[i].socket;
-			}
-		}
-
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
-
-		int activity = select(maxfd + 1, &readfds, NULL, NULL, &tv);
-
-		if (activity < 0) {
-			perror("Select error");
-			continue;
-		}
-
-		// New train connection
-		if (FD_ISSET(serverSocket, &readfds)) {
-			handleTrainConnection(serverSocket);
-		}
-
-		// Message from CCS
-		if (FD_ISSET(ccsSocket, &readfds)) {
-			char buffer[BUFFER_SIZE];
-			int bytesRead = recv(ccsSocket, buffer, BUFFER_SIZE, 0);
-			if (bytesRead <= 0) {
-				printf("CCS disconnected. Exiting...\n");
-				break;
-			} else {
-				buffer[bytesRead] = '\0';
-				printf("Message from CCS: %s\n", buffer);
-
-				// Process CCS commands
-				int trackSection, speed, trainId;
-				if (sscanf(buffer, "MOVEMENT_AUTHORITY %d %d", &trackSection, &speed) == 2) {
-					broadcastMovementAuthority(trackSection, speed);
-				}
-
-				if (sscanf(buffer, "TRAIN_SPEED %d %d", &trainId, &speed) == 2) {
-						// Find the train and send speed command
-						for (int i = 0; i < trainCount; i++) {
-								if (trains[i].connected && trains[i].id == trainId) {
-										char speedCmd[BUFFER_SIZE];
-										sprintf(speedCmd, "SPEED_LIMIT %d", speed);
-										send(trains[i].socket, speedCmd, strlen(speedCmd), 0);
-										printf("Sent speed %d to Train %d\n", speed, trainId);
-										break;
-								}
-						}
-				}
-			}
-		}
-
-		// Check for user commands
-		if (FD_ISSET(STDIN_FILENO, &readfds)) {
-			char command[BUFFER_SIZE];
-			if (fgets(command, BUFFER_SIZE, stdin) != NULL) {
-				int trackSection, speed;
-				if (sscanf(command, "ma %d %d", &trackSection, &speed) == 2) {
-					broadcastMovementAuthority(trackSection, speed);
-				} else if (strncmp(command, "status", 6) == 0) {
-					printf("Track Sections Status:\n");
-					for (int i = 0; i < MAX_TRACK_SECTIONS; i++) {
-						printf("Section %d: Speed %d, %s\n", trackSections[i].id,
-									 trackSections[i].speed,
-									 trackSections[i].occupied ? "Occupied" : "Clear");
-					}
-				} else if (strncmp(command, "trains", 6) == 0) {
-					printf("Connected Trains:\n");
-					for (int i = 0; i < trainCount; i++) {
-						if (trains[i].connected) {
-							printf("Train %d in section %d\n", trains[i].id,
-										 trains[i].currentSection);
-						}
-					}
-                } else if (strncmp(command, "route_north", 11) == 0) {
-                    // Set switches for northbound route
-                    setSwitch(1, 1); // Set switch 1 to REVERSE
-                    printf("Setting northbound route\n");
-                    
-                    // Find Train 102 and direct it
-                    for (int i = 0; i < trainCount; i++) {
-                        if (trains[i].connected && trains[i].id == 102) {
-                            char routeMsg[BUFFER_SIZE];
-                            sprintf(routeMsg, "TAKE_NORTH_ROUTE");
-                            send(trains[i].socket, routeMsg, strlen(routeMsg), 0);
-                            break;
-                        }
-                    }
-				} else if (strncmp(command, "quit", 4) == 0) {
-					break;
-				}
-			}
-		}
-
-		// Check for messages from trains
-		for (int i = 0; i < trainCount; i++) {
-			if (trains[i].connected && FD_ISSET(trains[i].socket, &readfds)) {
-				char buffer[BUFFER_SIZE];
-				int bytesRead = recv(trains[i].socket, buffer, BUFFER_SIZE, 0);
-				if (bytesRead <= 0) {
-					close(trains[i].socket);
-					trains[i].connected = 0;
-					printf("Train %d disconnected\n", trains[i].id);
-					
-					// Clear the track section
-					if (trains[i].currentSection >= 1 && 
-							trains[i].currentSection <= MAX_TRACK_SECTIONS) {
-						trackSections[trains[i].currentSection - 1].occupied = 0;
-					}
-				} else {
-					buffer[bytesRead] = '\0';
-					processTrainUpdate(i, buffer);
-				}
-			}
-		}
+	if (eventLoopInit(&eventLoop) < 0) {
+		perror("Event loop creation failed");
+		exit(EXIT_FAILURE);
+	}
+	if (setNonBlocking(serverSocket) < 0 ||
+			eventLoopAdd(&eventLoop, serverSocket, EVENT_READ_EDGE, handleListener, NULL) < 0 ||
+			eventLoopAdd(&eventLoop, ccsSocket, EVENT_READ_EDGE, handleCcsMessage, NULL) < 0) {
+		perror("Event loop registration failed");
+		exit(EXIT_FAILURE);
 	}
+	// stdin may be a file or /dev/null, which epoll cannot watch. Unbuffered,
+	// a line not yet read stays in the kernel and keeps the fd readable.
+	setvbuf(stdin, NULL, _IONBF, 0);
+	eventLoopAdd(&eventLoop, STDIN_FILENO, EVENT_READ, handleUserCommand, NULL);
+	flushEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (flushEvent < 0 || eventLoopAdd(&eventLoop, flushEvent, EVENT_READ, handleFlush, NULL) < 0) {
+		perror("Bulk flush event setup failed");
+		exit(EXIT_FAILURE);
+	}
+	int topologyWatch = topologyWatchOpen(topologyImagePath());
+	if (topologyWatch < 0 || eventLoopAdd(&eventLoop, topologyWatch, EVENT_READ, handleTopologyChange, NULL) < 0) {
+		perror("Watching the topology image failed, changes need a restart");
+	}
+	notifyReady();
+
+	eventLoopRun(&eventLoop);
 
 	// Clean up
 	for (int i = 0; i < trainCount; i++) {
 		if (trains[i].connected) {
 			close(trains[i].socket);
+			sendQueueFree(&trains[i].queue);
 		}
 	}
+	free(trains);
+	free(flushList);
+	free(trackSections);
+	free(stations);
+	topologyClose(&topology);
+	eventLoopClose(&eventLoop);
+	if (topologyWatch >= 0) close(topologyWatch);
+	close(flushEvent);
 	close(serverSocket);
 	close(ccsSocket);
 	close(multicastSocket);
+	if (sharedState != MAP_FAILED)
+		munmap(sharedState, sizeof(SharedState));
 	return 0;
 }